@@ -83,7 +83,7 @@ int main(int argc, const char** argv)
 	// connect poly object to audio and midi servers
 	AudioServer::GetInstance()->AddClient(&p, 0);
 	AudioServer::GetInstance()->AddClient(&p, 1);
-	MidiServer::GetInstance()->AddClient(&p, 0);
+	MidiServer::GetInstance()->AddClient(&p, MidiServer::kOmni);
 	
 	TypingKeyboard k;
 	k.SetOctave(4);
@@ -0,0 +1,38 @@
+#ifndef h_AlignedMemory
+#define h_AlignedMemory
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace MusKit
+{
+
+   static const size_t kCacheLineSize = 64;
+
+   /// Allocates memory aligned to a cache line (or any power of 2 alignment).
+   /// Release with AlignedFree.  Throws std::bad_alloc on failure.
+   inline void* AlignedAlloc(size_t bytes, size_t alignment = kCacheLineSize)
+   {
+      void* p = NULL;
+      if (bytes == 0)
+         bytes = alignment;
+      if (posix_memalign(&p, alignment, bytes) != 0)
+         throw std::bad_alloc();
+      return p;
+   }
+
+   inline void AlignedFree(void* p)
+   {
+      free(p);
+   }
+
+   /// Rounds a byte count up to a whole number of cache lines
+   inline size_t RoundToCacheLine(size_t bytes)
+   {
+      return (bytes + kCacheLineSize - 1) & ~(kCacheLineSize - 1);
+   }
+
+};
+
+#endif
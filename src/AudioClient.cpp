@@ -1,40 +1,190 @@
 #include "AudioClient.h"
 #include "AudioServer.h"
 
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <typeinfo>
+
+#include "AlignedMemory.h"
+#include "Profiler.h"
+
+//------ BlockCache ------//
+
+BlockCache::BlockCache(int numChannels)
+: fNumChannels(numChannels)
+, fBuffers(NULL)
+, fCapacity(0)
+, fStart(0)
+, fFrames(0)
+{
+	fBuffers = new float*[numChannels];
+	for (int c = 0; c < numChannels; ++c)
+	{
+		fBuffers[c] = NULL;
+	}
+}
+
+BlockCache::~BlockCache()
+{
+	for (int c = 0; c < fNumChannels; ++c)
+	{
+		MusKit::AlignedFree(fBuffers[c]);
+	}
+	delete[] fBuffers;
+}
+
+void BlockCache::Reserve(int maxFrames)
+{
+	if (maxFrames <= fCapacity)
+		return;
+	
+	for (int c = 0; c < fNumChannels; ++c)
+	{
+		float* buffer = (float*)MusKit::AlignedAlloc(maxFrames * sizeof(float));
+		if (fBuffers[c])
+		{
+			memcpy(buffer, fBuffers[c], fFrames * sizeof(float));
+		}
+		MusKit::AlignedFree(fBuffers[c]);
+		fBuffers[c] = buffer;
+	}
+	fCapacity = maxFrames;
+}
+
+int BlockCache::Begin(SampleTime time, int frames)
+{
+	const SampleTime distance = time - fStart;
+	int offset = (int)distance;
+	if (fFrames == 0 || distance < 0 || distance > fFrames)
+	{
+		// not contiguous with what's cached, start over
+		fStart = time;
+		fFrames = 0;
+		offset = 0;
+	}
+	
+	const int cached = std::min(frames, fFrames - offset);
+	
+	if (offset + frames > fCapacity)
+	{
+		// drop everything before time to make room
+		for (int c = 0; c < fNumChannels; ++c)
+		{
+			memmove(fBuffers[c], fBuffers[c] + offset, (fFrames - offset) * sizeof(float));
+		}
+		fStart = time;
+		fFrames -= offset;
+		
+		// only happens if the client wasn't prepared for this block size
+		Reserve(std::max(frames, AudioServer::GetInstance()->MaxBlockSize()));
+	}
+	
+	return cached;
+}
+
+//------ AudioClient ------//
+
 AudioClient::AudioClient()
-: fLastBufferSize(0)
-, fCachedBuffer(NULL)
-, fLastTime(0)
 {
 }
 
+AudioClient::~AudioClient()
+{
+}
+
+void AudioClient::Prepare(int maxFrames)
+{
+	fCache.Reserve(maxFrames);
+}
+
 void AudioClient::Process(float* buffer, int frames)
 {
-	if (!fCachedBuffer)
+	const SampleTime now = AudioServer::GetInstance()->Time();
+	const int cached = fCache.Begin(now, frames);
+	float* out = fCache.Buffer(0) + fCache.Position(now);
+	
+	if (cached < frames)
 	{
-		fCachedBuffer = new float[frames];
-		memset(fCachedBuffer, 0.f, frames * sizeof(float));
-		this->Render(fCachedBuffer, frames);
-		fLastTime = AudioServer::GetInstance()->Time();
+		// the rest starts cached frames later, make sure inputs see that time
+		AudioServer::SubBlock subBlock(cached);
+		memset(out + cached, 0, (frames - cached) * sizeof(float));
+#ifdef qProfile
+		ProfileScope profile(this, typeid(*this).name(), now + cached, frames - cached);
+#endif
+		this->Render(out + cached, frames - cached);
+		fCache.Commit(frames - cached);
 	}
 	
-	if (fLastTime != AudioServer::GetInstance()->Time())
+	memcpy(buffer, out, frames * sizeof(float));
+}
+
+
+//------ MultiOutputClient ------//
+
+MultiOutputClient::MultiOutputClient(int numOutputs)
+: fNumOutputs(numOutputs)
+, fOutputs(NULL)
+, fChannelCache(numOutputs)
+, fChannelPointers(NULL)
+{
+	fOutputs = new OutputTap[numOutputs];
+	fChannelPointers = new float*[numOutputs];
+	for (int c = 0; c < numOutputs; ++c)
+	{
+		fOutputs[c].fOwner = this;
+		fOutputs[c].fChannel = c;
+	}
+}
+
+MultiOutputClient::~MultiOutputClient()
+{
+	delete[] fChannelPointers;
+	delete[] fOutputs;
+}
+
+AudioClient* MultiOutputClient::Output(int channel)
+{
+	assert(channel >= 0 && channel < fNumOutputs);
+	return &fOutputs[channel];
+}
+
+void MultiOutputClient::Render(float* buffer, int frames)
+{
+	ProcessChannel(0, buffer, frames);
+}
+
+void MultiOutputClient::Prepare(int maxFrames)
+{
+	AudioClient::Prepare(maxFrames);
+	fChannelCache.Reserve(maxFrames);
+	for (int c = 0; c < fNumOutputs; ++c)
 	{
-      if (frames != fLastBufferSize)
-      {
-         delete[] fCachedBuffer;
-         fCachedBuffer = NULL;
-         fCachedBuffer = new float[frames];
-         fLastBufferSize = frames;
-      }
-      
-		memset(fCachedBuffer, 0.f, frames * sizeof(float));
-		this->Render(fCachedBuffer, frames);
-		fLastTime = AudioServer::GetInstance()->Time();
+		fOutputs[c].AudioClient::Prepare(maxFrames);
 	}
+}
+
+void MultiOutputClient::ProcessChannel(int channel, float* buffer, int frames)
+{
+	const SampleTime now = AudioServer::GetInstance()->Time();
+	const int cached = fChannelCache.Begin(now, frames);
+	const int position = fChannelCache.Position(now);
 	
-	for (int i = 0; i < frames; ++i)
+	if (cached < frames)
 	{
-		buffer[i] = fCachedBuffer[i];
+		for (int c = 0; c < fNumOutputs; ++c)
+		{
+			fChannelPointers[c] = fChannelCache.Buffer(c) + position + cached;
+			memset(fChannelPointers[c], 0, (frames - cached) * sizeof(float));
+		}
+		
+		AudioServer::SubBlock subBlock(cached);
+#ifdef qProfile
+		ProfileScope profile(this, typeid(*this).name(), now + cached, frames - cached);
+#endif
+		this->RenderChannels(fChannelPointers, fNumOutputs, frames - cached);
+		fChannelCache.Commit(frames - cached);
 	}
+	
+	memcpy(buffer, fChannelCache.Buffer(channel) + position, frames * sizeof(float));
 }
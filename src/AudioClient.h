@@ -2,6 +2,10 @@
 #define h_AudioClient
 
 #include <cstdlib>
+#include <stdint.h>
+
+/// Server time in samples.  64 bits, so it never wraps in practice.
+typedef int64_t SampleTime;
 
 // AudioClient
 // ----------------
@@ -15,11 +19,56 @@
 /// Consumers of a client's output (i.e. the DAC or another client) should
 /// obtain the output using Process, as this method will return either a freshly
 /// rendered block or a cached copy of a previously rendered block
+///
+/// Clients are prepared once with the largest block they will be asked for
+/// (AudioServer does this when a client is added and when the block size
+/// changes), after which Process may be called with any length up to that,
+/// including sub-blocks of the server's block (see AudioServer::SubBlock).
+/// The cache covers a span of time rather than a single block, so asking for
+/// a sub-block that was already rendered, or for a longer span that starts
+/// inside it, only renders the frames that are new.
+
+// BlockCache
+// ----------------
+/// \brief One or more channels of rendered output for a contiguous span of
+/// server time.
+///
+/// Begin(time, frames) makes room for [time, time + frames) and returns how
+/// many frames from time onwards are already cached; the caller renders the
+/// rest at Buffer(c) + Position(time) + cached and then calls Commit.
+
+class BlockCache
+{
+public:
+	BlockCache(int numChannels = 1);
+	~BlockCache();
+	
+	/// Allocates room for maxFrames per channel; keeps what is cached
+	void Reserve(int maxFrames);
+	
+	int Begin(SampleTime time, int frames);
+	void Commit(int frames) { fFrames += frames; }
+	
+	float* Buffer(int channel) const { return fBuffers[channel]; }
+	int Position(SampleTime time) const { return (int)(time - fStart); }
+	int Capacity() const { return fCapacity; }
+	
+private:
+	BlockCache(const BlockCache&);
+	BlockCache& operator=(const BlockCache&);
+	
+	int fNumChannels;
+	float** fBuffers;
+	int fCapacity;
+	SampleTime fStart;
+	int fFrames;
+};
 
 class AudioClient
 {
 public:
 	AudioClient();
+	virtual ~AudioClient();
 	
 	// Subclasses must override this
 	virtual void Render(float* buffer, int frames) = 0;
@@ -27,10 +76,72 @@ public:
 	// Consumers of client output should call this
 	virtual void Process(float* buffer, int frames);
 	
+	/// Allocates everything needed to render up to maxFrames at a time.
+	/// Subclasses that own buffers or inputs should override it, call the base
+	/// class version and pass it on to their inputs.  Not realtime safe.
+	virtual void Prepare(int maxFrames);
+	
+protected:
+	BlockCache fCache;
+};
+
+// MultiOutputClient
+// ----------------
+/// \brief Base class for clients that produce several channels at once (stereo
+/// panners, multichannel effects).
+///
+/// Subclasses override RenderChannels.  Each channel is exposed as an ordinary
+/// AudioClient through Output(channel), so it can be connected to the DAC or to
+/// other clients.  All channels are rendered together the first time any of
+/// them is asked for in a block, and cached for the rest.
+///
+/// Used directly as an AudioClient, a MultiOutputClient produces channel 0.
+
+class MultiOutputClient : public AudioClient
+{
+public:
+	MultiOutputClient(int numOutputs);
+	virtual ~MultiOutputClient();
+	
+	// Subclasses must override this.  buffers are zeroed before the call.
+	virtual void RenderChannels(float** buffers, int numChannels, int frames) = 0;
+	
+	void Render(float* buffer, int frames);
+	
+	void Prepare(int maxFrames);
+	
+	AudioClient* Output(int channel);
+	
+	int NumOutputs() const { return fNumOutputs; }
+	
 protected:
-	int fLastBufferSize;
-	float* fCachedBuffer;
-	unsigned fLastTime;
+	void ProcessChannel(int channel, float* buffer, int frames);
+	
+private:
+	class OutputTap : public AudioClient
+	{
+	public:
+		OutputTap() : fOwner(NULL), fChannel(0) {}
+		
+		void Render(float* buffer, int frames)
+		{
+			fOwner->ProcessChannel(fChannel, buffer, frames);
+		}
+		
+		void Prepare(int maxFrames)
+		{
+			AudioClient::Prepare(maxFrames);
+			fOwner->Prepare(maxFrames);
+		}
+		
+		MultiOutputClient* fOwner;
+		int fChannel;
+	};
+	
+	int fNumOutputs;
+	OutputTap* fOutputs;
+	BlockCache fChannelCache;
+	float** fChannelPointers;
 };
 
 #endif
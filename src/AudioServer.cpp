@@ -1,30 +1,113 @@
 #include "AudioServer.h"
 
 #include <cassert>
+#include <cstring>
+
+#include "Dynamics.h"
+#include "Profiler.h"
+#include "QualityGovernor.h"
 
 
 AudioServer* AudioServer::sInstance = NULL;
 
+thread_local unsigned AudioServer::sSubBlockOffset = 0;
+thread_local bool AudioServer::sWorkerClock = false;
+thread_local SampleTime AudioServer::sWorkerTime = 0;
+
+static const int kDefaultMaxBlockSize = 1024;
+
 AudioServer::AudioServer()
 : fFs(44100.f)
 , fTime(0)
 , fInputBuffer(NULL)
+, fInputBufferSize(0)
+, fMaxBlockSize(0)
 , fInputChannels(1)
 , fOutputChannels(1)
+, fOutputLimiter(NULL)
 {
+	SetMaxBlockSize(kDefaultMaxBlockSize);
+	
+	// created here rather than on the audio thread
+	QualityGovernor::GetInstance();
+	Profiler::GetInstance();
 }
 
 AudioServer::~AudioServer()
 {
 	fChannelClientMap.clear();
+	delete[] fInputBuffer;
+	delete fOutputLimiter;
+}
+
+void AudioServer::SetMaxBlockSize(int frames)
+{
+	fMaxBlockSize = frames;
+	fScratch.Reserve(frames);
+	ReserveInput(frames);
+	if (fOutputLimiter)
+		fOutputLimiter->Prepare(frames);
+	
+	ChannelClientMap::iterator channel;
+	for (channel = fChannelClientMap.begin(); channel != fChannelClientMap.end(); ++channel)
+	{
+		AudioClientList& clients = (*channel).second;
+		for (AudioClientList::iterator i = clients.begin(); i != clients.end(); ++i)
+		{
+			(*i)->Prepare(frames);
+		}
+	}
+}
+
+int AudioServer::MaxBlockSize() const
+{
+	return fMaxBlockSize;
+}
+
+void AudioServer::EnableOutputLimiter(float ceiling)
+{
+	// built and prepared outside the lock, swapped in under it
+	Limiter* limiter = new Limiter(fOutputChannels);
+	limiter->SetCeiling(ceiling);
+	limiter->Prepare(fMaxBlockSize);
+	
+	fLock.lock();
+	Limiter* previous = fOutputLimiter;
+	fOutputLimiter = limiter;
+	fOutputChannelBuffers.resize(fOutputChannels);
+	fLock.unlock();
+	
+	delete previous;
+}
+
+void AudioServer::DisableOutputLimiter()
+{
+	fLock.lock();
+	Limiter* previous = fOutputLimiter;
+	fOutputLimiter = NULL;
+	fLock.unlock();
+	
+	delete previous;
+}
+
+void AudioServer::ReserveInput(int frames)
+{
+	const int size = frames * fInputChannels;
+	if (size > fInputBufferSize)
+	{
+		delete[] fInputBuffer;
+		fInputBuffer = new float[size];
+		memset(fInputBuffer, 0, size * sizeof(float));
+		fInputBufferSize = size;
+	}
 }
 
 void AudioServer::AudioServerCallback(const float** inBuffer, float** outBuffer, unsigned frames)
 {
-    float inputBuffer[frames * fInputChannels];
-    memset(inputBuffer, 0, frames * fInputChannels * sizeof(float));
-    float outputBuffer[frames * fOutputChannels];
-    memset(outputBuffer, 0, frames * fInputChannels * sizeof(float));
+    ScratchArena::Bind(&fScratch);
+    ScratchBuffer inputBuffer(frames * fInputChannels);
+    ScratchBuffer outputBuffer(frames * fOutputChannels);
+    memset(outputBuffer, 0, frames * fOutputChannels * sizeof(float));
     int i = 0;
     for (int c = 0; c < fInputChannels; ++c)
     {
@@ -42,15 +125,20 @@ void AudioServer::AudioServerCallback(const float** inBuffer, float** outBuffer,
 
 void AudioServer::AudioServerCallback(float* inBuffer, float* outBuffer, unsigned frames)
 {
+	// time spent waiting for the lock counts against the deadline too
+	fLoadMonitor.BeginBlock();
 	fLock.lock();
+#ifdef qProfile
+	ProfileScope profile(NULL, "block", fTime, frames);
+#endif
+	ScratchArena::Bind(&fScratch);
 	float* buffer = (float*)outBuffer;
-	float tmp[frames];
+	ScratchBuffer tmp(frames);
 	
-	if (fInputBuffer)
-	{
-		delete[] fInputBuffer;
-	}
-	fInputBuffer = new float[frames * fInputChannels];
+	fTransport.BeginBlock(fTime, frames, fFs);
+	
+	// only grows if the driver breaks its SetMaxBlockSize promise
+	ReserveInput(frames);
 	for (int i = 0; i < frames * fInputChannels; ++i)
 	{
 		fInputBuffer[i] = inBuffer[i];
@@ -77,23 +165,24 @@ void AudioServer::AudioServerCallback(float* inBuffer, float* outBuffer, unsigne
 				{
 					buffer[frame] += tmp[frame];
 				}
-#if 0
-				// check for signals out of range [-1, 1]
-				for (int frame = 0; frame < frames; ++frame)
-				{
-					if (abs(buffer[frame]) > 1.f)
-					{
-						std::cout << "clip!\n";
-						buffer[frame] = (rand() % 32768) / 32768.f - 0.5f;
-					}
-				}
-#endif				
 			}
 		}
 		buffer = buffer + frames;
 	}
 	
+	if (fOutputLimiter)
+	{
+		const int channels = std::min(fOutputChannels, (int)fOutputChannelBuffers.size());
+		for (int channel = 0; channel < channels; ++channel)
+		{
+			fOutputChannelBuffers[channel] = outBuffer + channel * frames;
+		}
+		fOutputLimiter->Apply(&fOutputChannelBuffers[0], channels, frames);
+	}
+	
 	fTime += frames;
+	fLoadMonitor.EndBlock(frames, fFs);
+	QualityGovernor::GetInstance()->Update(fLoadMonitor, frames, fFs);
 	fLock.unlock();
 }
 
@@ -123,6 +212,7 @@ void AudioServer::AddClient(AudioClient* c, int channelIndex)
 	AudioClientList::iterator clientiter = std::find(clients->begin(), clients->end(), c);
 	if (clientiter == clients->end())
 	{
+		c->Prepare(fMaxBlockSize);
 		clients->push_back(c);
 	}
 }
@@ -160,6 +250,7 @@ float AudioServer::Fs() const
 void AudioServer::SetInputChannels(int channels)
 {
 	fInputChannels = channels;
+	ReserveInput(fMaxBlockSize);
 }
 
 int AudioServer::InputChannels() const { return fInputChannels; }
@@ -171,7 +262,7 @@ void AudioServer::SetOutputChannels(int channels)
 
 int AudioServer::OutputChannels() const { return fOutputChannels; }
 
-unsigned AudioServer::Time() const
+SampleTime AudioServer::Time() const
 {
-	return fTime;
+	return (sWorkerClock ? sWorkerTime : fTime) + sSubBlockOffset;
 }
@@ -2,12 +2,21 @@
 #define h_AudioServer
 
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <mutex>
 
 #include "RtAudio.h"
 
 #include "AudioClient.h"
+#include "LoadMonitor.h"
+#include "Profiler.h"
+#include "QualityGovernor.h"
+#include "ScratchArena.h"
+#include "Transport.h"
+
+class Limiter;
 
 // AudioServer
 // ----------------
@@ -19,7 +28,22 @@
 /// handle deallocation--make sure to delete clients after they are removed!
 ///
 /// There is a notion of time in the form of a running sample count used by clients
-/// to know whether or not to render new audio when asked for output
+/// to know whether or not to render new audio when asked for output.  It is 64
+/// bits wide, so it doesn't wrap however long the server runs.
+///
+/// The server also owns the Transport (tempo, beat position, play state).  It
+/// is advanced at the start of each block, and clients read it with
+/// GetTransport()->State().
+///
+/// Each callback is timed against its real-time budget by the LoadMonitor
+/// (GetLoadMonitor()), for CPU meters and overrun alarms, and the load
+/// drives the QualityGovernor.
+///
+/// Call SetMaxBlockSize before starting the stream so that the input buffer
+/// and the callback's ScratchArena are allocated up front.
+///
+/// EnableOutputLimiter puts a linked brickwall Limiter across all output
+/// channels after the clients are mixed, as a safety stage against overs.
 ///
 class AudioServer
 {
@@ -60,7 +84,86 @@ public:
 	
 	int OutputChannels() const;
 	
-	unsigned Time() const;
+	/// Start of the block (or sub-block) being rendered, in samples.  On a
+	/// thread with a WorkerClock, the time that thread is rendering for.
+	SampleTime Time() const;
+	
+	Transport* GetTransport() { return &fTransport; }
+	
+	LoadMonitor* GetLoadMonitor() { return &fLoadMonitor; }
+	
+	// SubBlock
+	// ----------------
+	/// \brief While in scope, moves Time() forward by offset samples so that
+	/// clients rendered from here cache a sub-block of the current block.
+	///
+	///    AudioServer::SubBlock subBlock(offset);
+	///    client->Process(buffer + offset, frames - offset);
+	///
+	/// Sub-blocks nest: offsets are relative to the enclosing one.  The offset
+	/// is per thread, so worker threads (see WorkerClock) can use them too.
+	class SubBlock
+	{
+	public:
+		SubBlock(int offset)
+		: fPrevious(sSubBlockOffset)
+		{
+			sSubBlockOffset += offset;
+		}
+		
+		~SubBlock()
+		{
+			sSubBlockOffset = fPrevious;
+		}
+		
+	private:
+		unsigned fPrevious;
+	};
+	
+	// WorkerClock
+	// ----------------
+	/// \brief While in scope, Time() on the calling thread returns time (plus
+	/// any SubBlock offsets) instead of the server's clock.
+	///
+	/// For threads that render clients ahead of the callback (RenderAhead):
+	/// the clients cache and schedule against the time they're rendering
+	/// for.  Other threads are unaffected.
+	class WorkerClock
+	{
+	public:
+		WorkerClock(SampleTime time)
+		: fPrevious(sWorkerTime)
+		, fPreviousActive(sWorkerClock)
+		{
+			sWorkerTime = time;
+			sWorkerClock = true;
+		}
+		
+		~WorkerClock()
+		{
+			sWorkerTime = fPrevious;
+			sWorkerClock = fPreviousActive;
+		}
+		
+	private:
+		SampleTime fPrevious;
+		bool fPreviousActive;
+	};
+	
+	/// Largest block the driver will ask for.  Prepares every connected client,
+	/// so call it before the stream starts.
+	void SetMaxBlockSize(int frames);
+	
+	int MaxBlockSize() const;
+	
+	/// Limits the mixed output to ceiling (dBFS), delaying it by
+	/// OutputLimiter()->Latency() samples.  Allocates, so call it from a
+	/// control thread, after SetOutputChannels.
+	void EnableOutputLimiter(float ceiling = -0.3f);
+	void DisableOutputLimiter();
+	
+	/// NULL when disabled
+	Limiter* OutputLimiter() { return fOutputLimiter; }
    
    void EnterLock() { fLock.lock(); }
    void ExitLock() { fLock.unlock(); }
@@ -68,7 +171,13 @@ public:
 private:
 	static AudioServer* sInstance;
 	
+	void ReserveInput(int frames);
+	
 	float* fInputBuffer;
+	int fInputBufferSize;
+	
+	int fMaxBlockSize;
+	ScratchArena fScratch;
 	
 	typedef std::vector<AudioClient*> AudioClientList;
 	typedef std::map<int, AudioClientList> ChannelClientMap;
@@ -78,7 +187,17 @@ private:
 	int fInputChannels;
 	int fOutputChannels;
 	
-	unsigned fTime;
+	SampleTime fTime;
+	
+	static thread_local unsigned sSubBlockOffset;
+	static thread_local bool sWorkerClock;
+	static thread_local SampleTime sWorkerTime;
+	
+	Transport fTransport;
+	LoadMonitor fLoadMonitor;
+	
+	Limiter* fOutputLimiter;
+	std::vector<float*> fOutputChannelBuffers;  // for fOutputLimiter
 	
     std::mutex fLock;
 };
@@ -122,6 +241,7 @@ public:
 		
 		try {
 			dac.openStream( &oParams, &iParams, RTAUDIO_FLOAT32, fs, &bufferFrames, &callback, (void *)data, &options );
+			AudioServer::GetInstance()->SetMaxBlockSize(bufferFrames);
 			dac.startStream();			
 			AudioServer::GetInstance()->SetFs(fs);
 			AudioServer::GetInstance()->SetOutputChannels(channels);
@@ -159,6 +279,8 @@ private:
 	static int callback( void *outputBuffer, void *inputBuffer, unsigned int nBufferFrames,
 						double streamTime, RtAudioStreamStatus status, void *data )
 	{
+		if (status)
+			Profiler::GetInstance()->CountXrun();
 		AudioServer::GetInstance()->AudioServerCallback((float*)inputBuffer,
 														(float*)outputBuffer,
 														nBufferFrames);
@@ -174,4 +296,65 @@ private:
 };
 
 
+// OfflineDriver
+// ----------------
+/// \brief Drives the AudioServer without a device, as fast as the graph
+/// renders, for rendering to memory or disk (a Sequencer playing a MidiFile,
+/// say).
+///
+/// The input is silent.  Output is written one buffer per channel.  While
+/// the driver exists the QualityGovernor is forced to kQualityHigh.
+class OfflineDriver
+{
+public:
+	OfflineDriver(unsigned bufferFrames = 512, float fs = 44100.f, int channels = 2)
+	: fBufferFrames(bufferFrames)
+	, fChannels(channels)
+	{
+		AudioServer* server = AudioServer::GetInstance();
+		server->SetFs(fs);
+		server->SetOutputChannels(channels);
+		server->SetMaxBlockSize(bufferFrames);
+		
+		fInput = new float[bufferFrames * std::max(server->InputChannels(), 1)];
+		memset(fInput, 0, bufferFrames * std::max(server->InputChannels(), 1) * sizeof(float));
+		fOutput = new float[bufferFrames * channels];
+		
+		// nothing is waiting on an offline render, so never cut corners
+		QualityGovernor::GetInstance()->Force(QualityGovernor::kQualityHigh);
+	}
+	
+	~OfflineDriver()
+	{
+		QualityGovernor::GetInstance()->Release();
+		delete[] fInput;
+		delete[] fOutput;
+	}
+	
+	/// Renders the next frames samples into output[channel] (NULL entries are
+	/// skipped), in blocks of at most bufferFrames
+	void Render(float** output, int frames)
+	{
+		int done = 0;
+		while (done < frames)
+		{
+			const int n = std::min((int)fBufferFrames, frames - done);
+			AudioServer::GetInstance()->AudioServerCallback(fInput, fOutput, n);
+			
+			for (int c = 0; c < fChannels; ++c)
+			{
+				if (output[c])
+					memcpy(output[c] + done, fOutput + c * n, n * sizeof(float));
+			}
+			done += n;
+		}
+	}
+	
+private:
+	unsigned fBufferFrames;
+	int fChannels;
+	float* fInput;
+	float* fOutput;
+};
+
 #endif
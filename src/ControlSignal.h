@@ -0,0 +1,53 @@
+#ifndef h_ControlSignal
+#define h_ControlSignal
+
+// ControlSignal
+// ----------------
+/// \brief A control-rate value: one value per control period (a sub-block of
+/// N samples) rather than one per sample.
+///
+/// Whoever produces the signal calls Set once per period.  Consumers that only
+/// need a number per period use Value(); consumers that apply it at audio rate
+/// use Fill, which ramps from the previous period's value to the current one
+/// so that stepping doesn't cause zipper noise.
+class ControlSignal
+{
+public:
+   ControlSignal(float initialValue = 0.f)
+   : fPrevious(initialValue)
+   , fCurrent(initialValue)
+   {
+   }
+
+   void Set(float value)
+   {
+      fPrevious = fCurrent;
+      fCurrent = value;
+   }
+
+   /// Sets the value without a ramp from the previous one
+   void Reset(float value)
+   {
+      fPrevious = fCurrent = value;
+   }
+
+   float Value() const { return fCurrent; }
+   float Previous() const { return fPrevious; }
+
+   /// Writes a linear ramp from Previous() towards Value() that arrives on the
+   /// last sample
+   void Fill(float* out, int frames) const
+   {
+      const float step = (fCurrent - fPrevious) / frames;
+      for (int i = 0; i < frames; ++i)
+      {
+         out[i] = fPrevious + step * (i + 1);
+      }
+   }
+
+private:
+   float fPrevious;
+   float fCurrent;
+};
+
+#endif
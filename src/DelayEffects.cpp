@@ -0,0 +1,398 @@
+#include "DelayEffects.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "QualityGovernor.h"
+#include "ScratchArena.h"
+
+// longest chorus and flanger delays, in seconds
+static const float kMaxChorusSeconds = 0.05f;
+static const float kMaxFlangerSeconds = 0.02f;
+
+// feedback is kept just short of unity so the loops always decay
+static const float kMaxFeedback = 0.99f;
+
+// Lagrange3 when there's time for it
+static int ModulatedInterpolation()
+{
+   return QualityGovernor::GetInstance()->Quality() >= QualityGovernor::kQualityHigh
+      ? DelayLine::kInterpolationLagrange3
+      : DelayLine::kInterpolationLinear;
+}
+
+static void RenderInput(AudioClient* input, float* buffer, int frames)
+{
+   if (input)
+      input->Process(buffer, frames);
+   else
+      memset(buffer, 0, frames * sizeof(float));
+}
+
+// from to to across frames
+static void Ramp(float* out, int frames, float from, float to)
+{
+   const float step = (to - from) / frames;
+   for (int i = 0; i < frames; ++i)
+      out[i] = from + step * (i + 1);
+}
+
+//
+// DelaySweep
+//
+
+DelaySweep::DelaySweep(float rate, int shape)
+: fLfo(rate, shape)
+, fValue(0.f)
+, fTarget(0.f)
+, fStep(0.f)
+, fLeft(0)
+{
+   Reset();
+}
+
+void DelaySweep::Reset(float phase)
+{
+   fLfo.Reset(phase);
+   fValue = fTarget = fLfo.Tick(kControlPeriod);
+   fStep = 0.f;
+   fLeft = 0;
+}
+
+void DelaySweep::Fill(float* delays, int frames, float centre, float depth)
+{
+   int i = 0;
+   while (i < frames)
+   {
+      if (fLeft == 0)
+      {
+         fValue = fTarget;
+         fTarget = fLfo.Tick(kControlPeriod);
+         fStep = (fTarget - fValue) / kControlPeriod;
+         fLeft = kControlPeriod;
+      }
+
+      const int n = std::min(fLeft, frames - i);
+      const float value = fValue;
+      const float step = fStep;
+      for (int k = 0; k < n; ++k)
+         delays[i + k] = centre + depth * (value + step * k);
+
+      fValue += step * n;
+      fLeft -= n;
+      i += n;
+   }
+}
+
+//
+// Chorus
+//
+
+Chorus::Chorus(AudioClient* input, int voices)
+: fInput(input)
+, fVoices(1)
+, fDelay(0.015f)
+, fDepth(0.003f)
+, fMix(0.5f)
+{
+   SetVoices(voices);
+   SetRate(0.8f);
+}
+
+void Chorus::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   fLine.Allocate((int)ceilf(kMaxChorusSeconds * fs) + 2, maxFrames);
+}
+
+void Chorus::SetVoices(int voices)
+{
+   fVoices = std::max(1, std::min(voices, (int)kMaxVoices));
+   for (int v = 0; v < fVoices; ++v)
+      fSweeps[v].Reset((float)v / fVoices);
+}
+
+void Chorus::SetRate(float rate)
+{
+   for (int v = 0; v < kMaxVoices; ++v)
+      fSweeps[v].SetRate(rate);
+}
+
+void Chorus::Render(float* buffer, int frames)
+{
+   RenderInput(fInput, buffer, frames);
+   fLine.Write(buffer, frames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const float longest = (float)(fLine.MaxDelay() - 2);
+   const float depth = std::min(fDepth * fs, longest * 0.5f);
+   const float centre = std::max(depth + 1.f, std::min(fDelay * fs, longest - depth));
+   const int type = ModulatedInterpolation();
+
+   ScratchBuffer delays(frames);
+   ScratchBuffer voice(frames);
+   ScratchBuffer wet(frames);
+   memset(wet, 0, frames * sizeof(float));
+
+   for (int v = 0; v < fVoices; ++v)
+   {
+      fSweeps[v].Fill(delays, frames, centre, depth);
+      fLine.Read(voice, frames, delays, type);
+      for (int i = 0; i < frames; ++i)
+         wet[i] += voice[i];
+   }
+
+   const float dry = 1.f - fMix;
+   const float gain = fMix / fVoices;
+   for (int i = 0; i < frames; ++i)
+      buffer[i] = dry * buffer[i] + gain * wet[i];
+}
+
+//
+// Flanger
+//
+
+Flanger::Flanger(AudioClient* input)
+: fInput(input)
+, fSweep(0.25f)
+, fDelay(0.003f)
+, fDepth(0.002f)
+, fFeedback(0.5f)
+, fMix(0.5f)
+{
+}
+
+void Flanger::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   fLine.Allocate((int)ceilf(kMaxFlangerSeconds * fs) + 2, maxFrames);
+}
+
+void Flanger::Render(float* buffer, int frames)
+{
+   RenderInput(fInput, buffer, frames);
+
+   // ReadNext with Lagrange3 needs every delay at least 2 samples past its
+   // frame in the chunk
+   const float fs = AudioServer::GetInstance()->Fs();
+   const float longest = (float)(fLine.MaxDelay() - 2);
+   const float depth = std::min(fDepth * fs, longest * 0.5f);
+   const float centre = std::max(depth + 3.f, std::min(fDelay * fs, longest - depth));
+   const float feedback = std::max(-kMaxFeedback, std::min(fFeedback, kMaxFeedback));
+   const int type = ModulatedInterpolation();
+
+   ScratchBuffer delays(frames);
+   ScratchBuffer wet(frames);
+   ScratchBuffer send(frames);
+   fSweep.Fill(delays, frames, centre, depth);
+
+   const float shortest = *std::min_element((float*)delays, (float*)delays + frames);
+   const int chunk = std::max((int)shortest - 1, 1);
+
+   for (int pos = 0; pos < frames; pos += chunk)
+   {
+      const int n = std::min(chunk, frames - pos);
+      fLine.ReadNext(wet + pos, n, delays + pos, type);
+      for (int i = pos; i < pos + n; ++i)
+         send[i] = buffer[i] + feedback * wet[i];
+      fLine.Write(send + pos, n);
+   }
+
+   const float dry = 1.f - fMix;
+   for (int i = 0; i < frames; ++i)
+      buffer[i] = dry * buffer[i] + fMix * wet[i];
+}
+
+//
+// MultiTapDelay
+//
+
+MultiTapDelay::MultiTapDelay(AudioClient* input, float maxSeconds)
+: fInput(input)
+, fMaxSeconds(maxSeconds)
+, fFeedback(0.f)
+, fDry(1.f)
+{
+   for (int t = 0; t < kMaxTaps; ++t)
+   {
+      fTaps[t].fSeconds = 0.f;
+      fTaps[t].fGain = 0.f;
+      fTaps[t].fDelay = -1.f;
+   }
+}
+
+void MultiTapDelay::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   fLine.Allocate((int)ceilf(fMaxSeconds * fs) + 1, maxFrames);
+}
+
+void MultiTapDelay::SetTap(int tap, float seconds, float gain)
+{
+   if (tap < 0 || tap >= kMaxTaps)
+      return;
+
+   fTaps[tap].fSeconds = seconds;
+   fTaps[tap].fGain = gain;
+}
+
+int MultiTapDelay::LongestTap() const
+{
+   int longest = -1;
+   for (int t = 0; t < kMaxTaps; ++t)
+   {
+      if (fTaps[t].fGain != 0.f && (longest < 0 || fTaps[t].fSeconds > fTaps[longest].fSeconds))
+         longest = t;
+   }
+   return longest;
+}
+
+void MultiTapDelay::Render(float* buffer, int frames)
+{
+   RenderInput(fInput, buffer, frames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const float longest = (float)fLine.MaxDelay();
+
+   // this block's delay for each tap, ramping from the last block's
+   float from[kMaxTaps];
+   float to[kMaxTaps];
+   for (int t = 0; t < kMaxTaps; ++t)
+   {
+      to[t] = std::max(1.f, std::min(fTaps[t].fSeconds * fs, longest));
+      from[t] = fTaps[t].fDelay < 0.f ? to[t] : fTaps[t].fDelay;
+      fTaps[t].fDelay = to[t];
+   }
+
+   ScratchBuffer delays(frames);
+   ScratchBuffer wet(frames);
+   const int feedbackTap = fFeedback != 0.f ? LongestTap() : -1;
+
+   if (feedbackTap < 0)
+   {
+      fLine.Write(buffer, frames);
+   }
+   else
+   {
+      // linear ReadNext needs delays at least one sample past the frame
+      const float d0 = from[feedbackTap];
+      const float d1 = to[feedbackTap];
+      Ramp(delays, frames, d0, d1);
+      const int chunk = std::max((int)std::min(d0, d1), 1);
+      const float feedback = std::max(-kMaxFeedback, std::min(fFeedback, kMaxFeedback));
+
+      ScratchBuffer send(frames);
+      for (int pos = 0; pos < frames; pos += chunk)
+      {
+         const int n = std::min(chunk, frames - pos);
+         fLine.ReadNext(wet + pos, n, delays + pos);
+         for (int i = pos; i < pos + n; ++i)
+            send[i] = buffer[i] + feedback * wet[i];
+         fLine.Write(send + pos, n);
+      }
+   }
+
+   for (int i = 0; i < frames; ++i)
+      buffer[i] *= fDry;
+
+   for (int t = 0; t < kMaxTaps; ++t)
+   {
+      const float gain = fTaps[t].fGain;
+      if (gain == 0.f)
+         continue;
+
+      if (from[t] == to[t])
+      {
+         fLine.Read(wet, frames, to[t]);
+      }
+      else
+      {
+         Ramp(delays, frames, from[t], to[t]);
+         fLine.Read(wet, frames, delays);
+      }
+
+      for (int i = 0; i < frames; ++i)
+         buffer[i] += gain * wet[i];
+   }
+}
+
+//
+// PingPongDelay
+//
+
+PingPongDelay::PingPongDelay(AudioClient* input, float maxSeconds)
+: MultiOutputClient(2)
+, fInput(input)
+, fMaxSeconds(maxSeconds)
+, fSeconds(0.25f)
+, fDelay(-1.f)
+, fFeedback(0.5f)
+, fMix(0.5f)
+{
+}
+
+void PingPongDelay::Prepare(int maxFrames)
+{
+   MultiOutputClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const int maxDelay = (int)ceilf(fMaxSeconds * fs) + 1;
+   fLines[0].Allocate(maxDelay, maxFrames);
+   fLines[1].Allocate(maxDelay, maxFrames);
+}
+
+void PingPongDelay::RenderChannels(float** buffers, int numChannels, int frames)
+{
+   float* left = buffers[0];
+   float* right = buffers[1];
+   RenderInput(fInput, left, frames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const float to = std::max(1.f, std::min(fSeconds * fs, (float)fLines[0].MaxDelay()));
+   const float from = fDelay < 0.f ? to : fDelay;
+   fDelay = to;
+
+   ScratchBuffer delays(frames);
+   ScratchBuffer echoLeft(frames);
+   ScratchBuffer echoRight(frames);
+   ScratchBuffer send(frames);
+   Ramp(delays, frames, from, to);
+
+   // both lines are read before either is written, a chunk at a time
+   const int chunk = std::max((int)std::min(from, to), 1);
+   const float feedback = std::max(-kMaxFeedback, std::min(fFeedback, kMaxFeedback));
+
+   for (int pos = 0; pos < frames; pos += chunk)
+   {
+      const int n = std::min(chunk, frames - pos);
+      fLines[0].ReadNext(echoLeft + pos, n, delays + pos);
+      fLines[1].ReadNext(echoRight + pos, n, delays + pos);
+      for (int i = pos; i < pos + n; ++i)
+         send[i] = left[i] + feedback * echoRight[i];
+      fLines[0].Write(send + pos, n);
+      fLines[1].Write(echoLeft + pos, n);
+   }
+
+   for (int i = 0; i < frames; ++i)
+   {
+      const float dry = left[i];
+      left[i] = dry + fMix * echoLeft[i];
+      right[i] = dry + fMix * echoRight[i];
+   }
+}
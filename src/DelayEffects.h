@@ -0,0 +1,193 @@
+#ifndef h_DelayEffects
+#define h_DelayEffects
+
+#include "AudioClient.h"
+#include "DelayLine.h"
+#include "Modulation.h"
+
+// DelaySweep
+// ----------------
+/// \brief Delay curve for a modulated delay: an LFO ticked every
+/// kControlPeriod samples and ramped linearly in between.
+///
+/// Fill writes a whole block of delays (in samples) for DelayLine::Read, so
+/// the LFO costs one Tick per control period rather than a call per sample.
+class DelaySweep
+{
+public:
+   enum
+   {
+      kControlPeriod = 32
+   };
+
+   DelaySweep(float rate = 1.f, int shape = LFO::kSine);
+
+   void SetRate(float rate) { fLfo.SetRate(rate); }
+   void SetShape(int shape) { fLfo.SetShape(shape); }
+   void Reset(float phase = 0.f);
+
+   /// delays[i] = centre + depth * lfo, centre and depth in samples
+   void Fill(float* delays, int frames, float centre, float depth);
+
+private:
+   LFO fLfo;
+   float fValue;   // LFO at the current sample
+   float fTarget;  // at the end of the period
+   float fStep;    // per sample
+   int fLeft;     // samples left in the period
+};
+
+// Chorus
+// ----------------
+/// \brief Up to kMaxVoices copies of the input, each delayed by delay ±
+/// depth seconds under its own sine LFO (spread evenly in phase), mixed with
+/// the dry signal.
+///
+/// Reads are Lagrange3 at full quality and linear below it (see
+/// QualityGovernor).
+class Chorus : public AudioClient
+{
+public:
+   enum
+   {
+      kMaxVoices = 4
+   };
+
+   Chorus(AudioClient* input = NULL, int voices = 2);
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   void SetVoices(int voices);
+   void SetDelay(float seconds) { fDelay = seconds; }
+   void SetDepth(float seconds) { fDepth = seconds; }
+   void SetRate(float rate);
+   void SetMix(float mix) { fMix = mix; }
+
+private:
+   AudioClient* fInput;
+   DelayLine fLine;
+   DelaySweep fSweeps[kMaxVoices];
+   int fVoices;
+   float fDelay;
+   float fDepth;
+   float fMix;
+};
+
+// Flanger
+// ----------------
+/// \brief Short swept delay with feedback, mixed with the dry signal.
+///
+/// With feedback the delayed signal is written back into the line, so the
+/// block is processed in chunks no longer than the shortest delay of the
+/// sweep (see DelayLine::ReadNext).  Keep delay - depth above a few samples.
+class Flanger : public AudioClient
+{
+public:
+   Flanger(AudioClient* input = NULL);
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   void SetDelay(float seconds) { fDelay = seconds; }
+   void SetDepth(float seconds) { fDepth = seconds; }
+   void SetRate(float rate) { fSweep.SetRate(rate); }
+   void SetShape(int shape) { fSweep.SetShape(shape); }
+
+   /// -1 to 1 (exclusive); negative feedback notches the odd harmonics
+   void SetFeedback(float feedback) { fFeedback = feedback; }
+   void SetMix(float mix) { fMix = mix; }
+
+private:
+   AudioClient* fInput;
+   DelayLine fLine;
+   DelaySweep fSweep;
+   float fDelay;
+   float fDepth;
+   float fFeedback;
+   float fMix;
+};
+
+// MultiTapDelay
+// ----------------
+/// \brief Echoes of the input from up to kMaxTaps taps, each with its own
+/// time and gain, added to the dry signal.  The longest tap feeds back into
+/// the line by feedback.
+///
+/// Each tap is one block read at a constant delay; a change of time is
+/// ramped over the next block.  maxSeconds bounds the tap times.
+class MultiTapDelay : public AudioClient
+{
+public:
+   enum
+   {
+      kMaxTaps = 8
+   };
+
+   MultiTapDelay(AudioClient* input = NULL, float maxSeconds = 2.f);
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   /// Sets tap (0 to kMaxTaps - 1); a gain of 0 turns it off
+   void SetTap(int tap, float seconds, float gain);
+   void SetFeedback(float feedback) { fFeedback = feedback; }
+   void SetDry(float gain) { fDry = gain; }
+
+private:
+   struct Tap
+   {
+      float fSeconds;
+      float fGain;
+      float fDelay;  // samples, as of the last block
+   };
+
+   int LongestTap() const;
+
+   AudioClient* fInput;
+   DelayLine fLine;
+   float fMaxSeconds;
+   Tap fTaps[kMaxTaps];
+   float fFeedback;
+   float fDry;
+};
+
+// PingPongDelay
+// ----------------
+/// \brief Stereo echo that bounces between the channels: the input enters
+/// the left delay, whose output feeds the right delay, whose output feeds
+/// back into the left.
+///
+/// Output(0) and Output(1) are the left and right channels, each the dry
+/// input plus its delay's output times mix.
+class PingPongDelay : public MultiOutputClient
+{
+public:
+   PingPongDelay(AudioClient* input = NULL, float maxSeconds = 2.f);
+
+   void RenderChannels(float** buffers, int numChannels, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   void SetTime(float seconds) { fSeconds = seconds; }
+   void SetFeedback(float feedback) { fFeedback = feedback; }
+   void SetMix(float mix) { fMix = mix; }
+
+private:
+   AudioClient* fInput;
+   DelayLine fLines[2];
+   float fMaxSeconds;
+   float fSeconds;
+   float fDelay;  // samples, as of the last block
+   float fFeedback;
+   float fMix;
+};
+
+#endif
@@ -0,0 +1,208 @@
+#include "DelayLine.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AlignedMemory.h"
+
+DelayLine::DelayLine(int maxDelay, int maxFrames)
+: fBuffer(NULL)
+, fOwned(false)
+, fSize(0)
+, fMask(0)
+, fWrite(0)
+, fMaxDelay(0)
+{
+   Allocate(maxDelay, maxFrames);
+}
+
+DelayLine::~DelayLine()
+{
+   Release();
+}
+
+size_t DelayLine::StorageSize(int maxDelay, int maxFrames)
+{
+   // room for the longest delay behind a whole block, plus the
+   // interpolators' extra taps
+   const size_t needed = (size_t)std::max(maxDelay, 0) + std::max(maxFrames, 1) + 4;
+   size_t size = 1;
+   while (size < needed)
+      size <<= 1;
+   return size;
+}
+
+void DelayLine::Allocate(int maxDelay, int maxFrames)
+{
+   const size_t size = StorageSize(maxDelay, maxFrames);
+   if (size != fSize || !fOwned)
+   {
+      Release();
+      fBuffer = (float*)MusKit::AlignedAlloc(size * sizeof(float));
+      fOwned = true;
+      fSize = size;
+      fMask = size - 1;
+   }
+   fMaxDelay = std::max(maxDelay, 0);
+   Clear();
+}
+
+void DelayLine::Attach(float* storage, int maxDelay, int maxFrames)
+{
+   Release();
+   fBuffer = storage;
+   fOwned = false;
+   fSize = StorageSize(maxDelay, maxFrames);
+   fMask = fSize - 1;
+   fMaxDelay = std::max(maxDelay, 0);
+   Clear();
+}
+
+void DelayLine::Release()
+{
+   if (fOwned)
+      MusKit::AlignedFree(fBuffer);
+   fBuffer = NULL;
+   fOwned = false;
+}
+
+void DelayLine::Clear()
+{
+   memset(fBuffer, 0, fSize * sizeof(float));
+   fWrite = 0;
+}
+
+void DelayLine::Write(const float* in, int frames)
+{
+   const size_t start = fWrite & fMask;
+   const size_t first = std::min((size_t)frames, fSize - start);
+   memcpy(fBuffer + start, in, first * sizeof(float));
+   memcpy(fBuffer, in + first, (frames - first) * sizeof(float));
+   fWrite += frames;
+}
+
+void DelayLine::Read(float* out, int frames, float delay, int type, AllpassState* state) const
+{
+   ReadFrom(fWrite - frames, out, frames, NULL, delay, type, state);
+}
+
+void DelayLine::Read(float* out, int frames, const float* delays, int type, AllpassState* state) const
+{
+   ReadFrom(fWrite - frames, out, frames, delays, 0.f, type, state);
+}
+
+void DelayLine::ReadNext(float* out, int frames, float delay, int type, AllpassState* state) const
+{
+   ReadFrom(fWrite, out, frames, NULL, delay, type, state);
+}
+
+void DelayLine::ReadNext(float* out, int frames, const float* delays, int type, AllpassState* state) const
+{
+   ReadFrom(fWrite, out, frames, delays, 0.f, type, state);
+}
+
+float DelayLine::Tap(float delay) const
+{
+   const int whole = (int)delay;
+   const float t = delay - whole;
+   const size_t n = fWrite - whole;
+   const float x0 = At(n);
+   return x0 + t * (At(n - 1) - x0);
+}
+
+void DelayLine::ReadFrom(size_t base, float* out, int frames, const float* delays, float delay,
+                         int type, AllpassState* state) const
+{
+   // frame i reads base + i - delay; delays, when given, override delay
+#define DELAY(i) (delays ? delays[i] : delay)
+
+   switch (type)
+   {
+      case kInterpolationNone:
+         for (int i = 0; i < frames; ++i)
+         {
+            out[i] = At(base + i - (size_t)(DELAY(i) + 0.5f));
+         }
+         break;
+
+      case kInterpolationLinear:
+         for (int i = 0; i < frames; ++i)
+         {
+            const float d = DELAY(i);
+            const int whole = (int)d;
+            const float t = d - whole;
+            const size_t n = base + i - whole;
+            const float x0 = At(n);
+            out[i] = x0 + t * (At(n - 1) - x0);
+         }
+         break;
+
+      case kInterpolationLagrange3:
+         for (int i = 0; i < frames; ++i)
+         {
+            // four points around the read position, the newest one sample
+            // later than it; below a delay of 1 there isn't one
+            const float d = std::max(DELAY(i), 1.f);
+            const int whole = (int)d;
+            const float t = d - whole;
+            const size_t n = base + i - whole;
+            const float xm1 = At(n + 1);
+            const float x0 = At(n);
+            const float x1 = At(n - 1);
+            const float x2 = At(n - 2);
+            const float c1 = x1 - xm1 * (1.f / 3.f) - x0 * 0.5f - x2 * (1.f / 6.f);
+            const float c2 = 0.5f * (xm1 + x1) - x0;
+            const float c3 = (1.f / 6.f) * (x2 - xm1) + 0.5f * (x0 - x1);
+            out[i] = ((c3 * t + c2) * t + c1) * t + x0;
+         }
+         break;
+
+      case kInterpolationAllpass:
+      {
+         AllpassState dummy;
+         AllpassState& s = state ? *state : dummy;
+         float y1 = s.fY1;
+         for (int i = 0; i < frames; ++i)
+         {
+            // keep the fractional part in [0.5, 1.5), where the filter behaves
+            const float d = std::max(DELAY(i), 0.5f);
+            const int whole = (int)(d - 0.5f);
+            const float D = d - whole;
+            const float eta = (1.f - D) / (1.f + D);
+            const size_t n = base + i - whole;
+            y1 = eta * At(n) + At(n - 1) - eta * y1;
+            out[i] = y1;
+         }
+         s.fY1 = y1;
+         break;
+      }
+
+      case kInterpolationThiran2:
+      {
+         AllpassState dummy;
+         AllpassState& s = state ? *state : dummy;
+         float y1 = s.fY1;
+         float y2 = s.fY2;
+         for (int i = 0; i < frames; ++i)
+         {
+            // fractional part in [1.5, 2.5)
+            const float d = std::max(DELAY(i), 1.5f);
+            const int whole = (int)(d - 1.5f);
+            const float D = d - whole;
+            const float a1 = -2.f * (D - 2.f) / (D + 1.f);
+            const float a2 = (D - 1.f) * (D - 2.f) / ((D + 1.f) * (D + 2.f));
+            const size_t n = base + i - whole;
+            const float y = a2 * At(n) + a1 * At(n - 1) + At(n - 2) - a1 * y1 - a2 * y2;
+            y2 = y1;
+            y1 = y;
+            out[i] = y;
+         }
+         s.fY1 = y1;
+         s.fY2 = y2;
+         break;
+      }
+   }
+
+#undef DELAY
+}
@@ -0,0 +1,101 @@
+#ifndef h_DelayLine
+#define h_DelayLine
+
+#include <stddef.h>
+
+// DelayLine
+// ----------------
+/// \brief Power-of-2 circular delay buffer with block writes and block-wise
+/// fractional reads.
+///
+/// Write appends a block.  Read then fetches the same frames delayed by
+/// a fixed number of samples or by one delay per frame (for modulated
+/// delays), with the interpolation resolved once per block.  Delays are
+/// in samples and may be fractional; a delay of 0 reads the frames just
+/// written.
+///
+/// A feedback loop has to read before it writes: ReadNext reads for the
+/// frames about to be written, which works as long as each frame's delay
+/// is more than its index in the block (more than one past it for
+/// Lagrange3), so loops run in chunks no longer than their shortest delay.
+///
+/// The allpass types are first and second order Thiran allpass
+/// interpolators.  They have a flat magnitude response, which suits
+/// waveguides and slowly modulated delays, but keep state, so each read
+/// position needs its own AllpassState.  The other types ignore it.
+class DelayLine
+{
+public:
+   enum InterpolationType
+   {
+      kInterpolationNone = 0,
+      kInterpolationLinear,
+      kInterpolationLagrange3,
+      kInterpolationAllpass,
+      kInterpolationThiran2,
+
+      kNumInterpolationTypes
+   };
+
+   struct AllpassState
+   {
+      AllpassState() : fY1(0.f), fY2(0.f) {}
+      float fY1;
+      float fY2;
+   };
+
+   DelayLine(int maxDelay = 0, int maxFrames = 0);
+   ~DelayLine();
+
+   /// Makes room for delays up to maxDelay samples read in blocks of up to
+   /// maxFrames, and clears.  Allocates, so not for the audio thread.
+   void Allocate(int maxDelay, int maxFrames);
+
+   /// Floats of storage Allocate would use (a power of 2)
+   static size_t StorageSize(int maxDelay, int maxFrames);
+
+   /// Like Allocate, but uses storage (StorageSize floats), which the caller
+   /// owns, e.g. a slice of one allocation shared by several lines
+   void Attach(float* storage, int maxDelay, int maxFrames);
+
+   void Clear();
+
+   /// Longest delay that can be read after writing maxFrames
+   int MaxDelay() const { return fMaxDelay; }
+
+   void Write(const float* in, int frames);
+   void Write(float x) { fBuffer[fWrite & fMask] = x; ++fWrite; }
+
+   /// Reads the frames just written, delayed by delay samples
+   void Read(float* out, int frames, float delay, int type = kInterpolationLinear, AllpassState* state = NULL) const;
+
+   /// Reads the frames just written, frame i delayed by delays[i] samples
+   void Read(float* out, int frames, const float* delays, int type = kInterpolationLinear, AllpassState* state = NULL) const;
+
+   /// Reads for the frames about to be written (see above)
+   void ReadNext(float* out, int frames, float delay, int type = kInterpolationLinear, AllpassState* state = NULL) const;
+   void ReadNext(float* out, int frames, const float* delays, int type = kInterpolationLinear, AllpassState* state = NULL) const;
+
+   /// One sample, delay samples (>= 1) before the next to be written
+   float Tap(float delay) const;
+
+private:
+   DelayLine(const DelayLine&);
+   DelayLine& operator=(const DelayLine&);
+
+   void ReadFrom(size_t base, float* out, int frames, const float* delays, float delay,
+                 int type, AllpassState* state) const;
+
+   float At(size_t index) const { return fBuffer[index & fMask]; }
+
+   void Release();
+
+   float* fBuffer;
+   bool fOwned;
+   size_t fSize;
+   size_t fMask;
+   size_t fWrite;  // free-running count of samples written
+   int fMaxDelay;
+};
+
+#endif
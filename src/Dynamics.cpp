@@ -0,0 +1,392 @@
+#include "Dynamics.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "ScratchArena.h"
+
+// level treated as silence, to keep the logs finite
+static const float kSilence = 1e-10f;
+
+//
+// Dynamics
+//
+
+Dynamics::Dynamics(int numChannels)
+: MultiOutputClient(numChannels)
+, fNumChannels(numChannels)
+, fInputs(new AudioClient*[numChannels])
+, fDelays(new DelayLine[numChannels])
+, fLinked(true)
+, fReduction(0.f)
+{
+   for (int c = 0; c < numChannels; ++c)
+      fInputs[c] = NULL;
+}
+
+Dynamics::~Dynamics()
+{
+   delete[] fInputs;
+   delete[] fDelays;
+}
+
+void Dynamics::SetInput(int channel, AudioClient* input)
+{
+   if (channel >= 0 && channel < fNumChannels)
+      fInputs[channel] = input;
+}
+
+void Dynamics::Prepare(int maxFrames)
+{
+   MultiOutputClient::Prepare(maxFrames);
+   for (int c = 0; c < fNumChannels; ++c)
+   {
+      if (fInputs[c])
+         fInputs[c]->Prepare(maxFrames);
+   }
+
+   Reset(AudioServer::GetInstance()->Fs());
+   for (int c = 0; c < fNumChannels; ++c)
+      fDelays[c].Allocate(Latency(), maxFrames);
+}
+
+void Dynamics::RenderChannels(float** buffers, int numChannels, int frames)
+{
+   for (int c = 0; c < numChannels; ++c)
+   {
+      if (fInputs[c])
+         fInputs[c]->Process(buffers[c], frames);
+   }
+
+   Apply(buffers, numChannels, frames);
+}
+
+void Dynamics::Apply(float** buffers, int numChannels, int frames)
+{
+   const float fs = AudioServer::GetInstance()->Fs();
+   const int channels = std::min(numChannels, fNumChannels);
+
+   float lowest = 1.f;
+   if (fLinked)
+   {
+      lowest = Process(buffers, 0, channels, frames, 0, fs);
+   }
+   else
+   {
+      for (int c = 0; c < channels; ++c)
+         lowest = std::min(lowest, Process(buffers + c, c, 1, frames, c, fs));
+   }
+
+   fReduction.store(ToDecibels(lowest), std::memory_order_relaxed);
+}
+
+float Dynamics::Process(float** buffers, int first, int channels, int frames, int group, float fs)
+{
+   ScratchBuffer level(frames);
+   ScratchBuffer gain(frames);
+
+   const float* x = buffers[0];
+   for (int i = 0; i < frames; ++i)
+      level[i] = fabsf(x[i]);
+
+   for (int c = 1; c < channels; ++c)
+   {
+      x = buffers[c];
+      for (int i = 0; i < frames; ++i)
+         level[i] = std::max(level[i], fabsf(x[i]));
+   }
+
+   ComputeGain(level, gain, frames, group, fs);
+
+   const int latency = Latency();
+   for (int c = 0; c < channels; ++c)
+   {
+      float* buffer = buffers[c];
+      if (latency > 0)
+      {
+         fDelays[first + c].Write(buffer, frames);
+         fDelays[first + c].Read(buffer, frames, (float)latency, DelayLine::kInterpolationNone);
+      }
+
+      for (int i = 0; i < frames; ++i)
+         buffer[i] *= gain[i];
+
+      Finish(buffer, frames);
+   }
+
+   return *std::min_element((float*)gain, (float*)gain + frames);
+}
+
+float Dynamics::ToDecibels(float gain)
+{
+   return 20.f * log10f(std::max(gain, kSilence));
+}
+
+float Dynamics::FromDecibels(float db)
+{
+   return powf(10.f, db / 20.f);
+}
+
+float Dynamics::Coefficient(float seconds, float fs)
+{
+   return seconds > 0.f ? expf(-1.f / (seconds * fs)) : 0.f;
+}
+
+//
+// Compressor
+//
+
+Compressor::Compressor(int numChannels)
+: Dynamics(numChannels)
+, fThreshold(-20.f)
+, fRatio(4.f)
+, fKnee(6.f)
+, fAttack(0.005f)
+, fRelease(0.1f)
+, fMakeup(0.f)
+, fEnvelope(new float[numChannels])
+{
+   for (int c = 0; c < numChannels; ++c)
+      fEnvelope[c] = 0.f;
+}
+
+Compressor::~Compressor()
+{
+   delete[] fEnvelope;
+}
+
+void Compressor::ComputeGain(const float* level, float* gain, int frames, int group, float fs)
+{
+   const float threshold = fThreshold;
+   const float slope = 1.f - 1.f / std::max(fRatio, 1.f);
+   const float knee = std::max(fKnee, 0.f);
+   const float half = knee * 0.5f;
+   const float dbPerLog = 20.f / logf(10.f);
+
+   // static curve: gain reduction in dB
+   for (int i = 0; i < frames; ++i)
+   {
+      const float over = dbPerLog * logf(std::max(level[i], kSilence)) - threshold;
+      const float soft = (over + half) * (over + half) / (2.f * knee + kSilence);
+      const float eased = over <= -half ? 0.f : (over < half ? soft : over);
+      gain[i] = -slope * eased;
+   }
+
+   // attack while the reduction deepens, release while it recovers
+   const float attack = Coefficient(fAttack, fs);
+   const float release = Coefficient(fRelease, fs);
+   float envelope = fEnvelope[group];
+   for (int i = 0; i < frames; ++i)
+   {
+      const float target = gain[i];
+      const float coefficient = target < envelope ? attack : release;
+      envelope = target + coefficient * (envelope - target);
+      gain[i] = envelope;
+   }
+   fEnvelope[group] = envelope;
+
+   const float makeup = fMakeup;
+   const float logPerDb = logf(10.f) / 20.f;
+   for (int i = 0; i < frames; ++i)
+      gain[i] = expf((gain[i] + makeup) * logPerDb);
+}
+
+//
+// Limiter
+//
+
+Limiter::Limiter(int numChannels, float lookahead)
+: Dynamics(numChannels)
+, fCeiling(-0.3f)
+, fRelease(0.1f)
+, fLookahead(lookahead)
+, fWindow(1)
+, fGroups(NULL)
+{
+}
+
+Limiter::~Limiter()
+{
+   FreeGroups();
+}
+
+void Limiter::FreeGroups()
+{
+   if (!fGroups)
+      return;
+
+   for (int g = 0; g < fNumChannels; ++g)
+   {
+      delete[] fGroups[g].fIndices;
+      delete[] fGroups[g].fValues;
+      delete[] fGroups[g].fHistory;
+   }
+   delete[] fGroups;
+   fGroups = NULL;
+}
+
+void Limiter::Reset(float fs)
+{
+   FreeGroups();
+
+   fWindow = std::max(1, (int)(fLookahead * fs + 0.5f));
+   fGroups = new Group[fNumChannels];
+   for (int g = 0; g < fNumChannels; ++g)
+   {
+      Group& group = fGroups[g];
+      group.fIndices = new SampleTime[fWindow + 1];
+      group.fValues = new float[fWindow + 1];
+      group.fFront = 0;
+      group.fCount = 0;
+      group.fSample = 0;
+
+      group.fRelease = 1.f;
+      group.fHistory = new float[fWindow];
+      std::fill(group.fHistory, group.fHistory + fWindow, 1.f);
+      group.fHistoryPosition = 0;
+      group.fSum = fWindow;
+   }
+}
+
+void Limiter::ComputeGain(const float* level, float* gain, int frames, int group, float fs)
+{
+   if (!fGroups)
+   {
+      std::fill(gain, gain + frames, 1.f);
+      return;
+   }
+
+   // gain each sample needs on its own
+   const float ceiling = FromDecibels(fCeiling);
+   for (int i = 0; i < frames; ++i)
+      gain[i] = level[i] > ceiling ? ceiling / level[i] : 1.f;
+
+   Group& g = fGroups[group];
+   const int window = fWindow;
+   const int capacity = window + 1;
+   const float release = Coefficient(fRelease, fs);
+   const double scale = 1.0 / window;
+
+   for (int i = 0; i < frames; ++i)
+   {
+      const float value = gain[i];
+      const SampleTime sample = g.fSample++;
+
+      // drop entries the new one makes irrelevant, then append it
+      while (g.fCount > 0)
+      {
+         int back = g.fFront + g.fCount - 1;
+         if (back >= capacity)
+            back -= capacity;
+         if (g.fValues[back] < value)
+            break;
+         --g.fCount;
+      }
+      int end = g.fFront + g.fCount;
+      if (end >= capacity)
+         end -= capacity;
+      g.fIndices[end] = sample;
+      g.fValues[end] = value;
+      ++g.fCount;
+
+      // and expire the one that left the window
+      if (g.fIndices[g.fFront] <= sample - window)
+      {
+         if (++g.fFront == capacity)
+            g.fFront = 0;
+         --g.fCount;
+      }
+
+      // instant attack to the window minimum, release towards it
+      const float minimum = g.fValues[g.fFront];
+      const float held = minimum < g.fRelease ? minimum : minimum + release * (g.fRelease - minimum);
+      g.fRelease = held;
+
+      // average over the window, which ramps into each peak
+      g.fSum += held - g.fHistory[g.fHistoryPosition];
+      g.fHistory[g.fHistoryPosition] = held;
+      if (++g.fHistoryPosition == window)
+         g.fHistoryPosition = 0;
+
+      gain[i] = (float)(g.fSum * scale);
+   }
+}
+
+void Limiter::Finish(float* buffer, int frames)
+{
+   const float ceiling = FromDecibels(fCeiling);
+   for (int i = 0; i < frames; ++i)
+      buffer[i] = std::max(-ceiling, std::min(buffer[i], ceiling));
+}
+
+//
+// Gate
+//
+
+Gate::Gate(int numChannels)
+: Dynamics(numChannels)
+, fThreshold(-50.f)
+, fHysteresis(6.f)
+, fRange(80.f)
+, fAttack(0.001f)
+, fHold(0.05f)
+, fRelease(0.1f)
+, fGain(new float[numChannels])
+, fHoldLeft(new int[numChannels])
+, fOpen(new bool[numChannels])
+{
+   for (int c = 0; c < numChannels; ++c)
+   {
+      fGain[c] = 0.f;
+      fHoldLeft[c] = 0;
+      fOpen[c] = false;
+   }
+}
+
+Gate::~Gate()
+{
+   delete[] fGain;
+   delete[] fHoldLeft;
+   delete[] fOpen;
+}
+
+void Gate::ComputeGain(const float* level, float* gain, int frames, int group, float fs)
+{
+   const float open = FromDecibels(fThreshold);
+   const float close = FromDecibels(fThreshold - std::max(fHysteresis, 0.f));
+   const float closed = FromDecibels(-std::max(fRange, 0.f));
+   const int hold = (int)(std::max(fHold, 0.f) * fs);
+   const float attack = Coefficient(fAttack, fs);
+   const float release = Coefficient(fRelease, fs);
+
+   // threshold crossings for the whole block first
+   for (int i = 0; i < frames; ++i)
+      gain[i] = level[i] > open ? 1.f : (level[i] >= close ? 0.f : -1.f);
+
+   bool isOpen = fOpen[group];
+   int holdLeft = fHoldLeft[group];
+   float g = fGain[group];
+   for (int i = 0; i < frames; ++i)
+   {
+      const float crossing = gain[i];
+      if (crossing > 0.f)
+         isOpen = true;
+
+      if (crossing >= 0.f)
+         holdLeft = hold;
+      else if (holdLeft > 0)
+         --holdLeft;
+      else
+         isOpen = false;
+
+      const float target = isOpen ? 1.f : closed;
+      const float coefficient = target > g ? attack : release;
+      g = target + coefficient * (g - target);
+      gain[i] = g;
+   }
+   fOpen[group] = isOpen;
+   fHoldLeft[group] = holdLeft;
+   fGain[group] = g;
+}
@@ -0,0 +1,213 @@
+#ifndef h_Dynamics
+#define h_Dynamics
+
+#include <atomic>
+
+#include "AudioClient.h"
+#include "DelayLine.h"
+
+// Dynamics
+// ----------------
+/// \brief Base class for gain processors (Compressor, Limiter, Gate) on
+/// numChannels channels.
+///
+/// Connect the signal with SetInput(channel, client) and take it on from
+/// Output(channel), or call Apply on buffers directly.  A block goes through
+/// in passes over whole arrays: the detector level (the peak across the
+/// channels when linked, each channel's own otherwise), the subclass's gain
+/// curve, and the gain applied to the channels, which the compiler
+/// vectorizes.  Only the time smoothing runs sample by sample.
+///
+/// Linked mode (the default) applies one gain to every channel, so a
+/// stereo image doesn't shift when one side triggers.  Unlinked, each
+/// channel is processed on its own.
+///
+/// Subclasses that look ahead report it from Latency(); the base class
+/// delays the channels to match.  Parameters may be changed from any thread
+/// and apply from the next block; lookahead changes apply at Prepare.
+class Dynamics : public MultiOutputClient
+{
+public:
+   Dynamics(int numChannels);
+   virtual ~Dynamics();
+
+   void SetInput(int channel, AudioClient* input);
+
+   void SetLinked(bool linked) { fLinked = linked; }
+   bool Linked() const { return fLinked; }
+
+   void RenderChannels(float** buffers, int numChannels, int frames);
+   void Prepare(int maxFrames);
+
+   /// Processes buffers in place (up to the channel count given at
+   /// construction)
+   void Apply(float** buffers, int numChannels, int frames);
+
+   /// Samples the output lags the input by
+   virtual int Latency() const { return 0; }
+
+   /// Gain reduction of the last block, in dB (0 or less), for meters
+   float Reduction() const { return fReduction.load(std::memory_order_relaxed); }
+
+   static float ToDecibels(float gain);
+   static float FromDecibels(float db);
+
+protected:
+   /// Turns level (linear peak, >= 0) into gain (linear), both frames
+   /// long.  group is 0 when linked and the channel otherwise, so state can
+   /// be kept per channel.
+   virtual void ComputeGain(const float* level, float* gain, int frames, int group, float fs) = 0;
+
+   /// Called from Prepare with the sample rate, before the delay lines are
+   /// sized from Latency()
+   virtual void Reset(float fs) {}
+
+   /// Called on each channel after the gain is applied
+   virtual void Finish(float* buffer, int frames) {}
+
+   /// One-pole coefficient for a time constant
+   static float Coefficient(float seconds, float fs);
+
+   int fNumChannels;
+
+private:
+   /// Returns the lowest gain applied
+   float Process(float** buffers, int first, int channels, int frames, int group, float fs);
+
+   AudioClient** fInputs;
+   DelayLine* fDelays;
+   bool fLinked;
+   std::atomic<float> fReduction;
+};
+
+// Compressor
+// ----------------
+/// \brief Feed-forward peak compressor with a soft knee.
+///
+/// Above threshold the level is reduced by 1 - 1/ratio dB per dB, eased in
+/// over knee dB around the threshold.  The gain reduction follows at the
+/// attack time and recovers at the release time (one-pole, in dB), and
+/// makeup gain is added after.
+class Compressor : public Dynamics
+{
+public:
+   Compressor(int numChannels = 2);
+   ~Compressor();
+
+   void SetThreshold(float db) { fThreshold = db; }
+   void SetRatio(float ratio) { fRatio = ratio; }
+   void SetKnee(float db) { fKnee = db; }
+   void SetAttack(float seconds) { fAttack = seconds; }
+   void SetRelease(float seconds) { fRelease = seconds; }
+   void SetMakeup(float db) { fMakeup = db; }
+
+protected:
+   void ComputeGain(const float* level, float* gain, int frames, int group, float fs);
+
+private:
+   float fThreshold;
+   float fRatio;
+   float fKnee;
+   float fAttack;
+   float fRelease;
+   float fMakeup;
+
+   float* fEnvelope;  // gain in dB, per group
+};
+
+// Limiter
+// ----------------
+/// \brief Lookahead brickwall limiter: no output sample exceeds the ceiling.
+///
+/// Each sample needs a gain of min(1, ceiling / |x|).  The limiter takes the
+/// minimum of that over the lookahead window, with a monotonic deque (O(1)
+/// per sample however long the window), lets it recover at the release
+/// time, and averages it over the window so the gain ramps down over the
+/// lookahead before a peak rather than stepping.  The signal is delayed by
+/// Latency() = lookahead - 1 samples, which lines each peak up with the
+/// bottom of its ramp.  A final clip at the ceiling catches rounding.
+class Limiter : public Dynamics
+{
+public:
+   Limiter(int numChannels = 2, float lookahead = 0.005f);
+   ~Limiter();
+
+   void SetCeiling(float db) { fCeiling = db; }
+   void SetRelease(float seconds) { fRelease = seconds; }
+
+   /// Seconds; applies at the next Prepare
+   void SetLookahead(float seconds) { fLookahead = seconds; }
+
+   int Latency() const { return fWindow - 1; }
+
+protected:
+   void ComputeGain(const float* level, float* gain, int frames, int group, float fs);
+   void Reset(float fs);
+   void Finish(float* buffer, int frames);
+
+private:
+   struct Group
+   {
+      // monotonic deque of (sample, gain), increasing gains from the front,
+      // in a ring of fWindow + 1 entries
+      SampleTime* fIndices;
+      float* fValues;
+      int fFront;
+      int fCount;
+      SampleTime fSample;
+
+      // release follower and the window's running average
+      float fRelease;
+      float* fHistory;
+      int fHistoryPosition;
+      double fSum;
+   };
+
+   void FreeGroups();
+
+   float fCeiling;
+   float fRelease;
+   float fLookahead;
+   int fWindow;
+   Group* fGroups;
+};
+
+// Gate
+// ----------------
+/// \brief Noise gate with hysteresis and hold.
+///
+/// The gate opens when the level rises above threshold and closes once it
+/// has stayed below threshold - hysteresis for the hold time.  Closed, the
+/// signal is turned down by range dB.  The gain opens at the attack time
+/// and closes at the release time.
+class Gate : public Dynamics
+{
+public:
+   Gate(int numChannels = 2);
+   ~Gate();
+
+   void SetThreshold(float db) { fThreshold = db; }
+   void SetHysteresis(float db) { fHysteresis = db; }
+   void SetRange(float db) { fRange = db; }
+   void SetAttack(float seconds) { fAttack = seconds; }
+   void SetHold(float seconds) { fHold = seconds; }
+   void SetRelease(float seconds) { fRelease = seconds; }
+
+protected:
+   void ComputeGain(const float* level, float* gain, int frames, int group, float fs);
+
+private:
+   float fThreshold;
+   float fHysteresis;
+   float fRange;
+   float fAttack;
+   float fHold;
+   float fRelease;
+
+   // per group
+   float* fGain;
+   int* fHoldLeft;
+   bool* fOpen;
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "Envelope.h"
+
+#include <cmath>
+#include <climits>
+#include <algorithm>
+
+#include "AudioServer.h"
+
+const float Envelope::kSilence = 0.00001f;
+
+Envelope::Envelope()
+: fNumSegments(0)
+, fSustain(-1)
+, fCurve(0.001f)
+, fRate(0.f)
+, fGate(false)
+, fStage(kIdle)
+, fHolding(false)
+, fLevel(0.f)
+, fTarget(0.f)
+, fRemaining(0)
+, fShape(kLinear)
+, fIncrement(0.f)
+, fCoef(1.f)
+, fBase(0.f)
+{
+}
+
+void Envelope::SetADSR(float attack, float decay, float sustain, float release)
+{
+   ClearSegments();
+   AddSegment(1.f, attack, kLinear);
+   fSustain = AddSegment(sustain, decay, kExponential);
+   AddSegment(0.f, release, kExponential);
+}
+
+void Envelope::ClearSegments()
+{
+   fNumSegments = 0;
+   fSustain = -1;
+   Reset();
+}
+
+int Envelope::AddSegment(float level, float time, int shape)
+{
+   if (fNumSegments == kMaxSegments)
+      return -1;
+
+   Segment& s = fSegments[fNumSegments];
+   s.fLevel = level;
+   s.fTime = time;
+   s.fShape = shape;
+   return fNumSegments++;
+}
+
+void Envelope::NoteOn()
+{
+   fGate = true;
+   EnterSegment(0);
+}
+
+void Envelope::NoteOff()
+{
+   fGate = false;
+   if (fSustain >= 0 && fStage != kIdle && fStage <= fSustain)
+   {
+      EnterSegment(fSustain + 1);
+   }
+}
+
+void Envelope::Reset()
+{
+   fGate = false;
+   fStage = kIdle;
+   fHolding = false;
+   fLevel = 0.f;
+}
+
+void Envelope::Hold()
+{
+   fHolding = true;
+   fShape = kLinear;
+   fIncrement = 0.f;
+   fRemaining = INT_MAX;
+}
+
+void Envelope::EnterSegment(int segment)
+{
+   fHolding = false;
+   if (segment >= fNumSegments)
+   {
+      fStage = kIdle;
+      return;
+   }
+
+   const Segment& s = fSegments[segment];
+   fStage = segment;
+   fTarget = s.fLevel;
+   fShape = s.fShape;
+   const float rate = fRate > 0.f ? fRate : AudioServer::GetInstance()->Fs();
+   fRemaining = (int)(s.fTime * rate);
+
+   if (fRemaining <= 0)
+   {
+      // zero-length segment: jump straight to its level
+      fRemaining = 0;
+      fLevel = fTarget;
+      return;
+   }
+
+   if (fShape == kLinear)
+   {
+      fIncrement = (fTarget - fLevel) / fRemaining;
+   }
+   else
+   {
+      // Aim at target + curve * span.  After n steps of the recurrence the
+      // distance to the aim point has shrunk by coef^n; choosing
+      // coef^n = curve / (1 + curve) lands exactly on target at n = fRemaining.
+      const float aim = fTarget + fCurve * (fTarget - fLevel);
+      fCoef = (float)exp(log(fCurve / (1.0 + fCurve)) / fRemaining);
+      fBase = aim * (1.f - fCoef);
+   }
+}
+
+void Envelope::Process(float* buffer, int frames, bool multiply)
+{
+   int done = 0;
+   while (done < frames)
+   {
+      if (fStage == kIdle)
+      {
+         const float level = fLevel;
+         for (int i = done; i < frames; ++i)
+         {
+            buffer[i] = multiply ? buffer[i] * level : level;
+         }
+         return;
+      }
+
+      if (fRemaining == 0)
+      {
+         // segment finished
+         fLevel = fTarget;
+         if (fStage == fSustain && fGate)
+            Hold();
+         else
+            EnterSegment(fStage + 1);
+         continue;
+      }
+
+      const int n = std::min(frames - done, fRemaining);
+      float* p = buffer + done;
+      float level = fLevel;
+
+      if (fShape == kLinear)
+      {
+         const float increment = fIncrement;
+         if (multiply)
+         {
+            for (int i = 0; i < n; ++i)
+            {
+               p[i] *= level;
+               level += increment;
+            }
+         }
+         else
+         {
+            for (int i = 0; i < n; ++i)
+            {
+               p[i] = level;
+               level += increment;
+            }
+         }
+      }
+      else
+      {
+         const float coef = fCoef;
+         const float base = fBase;
+         if (multiply)
+         {
+            for (int i = 0; i < n; ++i)
+            {
+               p[i] *= level;
+               level = base + level * coef;
+            }
+         }
+         else
+         {
+            for (int i = 0; i < n; ++i)
+            {
+               p[i] = level;
+               level = base + level * coef;
+            }
+         }
+      }
+
+      fLevel = level;
+      if (!fHolding)
+      {
+         fRemaining -= n;
+      }
+      done += n;
+
+      // a tail towards zero in the last segment is done once it's inaudible
+      if (fStage == fNumSegments - 1 && fTarget == 0.f && fabsf(fLevel) < kSilence)
+      {
+         fLevel = 0.f;
+         fStage = kIdle;
+      }
+   }
+}
+
+void Envelope::Render(float* out, int frames)
+{
+   if (fNumSegments == 0)
+   {
+      std::fill(out, out + frames, 1.f);
+      return;
+   }
+
+   Process(out, frames, false);
+}
+
+void Envelope::Apply(float* buffer, int frames)
+{
+   if (fNumSegments == 0)
+      return;
+
+   Process(buffer, frames, true);
+}
@@ -0,0 +1,124 @@
+#ifndef h_Envelope
+#define h_Envelope
+
+// Envelope
+// ----------------
+/// \brief Multi-segment envelope generator, rendered a block at a time.
+///
+/// An envelope is a list of segments, each moving from the current level to
+/// a target level over a time.  One segment may be marked as the sustain
+/// segment: with the gate on, the envelope holds at its target level, and
+/// NoteOff jumps to the segment after it.  Without a sustain segment the
+/// envelope is one-shot and ignores NoteOff.
+///
+/// Exponential segments are computed with a one-multiply recurrence whose
+/// coefficient is worked out once per segment, so the per-sample cost is the
+/// same as a linear ramp.  They aim slightly past the target so that they
+/// arrive in exactly the segment's time instead of approaching forever.
+///
+/// Once the last segment has finished (or an exponential tail towards zero
+/// has dropped below kSilence), Idle() reports true.  An envelope with no
+/// segments is a bypass: it renders 1, Apply does nothing and it is never
+/// idle.
+class Envelope
+{
+public:
+   enum Shape
+   {
+      kLinear = 0,
+      kExponential,
+
+      kNumShapes
+   };
+
+   enum
+   {
+      kMaxSegments = 8
+   };
+
+   /// level below which a decay to zero counts as silent (-100dB)
+   static const float kSilence;
+
+   Envelope();
+
+   /// Replaces the segments with attack, decay and release times in seconds
+   /// and a sustain level
+   void SetADSR(float attack, float decay, float sustain, float release);
+
+   void ClearSegments();
+
+   /// Appends a segment moving to level over time seconds.  Returns the
+   /// segment's index, or -1 if there are already kMaxSegments.
+   int AddSegment(float level, float time, int shape = kExponential);
+
+   /// Segment to hold at while the gate is on, -1 for a one-shot envelope
+   void SetSustainSegment(int segment) { fSustain = segment; }
+
+   /// How far past the target exponential segments aim, as a fraction of the
+   /// segment's span.  Small values curve more sharply.
+   void SetCurve(float curve) { fCurve = curve; }
+
+   /// Rate the envelope is rendered at, in values per second.  0 (the
+   /// default) means the server's sample rate; a control-rate envelope
+   /// rendering one value per sub-block sets it to Fs / sub-block length.
+   void SetRate(float rate) { fRate = rate; }
+
+   /// Starts from the first segment at the current level, so retriggering a
+   /// sounding envelope doesn't click
+   void NoteOn();
+   void NoteOff();
+
+   /// Silences immediately
+   void Reset();
+
+   /// Writes the envelope into out
+   void Render(float* out, int frames);
+
+   /// Multiplies buffer by the envelope
+   void Apply(float* buffer, int frames);
+
+   bool Idle() const { return fNumSegments > 0 && fStage == kIdle; }
+   float Level() const { return fLevel; }
+
+   /// segment currently playing, or -1 when idle
+   int Stage() const { return fStage; }
+
+private:
+   enum
+   {
+      kIdle = -1
+   };
+
+   struct Segment
+   {
+      float fLevel;
+      float fTime;
+      int fShape;
+   };
+
+   void EnterSegment(int segment);
+   void Hold();
+   void Process(float* buffer, int frames, bool multiply);
+
+   Segment fSegments[kMaxSegments];
+   int fNumSegments;
+   int fSustain;
+   float fCurve;
+   float fRate;
+
+   bool fGate;
+   int fStage;
+   bool fHolding;
+   float fLevel;
+   float fTarget;
+   int fRemaining;
+
+   // linear segments add fIncrement, exponential ones compute
+   // level = fBase + level * fCoef
+   int fShape;
+   float fIncrement;
+   float fCoef;
+   float fBase;
+};
+
+#endif
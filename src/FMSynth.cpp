@@ -0,0 +1,559 @@
+#include "FMSynth.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "AlignedMemory.h"
+#include "MathHelpers.h"
+#include "Tuning.h"
+
+//------ SineTable ------//
+
+const double SineTable::kPhaseScale = 4294967296.0;
+
+const float* SineTable::Get()
+{
+   struct Table
+   {
+      Table()
+      {
+         // one guard point so interpolation at the last index needs no wrap
+         for (int i = 0; i <= kSize; ++i)
+         {
+            fData[i] = (float)sin(2.0 * M_PI * i / kSize);
+         }
+      }
+      float fData[kSize + 1];
+   };
+   static Table sTable;
+   return sTable.fData;
+}
+
+//------ FMSynth::Algorithm ------//
+
+FMSynth::Algorithm::Algorithm(int numOperators)
+: fNumOperators(std::min(std::max(numOperators, 1), (int)kMaxOperators))
+, fCarriers(1)
+, fFeedbackOperator(-1)
+{
+   memset(fModulators, 0, sizeof(fModulators));
+}
+
+void FMSynth::Algorithm::Connect(int source, int target)
+{
+   if (source > target && source < fNumOperators)
+   {
+      fModulators[target] |= 1u << source;
+   }
+}
+
+FMSynth::Algorithm FMSynth::Algorithm::Stack(int n)
+{
+   Algorithm a(n);
+   for (int k = 1; k < a.fNumOperators; ++k)
+   {
+      a.Connect(k, k - 1);
+   }
+   a.fCarriers = 1;
+   a.fFeedbackOperator = a.fNumOperators - 1;
+   return a;
+}
+
+FMSynth::Algorithm FMSynth::Algorithm::Parallel(int n)
+{
+   Algorithm a(n);
+   a.fCarriers = (1u << a.fNumOperators) - 1;
+   return a;
+}
+
+FMSynth::Algorithm FMSynth::Algorithm::Pairs(int n)
+{
+   Algorithm a(n);
+   a.fCarriers = 0;
+   for (int k = 0; k < a.fNumOperators; k += 2)
+   {
+      a.fCarriers |= 1u << k;
+      a.Connect(k + 1, k);
+   }
+   a.fFeedbackOperator = a.fNumOperators > 1 ? 1 : -1;
+   return a;
+}
+
+FMSynth::Algorithm FMSynth::Algorithm::Branch(int n)
+{
+   Algorithm a(n);
+   for (int k = 1; k < a.fNumOperators; ++k)
+   {
+      a.Connect(k, 0);
+   }
+   a.fCarriers = 1;
+   a.fFeedbackOperator = a.fNumOperators - 1;
+   return a;
+}
+
+//------ FMSynth ------//
+
+FMSynth::FMSynth(int numOperators, int maxVoices)
+: fNumOperators(std::min(std::max(numOperators, 1), (int)kMaxOperators))
+, fMaxVoices(std::min(std::max(maxVoices, 1), (int)kMaxVoices))
+, fAlgorithm(Algorithm::Stack(numOperators))
+, fAlgorithmPending(false)
+, fFeedback(0.f)
+, fGain(0.25f)
+, fEventChannel(-1)
+, fNumActive(0)
+, fNextAge(0)
+, fControlRemaining(0)
+, fSine(SineTable::Get())
+{
+   for (int k = 0; k < kMaxOperators; ++k)
+   {
+      fRatio[k] = 1.f;
+      fDetune[k] = 0.f;
+      fLevel[k] = 1.f;
+      fEnvAttack[k] = 0.005f;
+      fEnvDecay[k] = 0.5f;
+      fEnvSustain[k] = 0.7f;
+      fEnvRelease[k] = 0.3f;
+   }
+
+   const size_t slots = kMaxOperators * kMaxVoices;
+   fPhase = (uint32_t*)MusKit::AlignedAlloc(slots * sizeof(uint32_t));
+   fIncrement = (uint32_t*)MusKit::AlignedAlloc(slots * sizeof(uint32_t));
+   fOutput = (float*)MusKit::AlignedAlloc(slots * sizeof(float));
+   fAmp = (float*)MusKit::AlignedAlloc(slots * sizeof(float));
+   fAmpStep = (float*)MusKit::AlignedAlloc(slots * sizeof(float));
+   fFeedback1 = (float*)MusKit::AlignedAlloc(kMaxVoices * sizeof(float));
+   fFeedback2 = (float*)MusKit::AlignedAlloc(kMaxVoices * sizeof(float));
+   fModSum = (float*)MusKit::AlignedAlloc(kMaxVoices * sizeof(float));
+   memset(fPhase, 0, slots * sizeof(uint32_t));
+   memset(fIncrement, 0, slots * sizeof(uint32_t));
+   memset(fOutput, 0, slots * sizeof(float));
+   memset(fAmp, 0, slots * sizeof(float));
+   memset(fAmpStep, 0, slots * sizeof(float));
+   memset(fFeedback1, 0, kMaxVoices * sizeof(float));
+   memset(fFeedback2, 0, kMaxVoices * sizeof(float));
+
+   fEnvelopes = new Envelope[slots];
+   fVelocity = new float[kMaxVoices];
+   fNote = new int[kMaxVoices];
+   fChannel = new int[kMaxVoices];
+   fBend = new float[kMaxVoices];
+   fReleased = new bool[kMaxVoices];
+   fAge = new unsigned[kMaxVoices];
+}
+
+FMSynth::~FMSynth()
+{
+   MusKit::AlignedFree(fPhase);
+   MusKit::AlignedFree(fIncrement);
+   MusKit::AlignedFree(fOutput);
+   MusKit::AlignedFree(fAmp);
+   MusKit::AlignedFree(fAmpStep);
+   MusKit::AlignedFree(fFeedback1);
+   MusKit::AlignedFree(fFeedback2);
+   MusKit::AlignedFree(fModSum);
+   delete[] fEnvelopes;
+   delete[] fVelocity;
+   delete[] fNote;
+   delete[] fChannel;
+   delete[] fBend;
+   delete[] fReleased;
+   delete[] fAge;
+}
+
+void FMSynth::SetAlgorithm(const Algorithm& algorithm)
+{
+   fPendingAlgorithm = algorithm;
+   fAlgorithmPending = true;
+}
+
+void FMSynth::ApplyAlgorithm()
+{
+   const int previous = fNumOperators;
+   fAlgorithm = fPendingAlgorithm;
+   fNumOperators = fAlgorithm.fNumOperators;
+   fAlgorithmPending = false;
+
+   // slots of added operators hold nothing (or a long-gone voice's state)
+   const float fs = AudioServer::GetInstance()->Fs();
+   for (int v = 0; v < fNumActive; ++v)
+   {
+      const float freq = Tuning::GetInstance()->Frequency(fNote[v], fChannel[v]);
+      for (int k = previous; k < fNumOperators; ++k)
+      {
+         StartOperator(v, k, freq, fs);
+         fAmp[k * kMaxVoices + v] = 0.f;
+         fAmpStep[k * kMaxVoices + v] = 0.f;
+         if (fReleased[v])
+            fEnvelopes[k * kMaxVoices + v].NoteOff();
+      }
+   }
+}
+
+void FMSynth::SetOperatorRatio(int op, float ratio, float detune)
+{
+   fRatio[op] = ratio;
+   fDetune[op] = detune;
+}
+
+void FMSynth::SetOperatorLevel(int op, float level)
+{
+   fLevel[op] = level;
+}
+
+void FMSynth::SetOperatorEnvelope(int op, float attack, float decay, float sustain, float release)
+{
+   fEnvAttack[op] = attack;
+   fEnvDecay[op] = decay;
+   fEnvSustain[op] = sustain;
+   fEnvRelease[op] = release;
+}
+
+void FMSynth::HandleEvent(const MidiEvent& event)
+{
+   // note ons take the channel, whose bend the voice then follows
+   fEventChannel = event.fChannel;
+   MidiClient::HandleEvent(event);
+   fEventChannel = -1;
+}
+
+void FMSynth::NoteOn(int note, int velocity)
+{
+   if (fAlgorithmPending)
+      ApplyAlgorithm();
+
+   // retrigger a held note in place
+   for (int v = 0; v < fNumActive; ++v)
+   {
+      if (fNote[v] == note && !fReleased[v])
+      {
+         fVelocity[v] = velocity / 127.f;
+         fAge[v] = fNextAge++;
+         if (fChannel[v] != fEventChannel)
+         {
+            fChannel[v] = fEventChannel;
+            UpdatePitch(v);
+         }
+         for (int k = 0; k < fNumOperators; ++k)
+         {
+            fEnvelopes[k * kMaxVoices + v].NoteOn();
+         }
+         return;
+      }
+   }
+
+   int v = -1;
+   if (fNumActive < fMaxVoices)
+   {
+      v = fNumActive++;
+   }
+   else
+   {
+      // steal the oldest released voice, or failing that the oldest voice
+      for (int pass = 0; pass < 2 && v < 0; ++pass)
+      {
+         unsigned oldest = 0;
+         for (int i = 0; i < fNumActive; ++i)
+         {
+            if ((pass == 1 || fReleased[i]) && (v < 0 || fAge[i] - fNextAge < oldest - fNextAge))
+            {
+               v = i;
+               oldest = fAge[i];
+            }
+         }
+      }
+   }
+
+   StartVoice(v, note, velocity);
+}
+
+void FMSynth::NoteOff(int note)
+{
+   for (int v = 0; v < fNumActive; ++v)
+   {
+      if (fNote[v] == note && !fReleased[v])
+      {
+         fReleased[v] = true;
+         for (int k = 0; k < fNumOperators; ++k)
+         {
+            fEnvelopes[k * kMaxVoices + v].NoteOff();
+         }
+      }
+   }
+}
+
+void FMSynth::StartVoice(int v, int note, int velocity)
+{
+   const float fs = AudioServer::GetInstance()->Fs();
+   const Tuning* tuning = Tuning::GetInstance();
+   const float freq = tuning->Frequency(note, fEventChannel);
+
+   fNote[v] = note;
+   fChannel[v] = fEventChannel;
+   fBend[v] = tuning->PitchBend(fEventChannel);
+   fVelocity[v] = velocity / 127.f;
+   fReleased[v] = false;
+   fAge[v] = fNextAge++;
+   fFeedback1[v] = 0.f;
+   fFeedback2[v] = 0.f;
+
+   for (int k = 0; k < fNumOperators; ++k)
+   {
+      StartOperator(v, k, freq, fs);
+   }
+}
+
+void FMSynth::StartOperator(int v, int k, float freq, float fs)
+{
+   const int slot = k * kMaxVoices + v;
+   const double hz = freq * fRatio[k] + fDetune[k];
+   fIncrement[slot] = (uint32_t)(int64_t)(hz / fs * SineTable::kPhaseScale);
+   fPhase[slot] = 0;
+   fOutput[slot] = 0.f;
+
+   Envelope& env = fEnvelopes[slot];
+   env.SetADSR(fEnvAttack[k], fEnvDecay[k], fEnvSustain[k], fEnvRelease[k]);
+   env.SetRate(fs / kControlPeriod);
+   env.NoteOn();
+}
+
+void FMSynth::UpdatePitch(int v)
+{
+   // phases carry on, so the bend glides rather than retriggers
+   const Tuning* tuning = Tuning::GetInstance();
+   const float fs = AudioServer::GetInstance()->Fs();
+   const float freq = tuning->Frequency(fNote[v], fChannel[v]);
+   fBend[v] = tuning->PitchBend(fChannel[v]);
+   for (int k = 0; k < fNumOperators; ++k)
+   {
+      const double hz = freq * fRatio[k] + fDetune[k];
+      fIncrement[k * kMaxVoices + v] = (uint32_t)(int64_t)(hz / fs * SineTable::kPhaseScale);
+   }
+}
+
+void FMSynth::SwapVoices(int a, int b)
+{
+   for (int k = 0; k < fNumOperators; ++k)
+   {
+      const int sa = k * kMaxVoices + a;
+      const int sb = k * kMaxVoices + b;
+      std::swap(fPhase[sa], fPhase[sb]);
+      std::swap(fIncrement[sa], fIncrement[sb]);
+      std::swap(fOutput[sa], fOutput[sb]);
+      std::swap(fAmp[sa], fAmp[sb]);
+      std::swap(fAmpStep[sa], fAmpStep[sb]);
+      std::swap(fEnvelopes[sa], fEnvelopes[sb]);
+   }
+   std::swap(fFeedback1[a], fFeedback1[b]);
+   std::swap(fFeedback2[a], fFeedback2[b]);
+   std::swap(fVelocity[a], fVelocity[b]);
+   std::swap(fNote[a], fNote[b]);
+   std::swap(fChannel[a], fChannel[b]);
+   std::swap(fBend[a], fBend[b]);
+   std::swap(fReleased[a], fReleased[b]);
+   std::swap(fAge[a], fAge[b]);
+}
+
+void FMSynth::RetireVoice(int v)
+{
+   // keep sounding voices packed at the front
+   --fNumActive;
+   if (v != fNumActive)
+   {
+      SwapVoices(v, fNumActive);
+   }
+   for (int k = 0; k < fNumOperators; ++k)
+   {
+      fAmp[k * kMaxVoices + fNumActive] = 0.f;
+      fAmpStep[k * kMaxVoices + fNumActive] = 0.f;
+   }
+}
+
+void FMSynth::UpdateEnvelopes(int frames)
+{
+   const uint32_t carriers = fAlgorithm.fCarriers;
+   const Tuning* tuning = Tuning::GetInstance();
+
+   for (int v = fNumActive - 1; v >= 0; --v)
+   {
+      // a voice is done once its carriers' envelopes finished last period
+      // (their ramps to zero have played out by now)
+      bool idle = true;
+      for (int k = 0; k < fNumOperators && idle; ++k)
+      {
+         if (carriers & (1u << k))
+            idle = fEnvelopes[k * kMaxVoices + v].Idle();
+      }
+      if (idle)
+      {
+         RetireVoice(v);
+         continue;
+      }
+
+      if (tuning->PitchBend(fChannel[v]) != fBend[v])
+         UpdatePitch(v);
+
+      for (int k = 0; k < fNumOperators; ++k)
+      {
+         const int slot = k * kMaxVoices + v;
+         float level;
+         fEnvelopes[slot].Render(&level, 1);
+         level *= fLevel[k];
+         if (carriers & (1u << k))
+            level *= fVelocity[v];
+         fAmpStep[slot] = (level - fAmp[slot]) / frames;
+      }
+   }
+}
+
+void FMSynth::Render(float* buffer, int frames)
+{
+   const float radiansToPhase = (float)(SineTable::kPhaseScale / (2.0 * M_PI));
+   const float* sine = fSine;
+   const uint32_t carriers = fAlgorithm.fCarriers;
+   const int feedbackOp = fAlgorithm.fFeedbackOperator;
+   const float feedback = fFeedback * 0.5f;
+
+   int done = 0;
+   while (done < frames)
+   {
+      if (fControlRemaining == 0)
+      {
+         UpdateEnvelopes(kControlPeriod);
+         fControlRemaining = kControlPeriod;
+      }
+
+      const int n = std::min(frames - done, fControlRemaining);
+      const int voices = fNumActive;
+      if (voices == 0)
+      {
+         done += n;
+         fControlRemaining -= n;
+         continue;
+      }
+
+      for (int s = 0; s < n; ++s)
+      {
+         float sample = 0.f;
+
+         for (int k = fNumOperators - 1; k >= 0; --k)
+         {
+            float* mod = fModSum;
+            memset(mod, 0, voices * sizeof(float));
+
+            const uint32_t modulators = fAlgorithm.fModulators[k];
+            for (int j = k + 1; j < fNumOperators; ++j)
+            {
+               if (modulators & (1u << j))
+               {
+                  const float* src = fOutput + j * kMaxVoices;
+                  for (int v = 0; v < voices; ++v)
+                     mod[v] += src[v];
+               }
+            }
+
+            if (k == feedbackOp)
+            {
+               for (int v = 0; v < voices; ++v)
+                  mod[v] += feedback * (fFeedback1[v] + fFeedback2[v]);
+            }
+
+            uint32_t* phase = fPhase + k * kMaxVoices;
+            const uint32_t* increment = fIncrement + k * kMaxVoices;
+            float* out = fOutput + k * kMaxVoices;
+            float* amp = fAmp + k * kMaxVoices;
+            const float* ampStep = fAmpStep + k * kMaxVoices;
+
+            if (k == feedbackOp)
+            {
+               // the feedback path takes the operator's unscaled output
+               for (int v = 0; v < voices; ++v)
+               {
+                  const uint32_t offset = (uint32_t)(int64_t)(mod[v] * radiansToPhase);
+                  const float raw = SineTable::Lookup(sine, phase[v] + offset);
+                  out[v] = raw * amp[v];
+                  amp[v] += ampStep[v];
+                  phase[v] += increment[v];
+                  fFeedback2[v] = fFeedback1[v];
+                  fFeedback1[v] = raw;
+               }
+            }
+            else
+            {
+               for (int v = 0; v < voices; ++v)
+               {
+                  const uint32_t offset = (uint32_t)(int64_t)(mod[v] * radiansToPhase);
+                  out[v] = SineTable::Lookup(sine, phase[v] + offset) * amp[v];
+                  amp[v] += ampStep[v];
+                  phase[v] += increment[v];
+               }
+            }
+
+            if (carriers & (1u << k))
+            {
+               for (int v = 0; v < voices; ++v)
+                  sample += out[v];
+            }
+         }
+
+         buffer[done + s] = sample * fGain;
+      }
+
+      done += n;
+      fControlRemaining -= n;
+   }
+}
+
+//------ FMPairKernel ------//
+
+void FMPairKernel::Start(int v, int note, int velocity)
+{
+   const double increment = Tuning::GetInstance()->Increment(note);
+
+   fCarrierPhase[v] = 0;
+   fModPhase[v] = 0;
+   fCarrierIncrement[v] = (uint32_t)(int64_t)(increment * SineTable::kPhaseScale);
+   fModIncrement[v] = (uint32_t)(int64_t)(increment * fRatio * SineTable::kPhaseScale);
+   fVelocity[v] = velocity / 127.f;
+}
+
+void FMPairKernel::Render(float* out, int frames, int first, float* gain, const float* gainStep)
+{
+   const float* sine = fSine;
+   const float depth = fIndex * (float)(SineTable::kPhaseScale / (2.0 * M_PI));
+   uint32_t* carrierPhase = fCarrierPhase + first;
+   uint32_t* modPhase = fModPhase + first;
+   const uint32_t* carrierIncrement = fCarrierIncrement + first;
+   const uint32_t* modIncrement = fModIncrement + first;
+
+   float g[kLanes];
+   float step[kLanes];
+   for (int lane = 0; lane < kLanes; ++lane)
+   {
+      g[lane] = gain[lane] * fVelocity[first + lane];
+      step[lane] = gainStep[lane] * fVelocity[first + lane];
+   }
+
+   for (int i = 0; i < frames; ++i)
+   {
+      float sum = 0.f;
+      for (int lane = 0; lane < kLanes; ++lane)
+      {
+         const float mod = SineTable::Lookup(sine, modPhase[lane]) * depth;
+         const uint32_t offset = (uint32_t)(int64_t)mod;
+         sum += SineTable::Lookup(sine, carrierPhase[lane] + offset) * g[lane];
+         g[lane] += step[lane];
+         modPhase[lane] += modIncrement[lane];
+         carrierPhase[lane] += carrierIncrement[lane];
+      }
+      out[i] += sum;
+   }
+
+   for (int lane = 0; lane < kLanes; ++lane)
+   {
+      gain[lane] += gainStep[lane] * frames;
+   }
+}
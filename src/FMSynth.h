@@ -0,0 +1,231 @@
+#ifndef h_FMSynth
+#define h_FMSynth
+
+#include <stdint.h>
+
+#include "AudioClient.h"
+#include "MidiServer.h"
+#include "Envelope.h"
+
+// SineTable
+// ----------------
+/// \brief Shared sine lookup indexed by a 32-bit fixed-point phase (one
+/// cycle is 2^32), read with linear interpolation.
+///
+/// Fixed-point phases wrap for free on overflow, so oscillators never need
+/// to test and subtract, and phase modulation is an integer add.
+class SineTable
+{
+public:
+   enum
+   {
+      kBits = 12,
+      kSize = 1 << kBits,
+      kFractionBits = 32 - kBits
+   };
+
+   /// phase units per cycle, as a float, for converting Hz and radians
+   static const double kPhaseScale;
+
+   static const float* Get();
+
+   static inline float Lookup(const float* table, uint32_t phase)
+   {
+      const uint32_t index = phase >> kFractionBits;
+      const float frac = (phase & ((1 << kFractionBits) - 1)) * (1.f / (1 << kFractionBits));
+      return table[index] + frac * (table[index + 1] - table[index]);
+   }
+};
+
+// FMSynth
+// ----------------
+/// \brief Polyphonic N-operator FM (phase modulation) synthesizer.
+///
+/// Each voice has up to kMaxOperators sine operators.  An Algorithm says which
+/// operators modulate which, which are carriers (heard), and which one feeds
+/// back on itself.  Operators are evaluated from the highest index down, so a
+/// modulator must have a higher index than the operators it modulates, as in
+/// the DX7's diagrams (operator 0 here is the DX's operator 1).
+///
+/// All voice state is stored operator-major in arrays of kMaxVoices (phase,
+/// increment, output, envelope level), and each step of the inner loop works
+/// on one operator across every sounding voice, so the compiler can vectorize
+/// over voices.  Sounding voices are kept packed at the front of the arrays.
+///
+/// Operator envelopes run at control rate (one value per kControlPeriod
+/// samples) and are ramped across each period.
+///
+/// An operator's level is its output amplitude for a carrier and its
+/// modulation index in radians for a modulator.
+///
+/// Voices follow the pitch bend of their note's channel (see Tuning), re-read
+/// every control period.
+class FMSynth : public AudioClient
+              , public MidiClient
+{
+public:
+   enum
+   {
+      kMaxOperators = 8,
+      kMaxVoices = 64,
+      kControlPeriod = 16
+   };
+
+   // Algorithm
+   // ----------------
+   /// \brief Operator routing for an FMSynth.
+   struct Algorithm
+   {
+      Algorithm(int numOperators = 4);
+
+      /// source modulates target; requires source > target (or use feedback)
+      void Connect(int source, int target);
+
+      int fNumOperators;
+      uint32_t fModulators[kMaxOperators]; // bit j set: operator j modulates this one
+      uint32_t fCarriers;                  // bit k set: operator k is heard
+      int fFeedbackOperator;               // -1 for none
+
+      /// n-1 -> ... -> 1 -> 0, feedback on the top
+      static Algorithm Stack(int n);
+
+      /// all operators are carriers (additive)
+      static Algorithm Parallel(int n);
+
+      /// (1 -> 0), (3 -> 2), ...: n/2 two-operator voices in parallel
+      static Algorithm Pairs(int n);
+
+      /// every other operator modulates operator 0
+      static Algorithm Branch(int n);
+   };
+
+   FMSynth(int numOperators = 4, int maxVoices = kMaxVoices);
+   ~FMSynth();
+
+   void Render(float* buffer, int frames);
+
+   void HandleEvent(const MidiEvent& event);
+   void NoteOn(int note, int velocity);
+   void NoteOff(int note);
+
+   /// Takes effect for the next note on.  Operators the new algorithm adds
+   /// start then on the voices already sounding, at their notes' pitch.
+   void SetAlgorithm(const Algorithm& algorithm);
+   const Algorithm& GetAlgorithm() const { return fAlgorithm; }
+
+   /// frequency is note frequency * ratio + detune (Hz)
+   void SetOperatorRatio(int op, float ratio, float detune = 0.f);
+   void SetOperatorLevel(int op, float level);
+   void SetOperatorEnvelope(int op, float attack, float decay, float sustain, float release);
+
+   /// feedback amount in radians for the algorithm's feedback operator
+   void SetFeedback(float feedback) { fFeedback = feedback; }
+
+   void SetGain(float gain) { fGain = gain; }
+
+   int ActiveVoices() const { return fNumActive; }
+
+private:
+   void StartVoice(int v, int note, int velocity);
+   void StartOperator(int v, int k, float freq, float fs);
+   void UpdatePitch(int v);
+   void ApplyAlgorithm();
+   void UpdateEnvelopes(int frames);
+   void RetireVoice(int v);
+   void SwapVoices(int a, int b);
+
+   int fNumOperators;
+   int fMaxVoices;
+   Algorithm fAlgorithm;
+   Algorithm fPendingAlgorithm;
+   bool fAlgorithmPending;
+
+   // per operator settings
+   float fRatio[kMaxOperators];
+   float fDetune[kMaxOperators];
+   float fLevel[kMaxOperators];
+   float fEnvAttack[kMaxOperators];
+   float fEnvDecay[kMaxOperators];
+   float fEnvSustain[kMaxOperators];
+   float fEnvRelease[kMaxOperators];
+   float fFeedback;
+   float fGain;
+
+   // per voice state, operator-major: fPhase[op * kMaxVoices + voice]
+   uint32_t* fPhase;
+   uint32_t* fIncrement;
+   float* fOutput;
+   float* fAmp;
+   float* fAmpStep;
+   float* fFeedback1;
+   float* fFeedback2;
+   float* fModSum;
+   Envelope* fEnvelopes;
+   float* fVelocity;
+   int* fNote;
+   int* fChannel;
+   float* fBend;       // the channel's pitch bend the increments were set for
+   bool* fReleased;
+   unsigned* fAge;
+
+   int fEventChannel;  // of the event being handled, -1 outside HandleEvent
+   int fNumActive;
+   unsigned fNextAge;
+   int fControlRemaining;
+   const float* fSine;
+};
+
+// FMPairKernel
+// ----------------
+/// \brief Two-operator FM voices (as FMOsc) for a PolyBank.
+///
+/// One modulator at a ratio of the note frequency drives one carrier.  Phases
+/// are fixed point, as in FMSynth, so the lane loop has no branches.  The
+/// ratio is picked up at note on; the index applies immediately.
+class FMPairKernel
+{
+public:
+   enum
+   {
+      kLanes = 8,
+      kMaxVoices = 64
+   };
+
+   FMPairKernel()
+   : fRatio(1.f)
+   , fIndex(0.f)
+   , fSine(SineTable::Get())
+   {
+      for (int v = 0; v < kMaxVoices; ++v)
+      {
+         fCarrierPhase[v] = fModPhase[v] = 0;
+         fCarrierIncrement[v] = fModIncrement[v] = 0;
+         fVelocity[v] = 0.f;
+      }
+   }
+
+   /// modulator frequency as a multiple of the note frequency
+   void SetRatio(float ratio) { fRatio = ratio; }
+
+   /// modulation index in radians
+   void SetIndex(float index) { fIndex = index; }
+
+   void Start(int v, int note, int velocity);
+
+   bool Done(int v) const { return false; }
+
+   void Render(float* out, int frames, int first, float* gain, const float* gainStep);
+
+private:
+   float fRatio;
+   float fIndex;
+   const float* fSine;
+
+   uint32_t fCarrierPhase[kMaxVoices];
+   uint32_t fCarrierIncrement[kMaxVoices];
+   uint32_t fModPhase[kMaxVoices];
+   uint32_t fModIncrement[kMaxVoices];
+   float fVelocity[kMaxVoices];
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include "Granular.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "MathHelpers.h"
+#include "ScratchArena.h"
+
+GranularCloud::GranularCloud(int maxGrains, float liveBufferSeconds)
+: MultiOutputClient(2)
+, fMaxGrains(maxGrains)
+, fNumFree(0)
+, fNumActive(0)
+, fSource(NULL)
+, fSourceSize(0)
+, fInput(NULL)
+, fLiveBuffer(NULL)
+, fLiveBufferSize(0)
+, fLiveWrite(0)
+, fLiveBlockStart(0)
+, fNextOnset(0)
+, fDensity(20.f)
+, fGrainLength(0.05f)
+, fPosition(0.f)
+, fPositionSpread(0.f)
+, fPitch(1.f)
+, fPitchSpread(0.f)
+, fPan(0.f)
+, fPanSpread(0.f)
+, fAmp(1.f)
+, fAmpSpread(0.f)
+, fWindow(NULL)
+, fInterpolator(Interpolator::kInterpolationTypeLinear)
+, fRandomState(0x9E3779B9)
+{
+   fGrainPosition = new double[maxGrains];
+   fGrainIncrement = new double[maxGrains];
+   fGrainEnvIndex = new double[maxGrains];
+   fGrainEnvIncrement = new double[maxGrains];
+   fGrainRemaining = new int[maxGrains];
+   fGrainOffset = new int[maxGrains];
+   fGrainGainL = new float[maxGrains];
+   fGrainGainR = new float[maxGrains];
+   fFreeGrains = new int[maxGrains];
+   fActiveGrains = new int[maxGrains];
+
+   for (int g = 0; g < maxGrains; ++g)
+   {
+      fFreeGrains[g] = maxGrains - 1 - g;
+   }
+   fNumFree = maxGrains;
+
+   fLiveBufferSize = std::max(1, (int)(liveBufferSeconds * AudioServer::GetInstance()->Fs()));
+   fLiveBuffer = new float[fLiveBufferSize];
+   memset(fLiveBuffer, 0, fLiveBufferSize * sizeof(float));
+
+   SetWindowType(WindowFunction::kHann);
+}
+
+GranularCloud::~GranularCloud()
+{
+   delete[] fGrainPosition;
+   delete[] fGrainIncrement;
+   delete[] fGrainEnvIndex;
+   delete[] fGrainEnvIncrement;
+   delete[] fGrainRemaining;
+   delete[] fGrainOffset;
+   delete[] fGrainGainL;
+   delete[] fGrainGainR;
+   delete[] fFreeGrains;
+   delete[] fActiveGrains;
+   delete[] fLiveBuffer;
+}
+
+void GranularCloud::RetireAllGrains()
+{
+   // grains hold positions into the old source
+   while (fNumActive > 0)
+   {
+      fFreeGrains[fNumFree++] = fActiveGrains[--fNumActive];
+   }
+}
+
+void GranularCloud::SetSource(const float* buffer, int frames)
+{
+   // RenderChannels walks the grain lists, so swap between blocks
+   AudioServer::GetInstance()->EnterLock();
+   RetireAllGrains();
+   fInput = NULL;
+   fSource = buffer;
+   fSourceSize = frames;
+   AudioServer::GetInstance()->ExitLock();
+}
+
+void GranularCloud::SetInput(AudioClient* input)
+{
+   AudioServer::GetInstance()->EnterLock();
+   RetireAllGrains();
+   fSource = NULL;
+   fSourceSize = 0;
+   fInput = input;
+   AudioServer::GetInstance()->ExitLock();
+}
+
+void GranularCloud::Prepare(int maxFrames)
+{
+   MultiOutputClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+}
+
+void GranularCloud::SetWindowType(unsigned int type)
+{
+   fWindow = WindowTableCache::GetInstance()->getTable(type, kGrainWindowSize);
+}
+
+float GranularCloud::Random()
+{
+   // xorshift: cheap, lock free and deterministic, unlike rand()
+   fRandomState ^= fRandomState << 13;
+   fRandomState ^= fRandomState >> 17;
+   fRandomState ^= fRandomState << 5;
+   return (fRandomState >> 8) * (1.f / 16777216.f);
+}
+
+void GranularCloud::RecordInput(int frames)
+{
+   ScratchBuffer input(frames);
+   fInput->Process(input, frames);
+
+   int done = 0;
+   while (done < frames)
+   {
+      const int n = std::min(frames - done, fLiveBufferSize - fLiveWrite);
+      memcpy(fLiveBuffer + fLiveWrite, input + done, n * sizeof(float));
+      fLiveWrite += n;
+      done += n;
+      if (fLiveWrite == fLiveBufferSize)
+         fLiveWrite = 0;
+   }
+}
+
+void GranularCloud::SpawnGrain(int offset)
+{
+   if (fNumFree == 0)
+      return;
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   int length = std::max(1, (int)(fGrainLength * fs));
+   const double pitch = fPitch * powf(2.f, fPitchSpread * (Random() * 2.f - 1.f) / 12.f);
+   const float position = fPosition + fPositionSpread * (Random() * 2.f - 1.f);
+
+   double start = 0;
+   if (fInput)
+   {
+      // read behind the write head, far enough back that a grain playing
+      // faster than real time never overtakes it
+      const int size = fLiveBufferSize;
+      const double lead = std::max(0.0, (pitch - 1.0) * length) + 4;
+      const int writeHead = fLiveBlockStart + offset;
+      start = writeHead - std::max(0.f, position) * size - lead;
+      start = fmod(start, (double)size);
+      if (start < 0)
+         start += size;
+   }
+   else if (fSource && fSourceSize > 0)
+   {
+      // only the live ring wraps: keep the grain, and Lagrange3's three taps
+      // past its last read, inside the sample
+      const double last = fSourceSize - 4;
+      if (last <= 0)
+         return;
+      if (pitch * length > last)
+         length = std::max(1, (int)(last / pitch));
+      start = std::min(std::max(position, 0.f), 1.f) * (fSourceSize - 1);
+      start = std::min(start, std::max(0.0, last - pitch * length));
+   }
+   else
+   {
+      return;
+   }
+
+   const float pan = std::min(std::max(fPan + fPanSpread * (Random() * 2.f - 1.f), -1.f), 1.f);
+   const float angle = (pan + 1.f) * MusKit::PI / 4.f;
+   const float amp = fAmp * (1.f - fAmpSpread * Random());
+
+   const int g = fFreeGrains[--fNumFree];
+   fGrainPosition[g] = start;
+   fGrainIncrement[g] = pitch;
+   fGrainEnvIndex[g] = 0;
+   fGrainEnvIncrement[g] = kGrainWindowSize / (double)length;
+   fGrainRemaining[g] = length;
+   fGrainOffset[g] = offset;
+   fGrainGainL[g] = amp * cosf(angle);
+   fGrainGainR[g] = amp * sinf(angle);
+   fActiveGrains[fNumActive++] = g;
+}
+
+void GranularCloud::RenderGrain(int g, float* left, float* right, int frames)
+{
+   const float* source = fInput ? fLiveBuffer : fSource;
+   const int sourceSize = fInput ? fLiveBufferSize : fSourceSize;
+
+   const int start = fGrainOffset[g];
+   const int n = std::min(frames - start, fGrainRemaining[g]);
+   const float gainL = fGrainGainL[g];
+   const float gainR = fGrainGainR[g];
+
+   double position = fGrainPosition[g];
+   double envIndex = fGrainEnvIndex[g];
+   const double envIncrement = fGrainEnvIncrement[g];
+
+   float* l = left + start;
+   float* r = right + start;
+   for (int done = 0; done < n; done += kGrainChunk)
+   {
+      const int count = std::min((int)kGrainChunk, n - done);
+
+      fWindow->fill(fEnvChunk, count, envIndex, envIncrement);
+      envIndex += count * envIncrement;
+
+      position = fInterpolator.InterpolateBlock(source, sourceSize, position, fGrainIncrement[g], fSourceChunk, count);
+
+      for (int i = 0; i < count; ++i)
+      {
+         const float s = fSourceChunk[i] * fEnvChunk[i];
+         l[done + i] += s * gainL;
+         r[done + i] += s * gainR;
+      }
+   }
+
+   fGrainPosition[g] = position;
+   fGrainEnvIndex[g] = envIndex;
+   fGrainRemaining[g] -= n;
+   fGrainOffset[g] = 0;
+}
+
+void GranularCloud::RenderChannels(float** buffers, int numChannels, int frames)
+{
+   fInterpolator.SetQuality(QualityGovernor::GetInstance()->Quality());
+
+   if (fInput)
+   {
+      fLiveBlockStart = fLiveWrite;
+      RecordInput(frames);
+   }
+
+   // schedule this block's onsets to the sample
+   if (fDensity > 0.f)
+   {
+      const double interval = AudioServer::GetInstance()->Fs() / fDensity;
+      while (fNextOnset < frames)
+      {
+         SpawnGrain((int)fNextOnset);
+         fNextOnset += interval;
+      }
+      fNextOnset -= frames;
+   }
+
+   float* left = buffers[0];
+   float* right = buffers[1];
+   int i = 0;
+   while (i < fNumActive)
+   {
+      const int g = fActiveGrains[i];
+      RenderGrain(g, left, right, frames);
+
+      if (fGrainRemaining[g] <= 0)
+      {
+         // retire: swap the last active grain into this slot
+         fFreeGrains[fNumFree++] = g;
+         fActiveGrains[i] = fActiveGrains[--fNumActive];
+      }
+      else
+      {
+         ++i;
+      }
+   }
+}
@@ -0,0 +1,136 @@
+#ifndef h_Granular
+#define h_Granular
+
+#include "AudioClient.h"
+#include "Interpolators.h"
+#include "WindowFunction.h"
+
+// GranularCloud
+// ----------------
+/// \brief Stereo granular synthesizer drawing grains from a sample buffer or
+/// from live input.
+///
+/// Grains live in a fixed-capacity pool allocated at construction; spawning and
+/// retiring grains only moves indices between the free stack and the active
+/// list, so the render path never allocates.  Grain onsets are scheduled to the
+/// sample within each block.
+///
+/// Each grain is rendered in short chunks: the envelope is read from a shared
+/// WindowTable with WindowTable::fill, the source is read with
+/// Interpolator::InterpolateBlock, and the two are combined into the stereo
+/// mix in straight-line loops the compiler can vectorize.
+///
+/// Use Output(0) and Output(1) for the left and right channels.
+class GranularCloud : public MultiOutputClient
+{
+public:
+   GranularCloud(int maxGrains = 2048, float liveBufferSeconds = 4.f);
+   ~GranularCloud();
+
+   void RenderChannels(float** buffers, int numChannels, int frames);
+   void Prepare(int maxFrames);
+
+   /// Play grains from a sample.  The buffer isn't copied and must outlive the
+   /// cloud (or be replaced before it is freed).  Clears any live input.
+   /// Grains stay inside the sample: one that would run past the end starts
+   /// earlier, or is cut short if the sample is shorter than the grain.
+   /// Takes the AudioServer lock, so call it from a control thread.
+   void SetSource(const float* buffer, int frames);
+
+   /// Play grains from a live signal, recorded into an internal ring buffer.
+   /// Takes the AudioServer lock, like SetSource.
+   void SetInput(AudioClient* input);
+
+   /// grains per second
+   void SetDensity(float grainsPerSecond) { fDensity = grainsPerSecond; }
+
+   /// grain length in seconds
+   void SetGrainLength(float seconds) { fGrainLength = seconds; }
+
+   /// Read position, 0-1 across a sample source.  For live input this is the
+   /// delay behind the write head as a fraction of the ring buffer.
+   void SetPosition(float position) { fPosition = position; }
+
+   /// random offset added to each grain's position, same units as SetPosition
+   void SetPositionSpread(float spread) { fPositionSpread = spread; }
+
+   /// playback rate as a ratio, and random spread in semitones
+   void SetPitch(float ratio) { fPitch = ratio; }
+   void SetPitchSpread(float semitones) { fPitchSpread = semitones; }
+
+   /// pan is -1 (left) to 1 (right), spread is the random range around it
+   void SetPan(float pan) { fPan = pan; }
+   void SetPanSpread(float spread) { fPanSpread = spread; }
+
+   void SetAmp(float amp) { fAmp = amp; }
+   void SetAmpSpread(float spread) { fAmpSpread = spread; }
+
+   /// may build a window table, don't call from the audio thread
+   void SetWindowType(unsigned int type);
+
+   void SetInterpolationType(int type) { fInterpolator.SetType(type); }
+
+   int ActiveGrains() const { return fNumActive; }
+   int MaxGrains() const { return fMaxGrains; }
+
+   enum
+   {
+      kGrainWindowSize = 1024,
+      kGrainChunk = 64
+   };
+
+private:
+   void RetireAllGrains();
+   void SpawnGrain(int offset);
+   void RenderGrain(int g, float* left, float* right, int frames);
+   void RecordInput(int frames);
+   float Random();
+
+   // grain pool, stored as parallel arrays indexed by grain number
+   int fMaxGrains;
+   double* fGrainPosition;
+   double* fGrainIncrement;
+   double* fGrainEnvIndex;
+   double* fGrainEnvIncrement;
+   int* fGrainRemaining;
+   int* fGrainOffset;
+   float* fGrainGainL;
+   float* fGrainGainR;
+
+   int* fFreeGrains;
+   int fNumFree;
+   int* fActiveGrains;
+   int fNumActive;
+
+   // source
+   const float* fSource;
+   int fSourceSize;
+   AudioClient* fInput;
+   float* fLiveBuffer;
+   int fLiveBufferSize;
+   int fLiveWrite;
+   int fLiveBlockStart;
+
+   // scheduling
+   double fNextOnset;
+
+   float fDensity;
+   float fGrainLength;
+   float fPosition;
+   float fPositionSpread;
+   float fPitch;
+   float fPitchSpread;
+   float fPan;
+   float fPanSpread;
+   float fAmp;
+   float fAmpSpread;
+
+   const WindowTable* fWindow;
+   Interpolator fInterpolator;
+   unsigned int fRandomState;
+
+   float fEnvChunk[kGrainChunk];
+   float fSourceChunk[kGrainChunk];
+};
+
+#endif
@@ -1,23 +1,44 @@
 #ifndef h_Interpolaters
 #define h_Interpolaters
 
+#include <algorithm>
+#include <cmath>
+
+#include "QualityGovernor.h"
+
 // Interpolator
 // ----------------
 /// \brief Class with inline interpolation routines of various types
 ///
+/// SetQuality caps the type actually used below the one asked for:
+/// Lagrange2 at kQualityMedium and linear at kQualityLow.  Owners pass it
+/// QualityGovernor::Quality() each block.
+///
 
 class Interpolator
 {
 public:
    Interpolator(int type = kInterpolationTypeLagrange3)
    : fType(type)
+   , fActiveType(type)
+   , fQuality(QualityGovernor::kQualityHigh)
    {
-      fType = type;
    }
    
    void SetType(int type)
    {
       fType = type;
+      SetQuality(fQuality);
+   }
+   
+   void SetQuality(int quality)
+   {
+      fQuality = quality;
+      fActiveType = fType;
+      if (quality <= QualityGovernor::kQualityLow)
+         fActiveType = std::min(fType, (int)kInterpolationTypeLinear);
+      else if (quality < QualityGovernor::kQualityHigh)
+         fActiveType = std::min(fType, (int)kInterpolationTypeLagrange2);
    }
    
    enum InterpolationType
@@ -34,13 +55,13 @@ public:
    {
       float input = inputBuf[(int)index];
       float output = input;
-      if (fType == kInterpolationTypeLinear)
+      if (fActiveType == kInterpolationTypeLinear)
       {
          double delta = index - (int)index;
          float next = inputBuf[(int)(index+1) % bufferSize];
          output = inputBuf[(int)index] + delta * (next - input);
       }
-      else if (fType == kInterpolationTypeLagrange2)
+      else if (fActiveType == kInterpolationTypeLagrange2)
       {
          float next1 = inputBuf[(int)(index+1) % bufferSize];
          float next2 = inputBuf[(int)(index+2) % bufferSize];
@@ -50,7 +71,7 @@ public:
          double h2 = (delta*(delta-1))/2;
          output = h0*input+h1*next1+h2*next2;
       }
-      else if (fType == kInterpolationTypeLagrange3)
+      else if (fActiveType == kInterpolationTypeLagrange3)
       {
          float next1 = inputBuf[(int)(index+1) % bufferSize];
          float next2 = inputBuf[(int)(index+2) % bufferSize];
@@ -66,8 +87,96 @@ public:
       return output;
    }
    
+   /// Block version of Interpolate: reads n samples starting at index and
+   /// stepping by increment (>= 0, and may exceed bufferSize), wrapping
+   /// around bufferSize.  The type is
+   /// resolved once per block instead of once per sample.
+   ///
+   /// Returns the read index following the last sample, wrapped into the buffer.
+   double InterpolateBlock(const float* inputBuf, int bufferSize, double index, double increment, float* out, int n)
+   {
+      const double size = bufferSize;
+      switch (fActiveType)
+      {
+         case kInterpolationTypeLinear:
+            for (int i = 0; i < n; ++i)
+            {
+               const int i0 = (int)index;
+               const float delta = (float)(index - i0);
+               const float x0 = inputBuf[i0];
+               const float x1 = inputBuf[Wrap(i0 + 1, bufferSize)];
+               out[i] = x0 + delta * (x1 - x0);
+               index += increment;
+               if (index >= size) index = fmod(index, size);
+            }
+            break;
+            
+         case kInterpolationTypeLagrange2:
+            for (int i = 0; i < n; ++i)
+            {
+               const int i0 = (int)index;
+               const float delta = (float)(index - i0);
+               const float x0 = inputBuf[i0];
+               const float x1 = inputBuf[Wrap(i0 + 1, bufferSize)];
+               const float x2 = inputBuf[Wrap(i0 + 2, bufferSize)];
+               const float h0 = ((delta-1)*(delta-2))/2;
+               const float h1 = -delta*(delta-2);
+               const float h2 = (delta*(delta-1))/2;
+               out[i] = h0*x0+h1*x1+h2*x2;
+               index += increment;
+               if (index >= size) index = fmod(index, size);
+            }
+            break;
+            
+         case kInterpolationTypeLagrange3:
+            for (int i = 0; i < n; ++i)
+            {
+               const int i0 = (int)index;
+               const float delta = (float)(index - i0);
+               const float x0 = inputBuf[i0];
+               const float x1 = inputBuf[Wrap(i0 + 1, bufferSize)];
+               const float x2 = inputBuf[Wrap(i0 + 2, bufferSize)];
+               const float x3 = inputBuf[Wrap(i0 + 3, bufferSize)];
+               const float h0 = -((delta-1)*(delta-2)*(delta-3))/6;
+               const float h1 = (delta*(delta-2)*(delta-3))/2;
+               const float h2 = -(delta*(delta-1)*(delta-3))/2;
+               const float h3 = (delta*(delta-1)*(delta-2))/6;
+               out[i] = h0*x0+h1*x1+h2*x2+h3*x3;
+               index += increment;
+               if (index >= size) index = fmod(index, size);
+            }
+            break;
+            
+         default:
+            for (int i = 0; i < n; ++i)
+            {
+               out[i] = inputBuf[(int)index];
+               index += increment;
+               if (index >= size) index = fmod(index, size);
+            }
+            break;
+      }
+      
+      return index;
+   }
+   
+   /// The type asked for; ActiveType is the one in use at this quality
+   int Type() const { return fType; }
+   int ActiveType() const { return fActiveType; }
+   
 private:
+   // cheaper than % for the taps, which are at most three past an index
+   // inside the buffer (more than one buffer past only for tiny buffers)
+   static inline int Wrap(int index, int bufferSize)
+   {
+      while (index >= bufferSize)
+         index -= bufferSize;
+      return index;
+   }
+   
    int fType;
+   int fActiveType;
+   int fQuality;
 };
 
 #endif
\ No newline at end of file
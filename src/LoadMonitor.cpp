@@ -0,0 +1,100 @@
+#include "LoadMonitor.h"
+
+#include <cmath>
+#include <algorithm>
+
+const float LoadMonitor::kSmoothingSeconds = 0.3f;
+
+LoadMonitor::LoadMonitor()
+: fBlocksOver(0)
+, fLoad(0.f)
+, fLastLoad(0.f)
+, fPeakLoad(0.f)
+, fOverruns(0)
+, fBlocks(0)
+, fThreshold(0.9f)
+, fAlarmBlocks(0)
+, fAlarms(0)
+, fWatchdog(NULL)
+, fWatching(false)
+{
+}
+
+LoadMonitor::~LoadMonitor()
+{
+   StopWatching();
+}
+
+void LoadMonitor::EndBlock(int frames, float fs)
+{
+   if (frames <= 0)
+      return;
+
+   const double budget = frames / (double)fs;
+   const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - fBlockStart).count();
+   const float load = (float)(elapsed / budget);
+
+   // one-pole smoothing with a time constant independent of the block size
+   const float coefficient = 1.f - expf(-(float)budget / kSmoothingSeconds);
+   const float smoothed = fLoad.load(std::memory_order_relaxed);
+   fLoad.store(smoothed + coefficient * (load - smoothed), std::memory_order_relaxed);
+   fLastLoad.store(load, std::memory_order_relaxed);
+   if (load > fPeakLoad.load(std::memory_order_relaxed))
+      fPeakLoad.store(load, std::memory_order_relaxed);
+
+   if (load > 1.f)
+      fOverruns.fetch_add(1, std::memory_order_relaxed);
+   fBlocks.fetch_add(1, std::memory_order_relaxed);
+
+   const int alarmBlocks = fAlarmBlocks.load(std::memory_order_relaxed);
+   if (alarmBlocks > 0 && load > fThreshold.load(std::memory_order_relaxed))
+   {
+      if (++fBlocksOver == alarmBlocks)
+         fAlarms.fetch_add(1, std::memory_order_release);
+   }
+   else
+   {
+      fBlocksOver = 0;
+   }
+}
+
+void LoadMonitor::SetWatchdog(Watchdog* watchdog, float threshold, int blocks)
+{
+   std::lock_guard<std::mutex> lock(fWatchdogLock);
+
+   StopWatching();
+
+   fThreshold.store(threshold);
+   fAlarmBlocks.store(watchdog ? std::max(blocks, 1) : 0);
+   fWatchdog = watchdog;
+
+   if (fWatchdog)
+   {
+      fWatching.store(true);
+      fThread = std::thread(&LoadMonitor::Watch, this);
+   }
+}
+
+void LoadMonitor::StopWatching()
+{
+   fAlarmBlocks.store(0);
+   if (fWatching.exchange(false))
+      fThread.join();
+   fWatchdog = NULL;
+}
+
+void LoadMonitor::Watch()
+{
+   unsigned long seen = fAlarms.load(std::memory_order_acquire);
+   while (fWatching.load())
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(kPollMilliseconds));
+
+      const unsigned long alarms = fAlarms.load(std::memory_order_acquire);
+      if (alarms != seen)
+      {
+         seen = alarms;
+         fWatchdog->LoadAlarm(*this);
+      }
+   }
+}
@@ -0,0 +1,85 @@
+#ifndef h_LoadMonitor
+#define h_LoadMonitor
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+// LoadMonitor
+// ----------------
+/// \brief Measures how much of each block's real-time budget the server's
+/// callback used.
+///
+/// Load is callback wall time over frames / fs: 1.0 means the block took as
+/// long to render as it takes to play, and anything above that is an
+/// overrun.  Load() is smoothed over about kSmoothingSeconds, PeakLoad()
+/// holds the highest single block until ResetPeak().  All of them are
+/// atomics, so any thread can poll them (for a CPU meter, say).
+///
+/// A Watchdog can be told when the load stays above a threshold for a number
+/// of consecutive blocks.  The audio thread only bumps a counter; the
+/// watchdog is called from the monitor's own thread, so it may lock, log or
+/// allocate.  It is called once per episode, and again only after a block
+/// under the threshold.
+class LoadMonitor
+{
+public:
+   class Watchdog
+   {
+   public:
+      virtual ~Watchdog() {}
+      virtual void LoadAlarm(const LoadMonitor& monitor) = 0;
+   };
+
+   enum
+   {
+      kPollMilliseconds = 10
+   };
+
+   static const float kSmoothingSeconds;
+
+   LoadMonitor();
+   ~LoadMonitor();
+
+   /// Audio thread: brackets one callback
+   void BeginBlock() { fBlockStart = std::chrono::steady_clock::now(); }
+   void EndBlock(int frames, float fs);
+
+   float Load() const { return fLoad.load(std::memory_order_relaxed); }
+   float LastLoad() const { return fLastLoad.load(std::memory_order_relaxed); }
+   float PeakLoad() const { return fPeakLoad.load(std::memory_order_relaxed); }
+   void ResetPeak() { fPeakLoad.store(0.f, std::memory_order_relaxed); }
+
+   /// Blocks whose load exceeded 1
+   unsigned long Overruns() const { return fOverruns.load(std::memory_order_relaxed); }
+   unsigned long Blocks() const { return fBlocks.load(std::memory_order_relaxed); }
+
+   /// Calls watchdog (from another thread) when the load is above threshold
+   /// for blocks consecutive blocks.  Pass NULL to stop watching.
+   void SetWatchdog(Watchdog* watchdog, float threshold = 0.9f, int blocks = 4);
+
+private:
+   void Watch();
+   void StopWatching();
+
+   std::chrono::steady_clock::time_point fBlockStart;  // audio thread only
+   int fBlocksOver;                                     // audio thread only
+
+   std::atomic<float> fLoad;
+   std::atomic<float> fLastLoad;
+   std::atomic<float> fPeakLoad;
+   std::atomic<unsigned long> fOverruns;
+   std::atomic<unsigned long> fBlocks;
+
+   std::atomic<float> fThreshold;
+   std::atomic<int> fAlarmBlocks;
+   std::atomic<unsigned long> fAlarms;
+
+   std::mutex fWatchdogLock;  // serialises SetWatchdog
+   Watchdog* fWatchdog;
+   std::thread fThread;
+   std::atomic<bool> fWatching;
+};
+
+#endif
@@ -0,0 +1,417 @@
+#include "Meters.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "MathHelpers.h"
+#include "ScratchArena.h"
+
+//------ MeterClient ------//
+
+MeterClient::MeterClient(int numChannels)
+: MultiOutputClient(numChannels)
+{
+   fInputs = new AudioClient*[numChannels];
+   for (int c = 0; c < numChannels; ++c)
+   {
+      fInputs[c] = NULL;
+   }
+}
+
+MeterClient::~MeterClient()
+{
+   delete[] fInputs;
+}
+
+void MeterClient::SetInput(int channel, AudioClient* input)
+{
+   if (channel >= 0 && channel < NumOutputs())
+      fInputs[channel] = input;
+}
+
+void MeterClient::Prepare(int maxFrames)
+{
+   MultiOutputClient::Prepare(maxFrames);
+   for (int c = 0; c < NumOutputs(); ++c)
+   {
+      if (fInputs[c])
+         fInputs[c]->Prepare(maxFrames);
+   }
+}
+
+void MeterClient::RenderChannels(float** buffers, int numChannels, int frames)
+{
+   for (int c = 0; c < numChannels; ++c)
+   {
+      if (fInputs[c])
+         fInputs[c]->Process(buffers[c], frames);
+   }
+
+   Measure(buffers, numChannels, frames);
+}
+
+float MeterClient::ToDecibels(float amplitude)
+{
+   return amplitude > 0.f ? 20.f * log10f(amplitude) : -HUGE_VALF;
+}
+
+//------ LevelMeter ------//
+
+LevelMeter::LevelMeter(int numChannels, float rmsSeconds)
+: MeterClient(numChannels)
+, fNumChannels(numChannels)
+, fRmsSeconds(rmsSeconds)
+, fResetRequest(false)
+{
+   // windowed-sinc interpolator, cut off at the original Nyquist frequency
+   const int taps = kOversampling * kTapsPerPhase;
+   const double centre = (taps - 1) / 2.0;
+   for (int n = 0; n < taps; ++n)
+   {
+      const double x = (n - centre) / kOversampling;
+      const double sinc = x == 0.0 ? 1.0 : sin(MusKit::PI * x) / (MusKit::PI * x);
+      const double w = 2.0 * MusKit::PI * (n + 0.5) / taps;
+      const double window = 0.42 - 0.5 * cos(w) + 0.08 * cos(2.0 * w);  // Blackman
+      fPhases[n % kOversampling][kTapsPerPhase - 1 - n / kOversampling] = (float)(sinc * window);
+   }
+
+   // unity gain at DC for every phase
+   for (int p = 0; p < kOversampling; ++p)
+   {
+      double sum = 0.0;
+      for (int t = 0; t < kTapsPerPhase; ++t)
+      {
+         sum += fPhases[p][t];
+      }
+      for (int t = 0; t < kTapsPerPhase; ++t)
+      {
+         fPhases[p][t] /= (float)sum;
+      }
+   }
+
+   fHistory = new float[numChannels * (kTapsPerPhase - 1)];
+   memset(fHistory, 0, numChannels * (kTapsPerPhase - 1) * sizeof(float));
+   fMeanSquare = new double[numChannels];
+
+   fPeak = new std::atomic<float>[numChannels];
+   fPeakHold = new std::atomic<float>[numChannels];
+   fTruePeak = new std::atomic<float>[numChannels];
+   fTruePeakHold = new std::atomic<float>[numChannels];
+   fRms = new std::atomic<float>[numChannels];
+   for (int c = 0; c < numChannels; ++c)
+   {
+      fMeanSquare[c] = 0.0;
+      fPeak[c].store(0.f);
+      fPeakHold[c].store(0.f);
+      fTruePeak[c].store(0.f);
+      fTruePeakHold[c].store(0.f);
+      fRms[c].store(0.f);
+   }
+}
+
+LevelMeter::~LevelMeter()
+{
+   delete[] fHistory;
+   delete[] fMeanSquare;
+   delete[] fPeak;
+   delete[] fPeakHold;
+   delete[] fTruePeak;
+   delete[] fTruePeakHold;
+   delete[] fRms;
+}
+
+void LevelMeter::Measure(float** buffers, int numChannels, int frames)
+{
+   const bool reset = fResetRequest.exchange(false);
+
+   const double fs = AudioServer::GetInstance()->Fs();
+   const double decay = exp(-frames / (fRmsSeconds * fs));
+
+   for (int c = 0; c < numChannels; ++c)
+   {
+      const float* x = buffers[c];
+
+      float peak = 0.f;
+      float sumSquares = 0.f;
+      for (int i = 0; i < frames; ++i)
+      {
+         peak = std::max(peak, fabsf(x[i]));
+         sumSquares += x[i] * x[i];
+      }
+
+      // block-wise one-pole average of the mean square
+      fMeanSquare[c] = decay * fMeanSquare[c] + (1.0 - decay) * (sumSquares / frames);
+
+      const float truePeak = std::max(peak, TruePeakOf(c, x, frames));
+
+      fPeak[c].store(peak, std::memory_order_relaxed);
+      fTruePeak[c].store(truePeak, std::memory_order_relaxed);
+      fRms[c].store((float)sqrt(fMeanSquare[c]), std::memory_order_relaxed);
+
+      const float hold = reset ? 0.f : fPeakHold[c].load(std::memory_order_relaxed);
+      fPeakHold[c].store(std::max(hold, peak), std::memory_order_relaxed);
+      const float trueHold = reset ? 0.f : fTruePeakHold[c].load(std::memory_order_relaxed);
+      fTruePeakHold[c].store(std::max(trueHold, truePeak), std::memory_order_relaxed);
+   }
+}
+
+float LevelMeter::TruePeakOf(int channel, const float* buffer, int frames)
+{
+   const int historySize = kTapsPerPhase - 1;
+   float* history = fHistory + channel * historySize;
+
+   // history followed by the block, so every output is a plain dot product
+   ScratchBuffer input(frames + historySize);
+   memcpy(input, history, historySize * sizeof(float));
+   memcpy(input + historySize, buffer, frames * sizeof(float));
+
+   ScratchBuffer sum(frames);
+   float peak = 0.f;
+   for (int p = 0; p < kOversampling; ++p)
+   {
+      const float* h = fPhases[p];
+      memset(sum, 0, frames * sizeof(float));
+      for (int t = 0; t < kTapsPerPhase; ++t)
+      {
+         const float* x = input + t;
+         const float coefficient = h[t];
+         for (int i = 0; i < frames; ++i)
+         {
+            sum[i] += coefficient * x[i];
+         }
+      }
+
+      for (int i = 0; i < frames; ++i)
+      {
+         peak = std::max(peak, fabsf(sum[i]));
+      }
+   }
+
+   memcpy(history, input + frames, historySize * sizeof(float));
+   return peak;
+}
+
+//------ LoudnessMeter ------//
+
+LoudnessMeter::LoudnessMeter(int numChannels)
+: MeterClient(numChannels)
+, fNumChannels(numChannels)
+, fFs(0.f)
+, fBinFrames(1)
+, fBinCount(0)
+, fBinSum(0.0)
+, fBinIndex(0)
+, fBinsDone(0)
+, fMomentary(-HUGE_VALF)
+, fShortTerm(-HUGE_VALF)
+, fIntegrated(-HUGE_VALF)
+, fResetRequest(false)
+{
+   fWeights = new std::atomic<float>[numChannels];
+   for (int c = 0; c < numChannels; ++c)
+   {
+      fWeights[c].store(1.f);
+   }
+
+   fState = new double[4 * numChannels];
+   memset(fState, 0, 4 * numChannels * sizeof(double));
+   memset(fBins, 0, sizeof(fBins));
+   memset(fHistogramCount, 0, sizeof(fHistogramCount));
+   memset(fHistogramEnergy, 0, sizeof(fHistogramEnergy));
+
+   Design(AudioServer::GetInstance()->Fs());
+}
+
+LoudnessMeter::~LoudnessMeter()
+{
+   delete[] fWeights;
+   delete[] fState;
+}
+
+void LoudnessMeter::SetChannelWeight(int channel, float weight)
+{
+   if (channel >= 0 && channel < fNumChannels)
+      fWeights[channel].store(weight);
+}
+
+void LoudnessMeter::Prepare(int maxFrames)
+{
+   MeterClient::Prepare(maxFrames);
+   Design(AudioServer::GetInstance()->Fs());
+}
+
+void LoudnessMeter::Design(float fs)
+{
+   if (fs == fFs)
+      return;
+   fFs = fs;
+
+   // BS.1770 K-weighting, from the analog prototypes of the 48kHz filters
+   // so that other rates get the same response
+   {
+      const double f0 = 1681.974450955533;
+      const double gain = 3.999843853973347;
+      const double q = 0.7071752369554196;
+      const double k = tan(MusKit::PI * f0 / fs);
+      const double vh = pow(10.0, gain / 20.0);
+      const double vb = pow(vh, 0.4996667741545416);
+      const double a0 = 1.0 + k / q + k * k;
+      fShelf.fB0 = (vh + vb * k / q + k * k) / a0;
+      fShelf.fB1 = 2.0 * (k * k - vh) / a0;
+      fShelf.fB2 = (vh - vb * k / q + k * k) / a0;
+      fShelf.fA1 = 2.0 * (k * k - 1.0) / a0;
+      fShelf.fA2 = (1.0 - k / q + k * k) / a0;
+   }
+   {
+      const double f0 = 38.13547087602444;
+      const double q = 0.5003270373238773;
+      const double k = tan(MusKit::PI * f0 / fs);
+      const double a0 = 1.0 + k / q + k * k;
+      fHighPass.fB0 = 1.0;
+      fHighPass.fB1 = -2.0;
+      fHighPass.fB2 = 1.0;
+      fHighPass.fA1 = 2.0 * (k * k - 1.0) / a0;
+      fHighPass.fA2 = (1.0 - k / q + k * k) / a0;
+   }
+
+   fBinFrames = std::max(1, (int)floor(fs * 0.1 + 0.5));
+   fBinCount = 0;
+   fBinSum = 0.0;
+   memset(fState, 0, 4 * fNumChannels * sizeof(double));
+}
+
+void LoudnessMeter::FilterInto(int channel, const float* in, float* out, int frames)
+{
+   double* z = fState + 4 * channel;
+   const Biquad& s = fShelf;
+   const Biquad& h = fHighPass;
+
+   // transposed direct form II, both stages in one pass
+   double s1 = z[0], s2 = z[1], h1 = z[2], h2 = z[3];
+   for (int i = 0; i < frames; ++i)
+   {
+      const double x = in[i];
+      const double y = s.fB0 * x + s1;
+      s1 = s.fB1 * x - s.fA1 * y + s2;
+      s2 = s.fB2 * x - s.fA2 * y;
+
+      const double k = h.fB0 * y + h1;
+      h1 = h.fB1 * y - h.fA1 * k + h2;
+      h2 = h.fB2 * y - h.fA2 * k;
+
+      out[i] = (float)k;
+   }
+   z[0] = s1; z[1] = s2; z[2] = h1; z[3] = h2;
+}
+
+void LoudnessMeter::Measure(float** buffers, int numChannels, int frames)
+{
+   if (fResetRequest.exchange(false))
+   {
+      memset(fHistogramCount, 0, sizeof(fHistogramCount));
+      memset(fHistogramEnergy, 0, sizeof(fHistogramEnergy));
+      fIntegrated.store(-HUGE_VALF, std::memory_order_relaxed);
+   }
+
+   ScratchBuffer weighted(frames);
+
+   // split the block at 100ms bin boundaries
+   int done = 0;
+   while (done < frames)
+   {
+      const int n = std::min(frames - done, fBinFrames - fBinCount);
+
+      for (int c = 0; c < numChannels; ++c)
+      {
+         const float weight = fWeights[c].load(std::memory_order_relaxed);
+         FilterInto(c, buffers[c] + done, weighted, n);
+         if (weight == 0.f)
+            continue;
+
+         float sumSquares = 0.f;
+         for (int i = 0; i < n; ++i)
+         {
+            sumSquares += weighted[i] * weighted[i];
+         }
+         fBinSum += weight * (double)sumSquares;
+      }
+
+      fBinCount += n;
+      done += n;
+      if (fBinCount == fBinFrames)
+         EndBin();
+   }
+}
+
+void LoudnessMeter::EndBin()
+{
+   fBins[fBinIndex] = fBinSum / fBinFrames;
+   fBinIndex = (fBinIndex + 1) % kBinsPerShortTerm;
+   fBinSum = 0.0;
+   fBinCount = 0;
+   ++fBinsDone;
+
+   double momentary = 0.0;
+   for (int b = 1; b <= kBinsPerMomentary; ++b)
+   {
+      momentary += fBins[(fBinIndex - b + kBinsPerShortTerm) % kBinsPerShortTerm];
+   }
+   momentary /= kBinsPerMomentary;
+
+   double shortTerm = 0.0;
+   for (int b = 0; b < kBinsPerShortTerm; ++b)
+   {
+      shortTerm += fBins[b];
+   }
+   shortTerm /= kBinsPerShortTerm;
+
+   fMomentary.store(ToLufs(momentary), std::memory_order_relaxed);
+   fShortTerm.store(ToLufs(shortTerm), std::memory_order_relaxed);
+
+   // the momentary window is also the gating block for integrated loudness
+   if (fBinsDone >= kBinsPerMomentary)
+   {
+      const float loudness = ToLufs(momentary);
+      if (loudness > -70.f)
+      {
+         const int bin = std::min((int)((loudness + 70.f) * 10.f), (int)kHistogramBins - 1);
+         ++fHistogramCount[bin];
+         fHistogramEnergy[bin] += momentary;
+         fIntegrated.store(Integrate(), std::memory_order_relaxed);
+      }
+   }
+}
+
+float LoudnessMeter::Integrate() const
+{
+   // absolute gate: everything in the histogram is above -70 LUFS
+   unsigned long count = 0;
+   double energy = 0.0;
+   for (int b = 0; b < kHistogramBins; ++b)
+   {
+      count += fHistogramCount[b];
+      energy += fHistogramEnergy[b];
+   }
+   if (count == 0)
+      return -HUGE_VALF;
+
+   // relative gate, 10 LU below the absolute-gated loudness, resolved to a bin
+   const float threshold = ToLufs(energy / count) - 10.f;
+   const int first = std::max(0, (int)ceil((threshold + 70.f) * 10.f - 0.5f));
+
+   count = 0;
+   energy = 0.0;
+   for (int b = first; b < kHistogramBins; ++b)
+   {
+      count += fHistogramCount[b];
+      energy += fHistogramEnergy[b];
+   }
+   return count ? ToLufs(energy / count) : -HUGE_VALF;
+}
+
+float LoudnessMeter::ToLufs(double meanSquare)
+{
+   return meanSquare > 0.0 ? (float)(-0.691 + 10.0 * log10(meanSquare)) : -HUGE_VALF;
+}
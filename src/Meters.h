@@ -0,0 +1,179 @@
+#ifndef h_Meters
+#define h_Meters
+
+#include <atomic>
+
+#include "AudioClient.h"
+
+// MeterClient
+// ----------------
+/// \brief Base class for meters: passes numChannels inputs through to its
+/// outputs unchanged and measures them on the way.
+///
+/// Connect the signal with SetInput(channel, client) and take it on from
+/// Output(channel); a meter only measures blocks it is asked to render.
+/// Subclasses override Measure.  Readings are published as atomics, so any
+/// thread may read them while the audio thread renders.
+class MeterClient : public MultiOutputClient
+{
+public:
+   MeterClient(int numChannels);
+   virtual ~MeterClient();
+
+   void SetInput(int channel, AudioClient* input);
+
+   void RenderChannels(float** buffers, int numChannels, int frames);
+   void Prepare(int maxFrames);
+
+   /// Linear amplitude to dBFS (-inf for 0)
+   static float ToDecibels(float amplitude);
+
+protected:
+   virtual void Measure(float** buffers, int numChannels, int frames) = 0;
+
+   AudioClient** fInputs;
+};
+
+// LevelMeter
+// ----------------
+/// \brief Per-channel sample peak, true peak and RMS.
+///
+/// True peak follows ITU-R BS.1770 Annex 2: the signal is upsampled 4x with
+/// a 48-tap polyphase FIR and the peak taken of the result, which catches
+/// inter-sample overs that a sample peak misses.  RMS is exponentially
+/// averaged over rmsSeconds.  Peak and TruePeak are the last block's;
+/// the Hold versions are the highest since ResetPeaks.  All amplitudes are
+/// linear (see ToDecibels).
+///
+/// Each measurement is a straight-line pass over the block per channel
+/// (one per filter tap and phase for the true peak), which the compiler
+/// vectorizes.
+class LevelMeter : public MeterClient
+{
+public:
+   enum
+   {
+      kOversampling = 4,
+      kTapsPerPhase = 12
+   };
+
+   LevelMeter(int numChannels = 2, float rmsSeconds = 0.3f);
+   ~LevelMeter();
+
+   float Peak(int channel) const { return fPeak[channel].load(std::memory_order_relaxed); }
+   float PeakHold(int channel) const { return fPeakHold[channel].load(std::memory_order_relaxed); }
+   float TruePeak(int channel) const { return fTruePeak[channel].load(std::memory_order_relaxed); }
+   float TruePeakHold(int channel) const { return fTruePeakHold[channel].load(std::memory_order_relaxed); }
+   float Rms(int channel) const { return fRms[channel].load(std::memory_order_relaxed); }
+
+   /// Clears the held peaks at the next block
+   void ResetPeaks() { fResetRequest.store(true); }
+
+protected:
+   void Measure(float** buffers, int numChannels, int frames);
+
+private:
+   float TruePeakOf(int channel, const float* buffer, int frames);
+
+   int fNumChannels;
+   float fRmsSeconds;
+
+   // [phase][tap], taps reversed so phase output i is a dot product with
+   // history[i .. i + kTapsPerPhase)
+   float fPhases[kOversampling][kTapsPerPhase];
+   float* fHistory;     // last kTapsPerPhase - 1 samples per channel
+   double* fMeanSquare;
+
+   std::atomic<float>* fPeak;
+   std::atomic<float>* fPeakHold;
+   std::atomic<float>* fTruePeak;
+   std::atomic<float>* fTruePeakHold;
+   std::atomic<float>* fRms;
+   std::atomic<bool> fResetRequest;
+};
+
+// LoudnessMeter
+// ----------------
+/// \brief EBU R128 / ITU-R BS.1770 loudness: momentary (400ms), short-term
+/// (3s) and gated integrated, in LUFS.
+///
+/// Each channel goes through the K-weighting filters (a high shelf and a
+/// high pass, designed for the current sample rate), and the weighted sum
+/// of the channels' mean squares is collected in 100ms bins.  Momentary and
+/// short-term loudness are updated every bin.
+///
+/// For the integrated loudness every 400ms gating block (one per bin, 75%
+/// overlap) above the -70 LUFS absolute gate is added to a histogram of
+/// 0.1 LU bins that also sums the blocks' energies, so the relative gate
+/// (-10 LU) can be applied at any time from a fixed amount of memory, however
+/// long the programme.  Blocks are only quantized for gating; the energies
+/// averaged are exact.
+///
+/// Channel weights default to 1; BS.1770 uses 1.41 for surround channels
+/// and 0 for the LFE.  Readings are -inf until there is something to
+/// measure.
+class LoudnessMeter : public MeterClient
+{
+public:
+   enum
+   {
+      kBinsPerShortTerm = 30,  // 100ms bins
+      kBinsPerMomentary = 4,
+      kHistogramBins = 1000    // -70 to +30 LUFS in 0.1 LU
+   };
+
+   LoudnessMeter(int numChannels = 2);
+   ~LoudnessMeter();
+
+   void SetChannelWeight(int channel, float weight);
+
+   float Momentary() const { return fMomentary.load(std::memory_order_relaxed); }
+   float ShortTerm() const { return fShortTerm.load(std::memory_order_relaxed); }
+   float Integrated() const { return fIntegrated.load(std::memory_order_relaxed); }
+
+   /// Starts a new integrated measurement at the next block
+   void ResetIntegrated() { fResetRequest.store(true); }
+
+   void Prepare(int maxFrames);
+
+protected:
+   void Measure(float** buffers, int numChannels, int frames);
+
+private:
+   struct Biquad
+   {
+      double fB0, fB1, fB2, fA1, fA2;
+   };
+
+   void Design(float fs);
+   void FilterInto(int channel, const float* in, float* out, int frames);
+   void EndBin();
+   float Integrate() const;
+
+   static float ToLufs(double meanSquare);
+
+   int fNumChannels;
+   std::atomic<float>* fWeights;
+
+   float fFs;  // the filters were designed for
+   Biquad fShelf;
+   Biquad fHighPass;
+   double* fState;  // 4 per channel: shelf z1, z2, high pass z1, z2
+
+   int fBinFrames;
+   int fBinCount;
+   double fBinSum;
+   double fBins[kBinsPerShortTerm];
+   int fBinIndex;
+   long fBinsDone;
+
+   unsigned long fHistogramCount[kHistogramBins];
+   double fHistogramEnergy[kHistogramBins];
+
+   std::atomic<float> fMomentary;
+   std::atomic<float> fShortTerm;
+   std::atomic<float> fIntegrated;
+   std::atomic<bool> fResetRequest;
+};
+
+#endif
@@ -0,0 +1,291 @@
+#include "MidiFile.h"
+
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+namespace
+{
+   uint32_t ReadBE32(const unsigned char* p)
+   {
+      return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+   }
+
+   unsigned ReadBE16(const unsigned char* p)
+   {
+      return (p[0] << 8) | p[1];
+   }
+
+   /// Variable-length quantity at data[pos], advancing pos; false if it runs
+   /// off the end
+   bool ReadVLQ(const unsigned char* data, size_t size, size_t& pos, uint32_t& value)
+   {
+      value = 0;
+      for (int i = 0; i < 4; ++i)
+      {
+         if (pos >= size)
+            return false;
+         const unsigned char byte = data[pos++];
+         value = (value << 7) | (byte & 0x7F);
+         if (!(byte & 0x80))
+            return true;
+      }
+      return false;
+   }
+
+   int ChannelDataLength(unsigned char status)
+   {
+      const unsigned char type = status & 0xF0;
+      return (type == 0xC0 || type == 0xD0) ? 1 : 2;
+   }
+}
+
+MidiFile::MidiFile()
+{
+   Clear();
+}
+
+void MidiFile::Clear()
+{
+   fEvents.clear();
+   fSysExData.clear();
+   fDuration = 0.0;
+   fFormat = 0;
+   fNumTracks = 0;
+   fDivision = 96;
+}
+
+bool MidiFile::Load(const std::string& path)
+{
+   std::ifstream file(path.c_str(), std::ios::binary);
+   if (!file)
+      return false;
+
+   std::vector<unsigned char> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+   if (data.empty())
+      return false;
+   return Load(&data[0], data.size());
+}
+
+bool MidiFile::Load(const unsigned char* data, size_t size)
+{
+   Clear();
+
+   if (size < 14 || std::string((const char*)data, 4) != "MThd")
+      return false;
+
+   const uint32_t headerLength = ReadBE32(data + 4);
+   if (headerLength < 6 || 8 + headerLength > size)
+      return false;
+
+   fFormat = ReadBE16(data + 8);
+   const int declaredTracks = ReadBE16(data + 10);
+   fDivision = ReadBE16(data + 12);
+   if (fDivision == 0)
+      return false;
+
+   std::vector<RawEvent> events;
+   uint64_t endTick = 0;
+
+   size_t pos = 8 + headerLength;
+   while (pos + 8 <= size && fNumTracks < declaredTracks)
+   {
+      const uint32_t length = ReadBE32(data + pos + 4);
+      const size_t start = pos + 8;
+      const size_t available = std::min((size_t)length, size - start);
+
+      // unknown chunk types are skipped
+      if (std::string((const char*)data + pos, 4) == "MTrk")
+      {
+         uint64_t trackEnd = 0;
+         ParseTrack(data + start, available, fNumTracks, events, trackEnd);
+         endTick = std::max(endTick, trackEnd);
+         ++fNumTracks;
+      }
+
+      pos = start + available;
+   }
+
+   ResolveTimes(events, endTick);
+   return true;
+}
+
+bool MidiFile::ParseTrack(const unsigned char* data, size_t size, int track, std::vector<RawEvent>& events, uint64_t& endTick)
+{
+   MidiParser parser;
+   Collector collector;
+   uint64_t tick = 0;
+   unsigned char running = 0;
+   size_t pos = 0;
+
+   while (pos < size)
+   {
+      uint32_t delta;
+      if (!ReadVLQ(data, size, pos, delta) || pos >= size)
+         break;
+      tick += delta;
+      endTick = tick;
+
+      RawEvent raw;
+      raw.fTick = tick;
+      raw.fTrack = track;
+      raw.fOrder = (int)events.size();
+      raw.fTempo = false;
+      raw.fTempoValue = 0;
+      raw.fSysExOffset = 0;
+
+      unsigned char status = data[pos];
+      if (status == 0xFF)
+      {
+         // meta event: only tempo and end of track matter
+         running = 0;
+         if (pos + 2 > size)
+            break;
+         const unsigned char type = data[pos + 1];
+         pos += 2;
+         uint32_t length;
+         if (!ReadVLQ(data, size, pos, length) || pos + length > size)
+            break;
+
+         if (type == 0x51 && length == 3)
+         {
+            raw.fTempo = true;
+            raw.fTempoValue = (data[pos] << 16) | (data[pos + 1] << 8) | data[pos + 2];
+            events.push_back(raw);
+         }
+         pos += length;
+
+         if (type == 0x2F)
+            return true;
+      }
+      else if (status == 0xF0 || status == 0xF7)
+      {
+         running = 0;
+         ++pos;
+         uint32_t length;
+         if (!ReadVLQ(data, size, pos, length) || pos + length > size)
+            break;
+
+         // F7 chunks are continuations or escapes; only whole F0 messages
+         // are kept, without their closing F7
+         if (status == 0xF0)
+         {
+            uint32_t bytes = length;
+            if (bytes > 0 && data[pos + bytes - 1] == 0xF7)
+               --bytes;
+            raw.fEvent.fType = MidiEvent::kSysEx;
+            raw.fEvent.fSize = bytes;
+            raw.fSysExOffset = fSysExData.size();
+            fSysExData.insert(fSysExData.end(), data + pos, data + pos + bytes);
+            events.push_back(raw);
+         }
+         pos += length;
+      }
+      else
+      {
+         if (status & 0x80)
+         {
+            running = status;
+            ++pos;
+         }
+         else if (running == 0)
+         {
+            break; // data without status: the track is damaged
+         }
+         status = running;
+
+         const int length = ChannelDataLength(status);
+         if (pos + length > size)
+            break;
+
+         unsigned char message[3] = { status, data[pos], length > 1 ? data[pos + 1] : (unsigned char)0 };
+         pos += length;
+
+         collector.fHave = false;
+         parser.Reset();
+         parser.Parse(message, 1 + length, &collector);
+         if (collector.fHave)
+         {
+            raw.fEvent = collector.fEvent;
+            events.push_back(raw);
+         }
+      }
+   }
+
+   return false;
+}
+
+namespace
+{
+   struct RawEventOrder
+   {
+      template <class T>
+      bool operator()(const T& a, const T& b) const
+      {
+         if (a.fTick != b.fTick)
+            return a.fTick < b.fTick;
+         // tempo changes apply to everything else at the same tick
+         if (a.fTempo != b.fTempo)
+            return a.fTempo;
+         if (a.fTrack != b.fTrack)
+            return a.fTrack < b.fTrack;
+         return a.fOrder < b.fOrder;
+      }
+   };
+}
+
+void MidiFile::ResolveTimes(std::vector<RawEvent>& events, uint64_t endTick)
+{
+   std::sort(events.begin(), events.end(), RawEventOrder());
+
+   // seconds per tick: fixed for SMPTE division, from the tempo for PPQ
+   const bool smpte = (fDivision & 0x8000) != 0;
+   double secondsPerTick;
+   if (smpte)
+   {
+      int fps = -(signed char)(fDivision >> 8);
+      const int ticksPerFrame = fDivision & 0xFF;
+      const double frameRate = fps == 29 ? 29.97 : fps;
+      secondsPerTick = 1.0 / (frameRate * std::max(ticksPerFrame, 1));
+   }
+   else
+   {
+      secondsPerTick = 0.5 / fDivision; // 120 bpm until told otherwise
+   }
+
+   uint64_t lastTick = 0;
+   double seconds = 0.0;
+
+   fEvents.reserve(events.size());
+   std::vector<size_t> sysExOffsets;
+   for (size_t i = 0; i < events.size(); ++i)
+   {
+      const RawEvent& raw = events[i];
+      seconds += (raw.fTick - lastTick) * secondsPerTick;
+      lastTick = raw.fTick;
+
+      if (raw.fTempo)
+      {
+         if (!smpte && raw.fTempoValue > 0)
+            secondsPerTick = raw.fTempoValue * 1e-6 / fDivision;
+         continue;
+      }
+
+      TimedEvent timed;
+      timed.fTime = seconds;
+      timed.fTrack = raw.fTrack;
+      timed.fEvent = raw.fEvent;
+      fEvents.push_back(timed);
+      sysExOffsets.push_back(raw.fSysExOffset);
+   }
+
+   fDuration = seconds + (endTick > lastTick ? (endTick - lastTick) * secondsPerTick : 0.0);
+
+   // fSysExData doesn't grow from here on, so pointers into it stay valid
+   for (size_t i = 0; i < fEvents.size(); ++i)
+   {
+      MidiEvent& event = fEvents[i].fEvent;
+      if (event.fType == MidiEvent::kSysEx && event.fSize > 0)
+         event.fSysEx = &fSysExData[sysExOffsets[i]];
+   }
+}
@@ -0,0 +1,90 @@
+#ifndef h_MidiFile
+#define h_MidiFile
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "MidiParser.h"
+
+// MidiFile
+// ----------------
+/// \brief A Standard MIDI File, loaded into a single time-sorted list of
+/// events.
+///
+/// Every track is merged into one list and each event's time is converted
+/// from ticks to seconds through the tempo map when the file is loaded, so a
+/// player only has to walk the list.  Formats 0 and 1 are supported (format
+/// 2 files load as if they were format 1), with PPQ or SMPTE time division.
+/// Meta events other than tempo are dropped; sysex is kept.
+///
+/// Events at the same time keep their order within a track, and across
+/// tracks are ordered by track.
+class MidiFile
+{
+public:
+   // TimedEvent
+   // ----------------
+   /// \brief An event and its time from the start of the file.
+   struct TimedEvent
+   {
+      double fTime;  ///< seconds
+      int fTrack;
+      MidiEvent fEvent;
+   };
+
+   MidiFile();
+
+   /// Returns false if the file can't be read or isn't a MIDI file.  A file
+   /// with a damaged track keeps the events before the damage.
+   bool Load(const std::string& path);
+   bool Load(const unsigned char* data, size_t size);
+
+   void Clear();
+
+   const std::vector<TimedEvent>& Events() const { return fEvents; }
+   int NumEvents() const { return (int)fEvents.size(); }
+
+   /// Time of the last event (or end of track), in seconds
+   double Duration() const { return fDuration; }
+
+   int Format() const { return fFormat; }
+   int NumTracks() const { return fNumTracks; }
+
+private:
+   // events point into fSysExData
+   MidiFile(const MidiFile&);
+   MidiFile& operator=(const MidiFile&);
+
+   struct RawEvent
+   {
+      uint64_t fTick;
+      int fTrack;
+      int fOrder;        // position in the file, for a stable merge
+      bool fTempo;
+      unsigned fTempoValue; // microseconds per quarter note
+      MidiEvent fEvent;
+      size_t fSysExOffset;
+   };
+
+   // MidiParser::Listener that keeps the last event
+   struct Collector : public MidiParser::Listener
+   {
+      Collector() : fHave(false) {}
+      void HandleEvent(const MidiEvent& event) { fEvent = event; fHave = true; }
+      MidiEvent fEvent;
+      bool fHave;
+   };
+
+   bool ParseTrack(const unsigned char* data, size_t size, int track, std::vector<RawEvent>& events, uint64_t& endTick);
+   void ResolveTimes(std::vector<RawEvent>& events, uint64_t endTick);
+
+   std::vector<TimedEvent> fEvents;
+   std::vector<unsigned char> fSysExData;
+   double fDuration;
+   int fFormat;
+   int fNumTracks;
+   int fDivision;
+};
+
+#endif
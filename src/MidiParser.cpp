@@ -0,0 +1,189 @@
+#include "MidiParser.h"
+
+#include <cstddef>
+
+MidiParser::MidiParser()
+{
+   Reset();
+}
+
+void MidiParser::Reset()
+{
+   fStatus = 0;
+   fData[0] = fData[1] = 0;
+   fCount = 0;
+   fExpected = 0;
+   fInSysEx = false;
+   fSysExSize = 0;
+}
+
+int MidiParser::DataLength(unsigned char status)
+{
+   if (status < 0xF0)
+   {
+      switch (status & 0xF0)
+      {
+      case 0xC0: // program change
+      case 0xD0: // channel pressure
+         return 1;
+      default:
+         return 2;
+      }
+   }
+
+   switch (status)
+   {
+   case 0xF1: // time code quarter frame
+   case 0xF3: // song select
+      return 1;
+   case 0xF2: // song position
+      return 2;
+   case 0xF6: // tune request
+      return 0;
+   default:
+      return -1;
+   }
+}
+
+void MidiParser::Parse(const unsigned char* data, int size, Listener* listener)
+{
+   for (int i = 0; i < size; ++i)
+   {
+      ParseByte(data[i], listener);
+   }
+}
+
+void MidiParser::ParseByte(unsigned char byte, Listener* listener)
+{
+   // real-time: one byte, may appear anywhere, touches no other state
+   if (byte >= 0xF8)
+   {
+      MidiEvent event;
+      switch (byte)
+      {
+      case 0xF8: event.fType = MidiEvent::kClock; break;
+      case 0xFA: event.fType = MidiEvent::kStart; break;
+      case 0xFB: event.fType = MidiEvent::kContinue; break;
+      case 0xFC: event.fType = MidiEvent::kStop; break;
+      case 0xFE: event.fType = MidiEvent::kActiveSensing; break;
+      case 0xFF: event.fType = MidiEvent::kReset; break;
+      default: return; // undefined
+      }
+      listener->HandleEvent(event);
+      return;
+   }
+
+   if (byte & 0x80)
+   {
+      // any other status byte ends a sysex
+      if (fInSysEx)
+      {
+         FinishSysEx(listener, false);
+         fInSysEx = false;
+         if (byte == 0xF7)
+            return;
+      }
+
+      if (byte == 0xF0)
+      {
+         fInSysEx = true;
+         fSysExSize = 0;
+         fStatus = 0;
+         return;
+      }
+
+      const int length = DataLength(byte);
+      if (length < 0)
+      {
+         // undefined, or a stray F7: drop it, and running status with it
+         fStatus = 0;
+         return;
+      }
+
+      fStatus = byte;
+      fExpected = length;
+      fCount = 0;
+      if (length == 0)
+      {
+         FinishMessage(listener);
+         fStatus = 0;
+      }
+      return;
+   }
+
+   if (fInSysEx)
+   {
+      if (fSysExSize == kMaxSysEx)
+      {
+         FinishSysEx(listener, true);
+         fSysExSize = 0;
+      }
+      fSysEx[fSysExSize++] = byte;
+      return;
+   }
+
+   // data byte without a status to belong to
+   if (fStatus == 0)
+      return;
+
+   fData[fCount++] = byte;
+   if (fCount == fExpected)
+   {
+      FinishMessage(listener);
+      fCount = 0;
+
+      // system common messages don't set running status
+      if (fStatus >= 0xF0)
+         fStatus = 0;
+   }
+}
+
+void MidiParser::FinishMessage(Listener* listener)
+{
+   MidiEvent event;
+   event.fData1 = fExpected > 0 ? fData[0] : 0;
+   event.fData2 = fExpected > 1 ? fData[1] : 0;
+
+   if (fStatus < 0xF0)
+   {
+      event.fChannel = fStatus & 0x0F;
+      switch (fStatus & 0xF0)
+      {
+      case 0x80: event.fType = MidiEvent::kNoteOff; break;
+      case 0x90: event.fType = event.fData2 > 0 ? MidiEvent::kNoteOn : MidiEvent::kNoteOff; break;
+      case 0xA0: event.fType = MidiEvent::kPolyPressure; break;
+      case 0xB0: event.fType = MidiEvent::kControlChange; break;
+      case 0xC0: event.fType = MidiEvent::kProgramChange; break;
+      case 0xD0: event.fType = MidiEvent::kChannelPressure; break;
+      case 0xE0:
+         event.fType = MidiEvent::kPitchBend;
+         event.fValue = ((event.fData2 << 7) | event.fData1) - 8192;
+         break;
+      }
+   }
+   else
+   {
+      switch (fStatus)
+      {
+      case 0xF1: event.fType = MidiEvent::kTimeCode; break;
+      case 0xF2:
+         event.fType = MidiEvent::kSongPosition;
+         event.fValue = (event.fData2 << 7) | event.fData1;
+         break;
+      case 0xF3: event.fType = MidiEvent::kSongSelect; break;
+      case 0xF6: event.fType = MidiEvent::kTuneRequest; break;
+      }
+   }
+
+   listener->HandleEvent(event);
+}
+
+void MidiParser::FinishSysEx(Listener* listener, bool continues)
+{
+   MidiEvent event;
+   event.fType = MidiEvent::kSysEx;
+   event.fSysEx = fSysEx;
+   event.fSize = fSysExSize;
+   event.fContinues = continues;
+   listener->HandleEvent(event);
+}
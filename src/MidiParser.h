@@ -0,0 +1,121 @@
+#ifndef h_MidiParser
+#define h_MidiParser
+
+// MidiEvent
+// ----------------
+/// \brief One parsed MIDI message.
+///
+/// fChannel is 0-15 for channel messages and -1 otherwise.  fData1/fData2
+/// are the raw data bytes; fValue holds the combined 14-bit value of pitch
+/// bend (centered, -8192 to 8191) and song position.  A note on with
+/// velocity 0 is reported as a note off.
+///
+/// For sysex, fSysEx points at the message bytes between F0 and F7, valid
+/// only during the call that delivers the event.  A message longer than the
+/// parser's buffer arrives in pieces, each but the last with fContinues set.
+struct MidiEvent
+{
+   enum Type
+   {
+      kNoteOff = 0,
+      kNoteOn,
+      kPolyPressure,
+      kControlChange,
+      kProgramChange,
+      kChannelPressure,
+      kPitchBend,
+
+      kSysEx,
+      kTimeCode,
+      kSongPosition,
+      kSongSelect,
+      kTuneRequest,
+
+      kClock,
+      kStart,
+      kContinue,
+      kStop,
+      kActiveSensing,
+      kReset,
+
+      kNumTypes
+   };
+
+   MidiEvent()
+   : fType(kNoteOff)
+   , fChannel(-1)
+   , fData1(0)
+   , fData2(0)
+   , fValue(0)
+   , fSysEx(0)
+   , fSize(0)
+   , fContinues(false)
+   {}
+
+   bool IsChannelMessage() const { return fType <= kPitchBend; }
+   bool IsRealTime() const { return fType >= kClock; }
+
+   int fType;
+   int fChannel;
+   int fData1;
+   int fData2;
+   int fValue;
+   const unsigned char* fSysEx;
+   int fSize;
+   bool fContinues;
+};
+
+// MidiParser
+// ----------------
+/// \brief Turns a MIDI 1.0 byte stream into MidiEvents.
+///
+/// Handles running status, real-time bytes interleaved anywhere (even inside
+/// another message or a sysex), system common messages cancelling running
+/// status, and sysex of any length.  Bytes may arrive split across calls in
+/// any way; the parser keeps its state between them.  It never allocates.
+///
+/// Use one parser per input stream, from one thread at a time.
+class MidiParser
+{
+public:
+   enum
+   {
+      kMaxSysEx = 1024
+   };
+
+   // Listener
+   // ----------------
+   /// \brief Receives the events a MidiParser finds.
+   class Listener
+   {
+   public:
+      virtual ~Listener() {}
+      virtual void HandleEvent(const MidiEvent& event) = 0;
+   };
+
+   MidiParser();
+
+   /// Parses size bytes, calling listener for each complete event
+   void Parse(const unsigned char* data, int size, Listener* listener);
+
+   /// Forgets running status and any partial message
+   void Reset();
+
+private:
+   /// Data bytes that follow status, -1 for none defined
+   static int DataLength(unsigned char status);
+
+   void ParseByte(unsigned char byte, Listener* listener);
+   void FinishMessage(Listener* listener);
+   void FinishSysEx(Listener* listener, bool continues);
+
+   unsigned char fStatus;   // running status, 0 for none
+   unsigned char fData[2];
+   int fCount;              // data bytes received
+   int fExpected;           // data bytes fStatus takes
+   bool fInSysEx;
+   int fSysExSize;
+   unsigned char fSysEx[kMaxSysEx];
+};
+
+#endif
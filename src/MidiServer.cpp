@@ -1,3 +1,197 @@
 #include "MidiServer.h"
 
-MidiServer* MidiServer::sInstance = NULL;
\ No newline at end of file
+#include <algorithm>
+#include <thread>
+
+#include "Tuning.h"
+
+MidiServer* MidiServer::sInstance = NULL;
+
+MidiServer::MidiServer()
+: fTable(new RoutingTable)
+, fDispatching(0)
+{
+}
+
+MidiServer::~MidiServer()
+{
+   delete fTable.load();
+}
+
+void MidiServer::HandleEvent(const MidiEvent& event)
+{
+#ifdef qVerbose
+   std::cout << "MidiServer got: type " << event.fType << " channel " << event.fChannel << std::endl;
+#endif
+
+   // announce the dispatch before loading the table, so a writer that
+   // swaps the table either sees us here or we see its new table
+   fDispatching.fetch_add(1);
+   const RoutingTable* table = fTable.load();
+
+   // bends are kept per channel by the Tuning, where voices look them up
+   if (event.fType == MidiEvent::kPitchBend)
+      Tuning::GetInstance()->HandlePitchBend(event.fChannel, event.fValue);
+
+   if (event.IsChannelMessage())
+   {
+      const RouteList& routes = table->fChannels[event.fChannel];
+      const int note = event.fData1;
+      for (RouteList::const_iterator i = routes.begin(); i != routes.end(); ++i)
+      {
+         switch (event.fType)
+         {
+         case MidiEvent::kNoteOn:
+            if (event.fData2 < i->fLowVelocity || event.fData2 > i->fHighVelocity)
+               continue;
+            // fall through
+         case MidiEvent::kNoteOff:
+         case MidiEvent::kPolyPressure:
+            if (note < i->fLowNote || note > i->fHighNote)
+               continue;
+            break;
+         default:
+            break;
+         }
+         i->fClient->HandleEvent(event);
+      }
+   }
+   else
+   {
+      MidiClientList::const_iterator i;
+      for (i = table->fClients.begin(); i != table->fClients.end(); ++i)
+      {
+         (*i)->HandleEvent(event);
+      }
+   }
+
+   fDispatching.fetch_sub(1);
+}
+
+void MidiServer::AddClient(MidiClient* c, int channelIndex,
+                           int lowNote, int highNote,
+                           int lowVelocity, int highVelocity)
+{
+   if (channelIndex < kOmni || channelIndex >= kNumChannels)
+      return;
+
+   std::lock_guard<std::mutex> lock(fWriteLock);
+
+   Route route;
+   route.fClient = c;
+   route.fChannel = channelIndex;
+   route.fLowNote = lowNote;
+   route.fHighNote = highNote;
+   route.fLowVelocity = lowVelocity;
+   route.fHighVelocity = highVelocity;
+
+   RouteList routes = fTable.load()->fRoutes;
+   RouteList::iterator i;
+   for (i = routes.begin(); i != routes.end(); ++i)
+   {
+      if (i->fClient == c && i->fChannel == channelIndex)
+         break;
+   }
+   if (i != routes.end())
+      *i = route;
+   else
+      routes.push_back(route);
+
+   Publish(routes);
+}
+
+void MidiServer::RemoveClient(MidiClient* c, int channelIndex)
+{
+   std::lock_guard<std::mutex> lock(fWriteLock);
+
+   RouteList routes;
+   const RouteList& current = fTable.load()->fRoutes;
+   for (RouteList::const_iterator i = current.begin(); i != current.end(); ++i)
+   {
+      if (i->fClient != c || i->fChannel != channelIndex)
+         routes.push_back(*i);
+   }
+
+   Publish(routes);
+}
+
+void MidiServer::RemoveClient(MidiClient* c)
+{
+   std::lock_guard<std::mutex> lock(fWriteLock);
+
+   RouteList routes;
+   const RouteList& current = fTable.load()->fRoutes;
+   for (RouteList::const_iterator i = current.begin(); i != current.end(); ++i)
+   {
+      if (i->fClient != c)
+         routes.push_back(*i);
+   }
+
+   Publish(routes);
+}
+
+void MidiServer::Publish(const RouteList& routes)
+{
+   RoutingTable* table = new RoutingTable;
+   table->fRoutes = routes;
+   for (RouteList::const_iterator i = routes.begin(); i != routes.end(); ++i)
+   {
+      for (int channel = 0; channel < kNumChannels; ++channel)
+      {
+         if (i->fChannel == kOmni || i->fChannel == channel)
+            table->fChannels[channel].push_back(*i);
+      }
+
+      if (std::find(table->fClients.begin(), table->fClients.end(), i->fClient) == table->fClients.end())
+         table->fClients.push_back(i->fClient);
+   }
+
+   RoutingTable* old = fTable.exchange(table);
+
+   // dispatches that started before the exchange may still be reading the
+   // old table; once none are running, nobody can be
+   while (fDispatching.load() != 0)
+   {
+      std::this_thread::yield();
+   }
+   delete old;
+}
+
+void MidiClient::HandleEvent(const MidiEvent& event)
+{
+   switch (event.fType)
+   {
+   case MidiEvent::kNoteOn:
+      NoteOn(event.fData1, event.fData2);
+      break;
+   case MidiEvent::kNoteOff:
+      NoteOff(event.fData1);
+      break;
+   case MidiEvent::kControlChange:
+      ControlChange(event.fData1, event.fData2);
+      break;
+   case MidiEvent::kPitchBend:
+      PitchBend(event.fValue);
+      break;
+   case MidiEvent::kChannelPressure:
+      ChannelPressure(event.fData1);
+      break;
+   case MidiEvent::kPolyPressure:
+      PolyPressure(event.fData1, event.fData2);
+      break;
+   case MidiEvent::kProgramChange:
+      ProgramChange(event.fData1);
+      break;
+   case MidiEvent::kSysEx:
+      SysEx(event.fSysEx, event.fSize);
+      break;
+   case MidiEvent::kClock:
+   case MidiEvent::kStart:
+   case MidiEvent::kContinue:
+   case MidiEvent::kStop:
+      RealTime(event.fType);
+      break;
+   default:
+      break;
+   }
+}
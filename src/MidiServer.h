@@ -2,7 +2,11 @@
 #define h_MidiServer
 
 #include "RtMidi.h"
+#include "MidiParser.h"
 #include <cassert>
+#include <atomic>
+#include <mutex>
+#include <vector>
 
 //#define qVerbose 1
 
@@ -11,12 +15,34 @@
 /// \brief MidiClient is the base class for the anything that consumes MIDI.
 ///
 /// Client must be registered with the MidiServer singleton to get midi callbacks.
-/// They must also override all MidiClient methods.
+/// They must also override NoteOn and NoteOff; other messages are optional.
+///
+/// The server hands each event to HandleEvent, which calls the method for its
+/// type.  Clients that need the channel (MPE, per-channel instruments) or the
+/// less common messages override HandleEvent instead.
 class MidiClient
 {
 public:
+   virtual ~MidiClient() {}
+
 	virtual void NoteOn(int note, int velocity) = 0;
    virtual void NoteOff(int note) = 0;
+   virtual void ControlChange(int controller, int value) {}
+
+   /// -8192 to 8191, 0 is centered
+   virtual void PitchBend(int value) {}
+   virtual void ChannelPressure(int pressure) {}
+   virtual void PolyPressure(int note, int pressure) {}
+   virtual void ProgramChange(int program) {}
+
+   /// the bytes between F0 and F7, valid only for the call; long messages
+   /// arrive in pieces (see MidiEvent)
+   virtual void SysEx(const unsigned char* data, int size) {}
+
+   /// clock, start, continue, stop (MidiEvent types)
+   virtual void RealTime(int type) {}
+
+   virtual void HandleEvent(const MidiEvent& event);
 };
 
 // MidiServer
@@ -26,10 +52,30 @@ public:
 ///
 /// Clients are registered with AddClient and removed with RemoveClient.  The
 /// MidiServer is not responsible for deallocating removed clients! 
-class MidiServer
+///
+/// Clients are routed by channel through a table with one list per MIDI
+/// channel, so an event only visits the clients listening on its channel.
+/// A route may also have a note range and a velocity range, for splits and
+/// layers: note ons outside them are not sent, and note offs and poly
+/// pressure outside the note range are not sent.  System messages go to
+/// every client once.  Pitch bends also set the Tuning's bend for their
+/// channel (Tuning::HandlePitchBend), whether or not any client hears them.
+///
+/// The table is never modified in place.  AddClient and RemoveClient build a
+/// new one and swap it in, so routing can change while events are being
+/// dispatched without the MIDI thread ever waiting.  They wait (briefly) for
+/// dispatches still reading the old table before freeing it, so don't call
+/// them from inside a client's MIDI callback.
+class MidiServer : public MidiParser::Listener
 {
 public:
-	MidiServer() {}
+   enum
+   {
+      kNumChannels = 16,
+      kOmni = -1 ///< channelIndex for a client that hears every channel
+   };
+
+	MidiServer();
 	
 	~MidiServer();
 	
@@ -42,73 +88,64 @@ public:
 		return sInstance;
 	}
 	
+   /// Parses a message from RtMidi and dispatches the events in it, using the
+   /// server's own parser (for a single input)
 	void MidiServerCallback(double deltatime, std::vector< unsigned char > *message)
 	{
-		unsigned int nBytes = message->size();
-		
-		// only care about 3-byte messages
-		if(nBytes == 3)
-		{
-			unsigned char status = message->at(0);
-			unsigned char data1 = message->at(1);
-			unsigned char data2 = message->at(2);
-			
-			unsigned short messageType = status & 0xF0;
-			unsigned short channel = status & 0x0F;
-			
-#ifdef qVerbose
-			std::cout << "MidiServer got: msg " << messageType << " channel " << channel << std::endl;
-#endif
-			
-			switch(messageType)
-			{
-				case 0x90: // note on
-				{			
-					std::vector<MidiClient*>::iterator i;
-					for (i = fClients.begin(); i != fClients.end(); ++i)
-					{
-						if (data2 > 0)
-							(*i)->NoteOn(data1, data2);
-                  else
-                     (*i)->NoteOff(data1);
-					}
-               break;
-				}
-
-            case 0x80: // note off
-            {
-               std::vector<MidiClient*>::iterator i;
-					for (i = fClients.begin(); i != fClients.end(); ++i)
-					{
-                  (*i)->NoteOff(data1);
-					}
-                  break;
-            }
-					
-				default:
-					break;
-			}
-		}
-		
-
+      if (!message->empty())
+         fParser.Parse(&message->at(0), (int)message->size(), this);
 	}
 	
-	void AddClient(MidiClient* c, int channelIndex)
-	{
-		MidiClientList::iterator clientiter = std::find(fClients.begin(), fClients.end(), c);
-		if (clientiter == fClients.end())
-		{
-			fClients.push_back(c);
-		}
-	}
+   /// Sends event to the clients routed to it
+   void HandleEvent(const MidiEvent& event);
+	
+   /// Routes channelIndex (0-15, or kOmni) to c.  Adding a route the client
+   /// already has on that channel replaces its ranges.
+	void AddClient(MidiClient* c, int channelIndex,
+                  int lowNote = 0, int highNote = 127,
+                  int lowVelocity = 1, int highVelocity = 127);
 	
+   /// Removes c's route on channelIndex
 	void RemoveClient(MidiClient* c, int channelIndex);
+   
+   /// Removes all of c's routes
+   void RemoveClient(MidiClient* c);
 	
 private:
+   struct Route
+   {
+      MidiClient* fClient;
+      int fChannel;
+      int fLowNote;
+      int fHighNote;
+      int fLowVelocity;
+      int fHighVelocity;
+   };
+   
+   typedef std::vector<Route> RouteList;
+   typedef std::vector<MidiClient*> MidiClientList;
+   
+   // RoutingTable
+   // ----------------
+   /// \brief An immutable snapshot of the routes, as registered and split
+   /// out per channel (omni routes appear in every channel).
+   struct RoutingTable
+   {
+      RouteList fRoutes;
+      RouteList fChannels[kNumChannels];
+      MidiClientList fClients;
+   };
+   
+   /// Builds a table from routes and swaps it in
+   void Publish(const RouteList& routes);
+   
 	static MidiServer* sInstance;
 	
-	typedef std::vector<MidiClient*> MidiClientList;
-	MidiClientList fClients;
+   std::atomic<RoutingTable*> fTable;
+   std::atomic<int> fDispatching;
+   std::mutex fWriteLock;
+   
+   MidiParser fParser;
 };
 
 // RtMidiDriver
@@ -130,7 +167,7 @@ public:
 		// Set our callback function.  This should be done immediately after
 		// opening the port to avoid having incoming messages written to the
 		// queue.
-		fMidiIn.setCallback(&callback);
+		fMidiIn.setCallback(&callback, this);
 		
 		// Don't ignore sysex, timing, or active sensing messages.
 		fMidiIn.ignoreTypes( false, false, false );		
@@ -158,10 +195,15 @@ public:
 private:
 	static void callback(double deltatime, std::vector< unsigned char > *message, void *userData)
 	{
-		MidiServer::GetInstance()->MidiServerCallback(deltatime, message);
+      // each port has its own parser, so running status and sysex from
+      // different ports don't mix
+      RtMidiDriver* driver = (RtMidiDriver*)userData;
+      if (!message->empty())
+         driver->fParser.Parse(&message->at(0), (int)message->size(), MidiServer::GetInstance());
 	}
 	
 	RtMidiIn fMidiIn;
+   MidiParser fParser;
 };
 
 #endif
@@ -0,0 +1,203 @@
+#include "Modulation.h"
+
+#include <cmath>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "MathHelpers.h"
+
+//------ LFO ------//
+
+LFO::LFO(float rate, int shape)
+: fRate(rate)
+, fShape(shape)
+, fPhase(0)
+, fHeld(0.f)
+, fRandomState(0x2545F491)
+{
+}
+
+float LFO::Tick(int frames)
+{
+   const float phase = (float)fPhase;
+
+   float value = 0.f;
+   switch (fShape)
+   {
+   case kTriangle:
+      value = phase < 0.5f ? 4.f * phase - 1.f : 3.f - 4.f * phase;
+      break;
+   case kSaw:
+      value = 2.f * phase - 1.f;
+      break;
+   case kSquare:
+      value = phase < 0.5f ? 1.f : -1.f;
+      break;
+   case kSampleAndHold:
+      value = fHeld;
+      break;
+   default:
+      value = sinf(2.f * MusKit::PI * phase);
+      break;
+   }
+
+   fPhase += fRate * frames / AudioServer::GetInstance()->Fs();
+   if (fPhase >= 1.0)
+   {
+      fPhase -= floor(fPhase);
+
+      // new random value each cycle
+      fRandomState ^= fRandomState << 13;
+      fRandomState ^= fRandomState >> 17;
+      fRandomState ^= fRandomState << 5;
+      fHeld = (fRandomState >> 8) * (2.f / 16777216.f) - 1.f;
+   }
+
+   return value;
+}
+
+//------ ModMatrix ------//
+
+ModMatrix::ModMatrix(AudioClient* input, int controlPeriod)
+: fInput(input)
+, fControlPeriod(controlPeriod)
+{
+}
+
+void ModMatrix::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+}
+
+void ModMatrix::AddSource(ControlSource* source)
+{
+   if (std::find(fSources.begin(), fSources.end(), source) != fSources.end())
+      return;
+
+   source->Prepare(AudioServer::GetInstance()->Fs() / fControlPeriod);
+   fSources.push_back(source);
+   fSourceValues.push_back(0.f);
+}
+
+void ModMatrix::RemoveSource(ControlSource* source)
+{
+   // slots are kept so that route indices stay valid
+   for (size_t s = 0; s < fSources.size(); ++s)
+   {
+      if (fSources[s] == source)
+      {
+         fSources[s] = NULL;
+         for (size_t r = 0; r < fRoutes.size(); ++r)
+         {
+            if (fRoutes[r].fSource == (int)s)
+               fRoutes[r].fActive = false;
+         }
+      }
+   }
+}
+
+int ModMatrix::TargetIndex(Parameter* target)
+{
+   std::vector<Parameter*>::iterator i = std::find(fTargets.begin(), fTargets.end(), target);
+   if (i != fTargets.end())
+      return (int)(i - fTargets.begin());
+
+   fTargets.push_back(target);
+   fTargetSums.push_back(0.f);
+   return (int)fTargets.size() - 1;
+}
+
+int ModMatrix::AddRoute(ControlSource* source, Parameter* target, float depth, float curve)
+{
+   AddSource(source);
+
+   Route route;
+   route.fSource = (int)(std::find(fSources.begin(), fSources.end(), source) - fSources.begin());
+   route.fTarget = TargetIndex(target);
+   route.fDepth = depth;
+   route.fCurve = curve;
+   route.fActive = true;
+   fRoutes.push_back(route);
+   return (int)fRoutes.size() - 1;
+}
+
+int ModMatrix::AddRoute(ControlSource* source, int parameterId, float depth, float curve)
+{
+   Parameter* target = ParameterManager::GetInstance()->GetParameter(parameterId);
+   if (!target)
+      return -1;
+   return AddRoute(source, target, depth, curve);
+}
+
+void ModMatrix::SetDepth(int route, float depth)
+{
+   fRoutes[route].fDepth = depth;
+}
+
+void ModMatrix::SetCurve(int route, float curve)
+{
+   fRoutes[route].fCurve = curve;
+}
+
+void ModMatrix::RemoveRoute(int route)
+{
+   fRoutes[route].fActive = false;
+}
+
+void ModMatrix::ClearRoutes()
+{
+   for (size_t t = 0; t < fTargets.size(); ++t)
+   {
+      fTargets[t]->SetModulation(0.f);
+   }
+   fRoutes.clear();
+   fTargets.clear();
+   fTargetSums.clear();
+}
+
+void ModMatrix::Tick(int frames)
+{
+   for (size_t s = 0; s < fSources.size(); ++s)
+   {
+      if (fSources[s])
+         fSourceValues[s] = fSources[s]->Tick(frames);
+   }
+
+   std::fill(fTargetSums.begin(), fTargetSums.end(), 0.f);
+   for (size_t r = 0; r < fRoutes.size(); ++r)
+   {
+      const Route& route = fRoutes[r];
+      if (!route.fActive)
+         continue;
+
+      float value = fSourceValues[route.fSource];
+      if (route.fCurve != 1.f)
+      {
+         const float shaped = powf(fabsf(value), route.fCurve);
+         value = value < 0.f ? -shaped : shaped;
+      }
+      fTargetSums[route.fTarget] += route.fDepth * value;
+   }
+
+   for (size_t t = 0; t < fTargets.size(); ++t)
+   {
+      fTargets[t]->SetModulation(fTargetSums[t]);
+   }
+}
+
+void ModMatrix::Render(float* buffer, int frames)
+{
+   for (int offset = 0; offset < frames; offset += fControlPeriod)
+   {
+      const int n = std::min(fControlPeriod, frames - offset);
+      Tick(n);
+
+      if (fInput)
+      {
+         AudioServer::SubBlock subBlock(offset);
+         fInput->Process(buffer + offset, n);
+      }
+   }
+}
@@ -0,0 +1,206 @@
+#ifndef h_Modulation
+#define h_Modulation
+
+#include <atomic>
+#include <vector>
+
+#include "AudioClient.h"
+#include "ControlSignal.h"
+#include "Envelope.h"
+#include "MidiServer.h"
+#include "ParameterAPI.h"
+
+// ControlSource
+// ----------------
+/// \brief Base class for control-rate modulators.
+///
+/// A ModMatrix ticks each of its sources once per control period and routes
+/// the values to Parameters.  LFOs and envelopes are bipolar/unipolar as
+/// noted; routes scale them by depth.
+class ControlSource
+{
+public:
+   virtual ~ControlSource() {}
+
+   /// Called when the source is added to a ModMatrix, with the number of
+   /// ticks per second
+   virtual void Prepare(float tickRate) {}
+
+   /// Returns the value for the next control period, which is frames long
+   virtual float Tick(int frames) = 0;
+};
+
+// LFO
+// ----------------
+/// \brief Low frequency oscillator, -1 to 1.
+///
+class LFO : public ControlSource
+{
+public:
+   enum Shape
+   {
+      kSine = 0,
+      kTriangle,
+      kSaw,
+      kSquare,
+      kSampleAndHold,
+
+      kNumShapes
+   };
+
+   LFO(float rate = 1.f, int shape = kSine);
+
+   float Tick(int frames);
+
+   /// cycles per second
+   void SetRate(float rate) { fRate = rate; }
+   void SetShape(int shape) { fShape = shape; }
+
+   /// Restarts the cycle at phase (0-1)
+   void Reset(float phase = 0.f) { fPhase = phase; }
+
+private:
+   float fRate;
+   int fShape;
+   double fPhase;
+   float fHeld;
+   unsigned int fRandomState;
+};
+
+// ControlEnvelope
+// ----------------
+/// \brief An Envelope rendered at control rate, 0 to 1 for the usual shapes.
+///
+/// Gate it with NoteOn/NoteOff; shape it through GetEnvelope().
+class ControlEnvelope : public ControlSource
+{
+public:
+   void Prepare(float tickRate) { fEnvelope.SetRate(tickRate); }
+
+   float Tick(int frames)
+   {
+      float value;
+      fEnvelope.Render(&value, 1);
+      return value;
+   }
+
+   void NoteOn() { fEnvelope.NoteOn(); }
+   void NoteOff() { fEnvelope.NoteOff(); }
+
+   Envelope& GetEnvelope() { return fEnvelope; }
+
+private:
+   Envelope fEnvelope;
+};
+
+// MidiControlSource
+// ----------------
+/// \brief A MIDI continuous controller, 0 to 1.
+///
+/// Register it with the MidiServer.  The controller value is handed from the
+/// MIDI thread to the audio thread through an atomic, and the matrix ramps
+/// between ticks, so coarse 7-bit steps don't zipper.
+class MidiControlSource : public ControlSource
+                        , public MidiClient
+{
+public:
+   MidiControlSource(int controller, float initialValue = 0.f)
+   : fController(controller)
+   , fValue(initialValue)
+   {
+   }
+
+   float Tick(int frames) { return fValue.load(std::memory_order_relaxed); }
+
+   void NoteOn(int note, int velocity) {}
+   void NoteOff(int note) {}
+
+   void ControlChange(int controller, int value)
+   {
+      if (controller == fController)
+         fValue.store(value / 127.f, std::memory_order_relaxed);
+   }
+
+private:
+   int fController;
+   std::atomic<float> fValue;
+};
+
+// ModMatrix
+// ----------------
+/// \brief Routes ControlSources to Parameters, evaluated once per control
+/// period.
+///
+/// The matrix renders its input in sub-blocks of ControlPeriod() samples
+/// (see AudioServer::SubBlock).  Before each sub-block it ticks every source
+/// once, and sets each routed Parameter's modulation to the sum of
+/// depth * curve(source) over the routes that target it.  Clients in the
+/// input's graph read Parameter::ModulatedValue while rendering, and so see a
+/// new value every period.
+///
+/// A route's curve is an exponent applied to the magnitude of the source
+/// value (the sign is kept): 1 is linear, above 1 spends more of the range
+/// near 0.
+///
+/// Sources and routes may only be changed with the AudioServer lock held (or
+/// before the stream starts).  The matrix doesn't own its sources.
+class ModMatrix : public AudioClient
+{
+public:
+   enum
+   {
+      kDefaultControlPeriod = 32
+   };
+
+   ModMatrix(AudioClient* input = NULL, int controlPeriod = kDefaultControlPeriod);
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   void AddSource(ControlSource* source);
+   void RemoveSource(ControlSource* source);
+
+   /// Routes source (added if necessary) to target.  Returns the route's index.
+   int AddRoute(ControlSource* source, Parameter* target, float depth, float curve = 1.f);
+
+   /// Routes to the Parameter registered with ParameterManager under
+   /// parameterId.  Returns -1 if there isn't one.
+   int AddRoute(ControlSource* source, int parameterId, float depth, float curve = 1.f);
+
+   void SetDepth(int route, float depth);
+   void SetCurve(int route, float curve);
+   void RemoveRoute(int route);
+   void ClearRoutes();
+
+   int ControlPeriod() const { return fControlPeriod; }
+
+   /// Ticks the sources and updates the parameters for the next frames
+   /// samples.  Render calls this; call it directly to drive the matrix
+   /// without an input.
+   void Tick(int frames);
+
+private:
+   struct Route
+   {
+      int fSource;
+      int fTarget;
+      float fDepth;
+      float fCurve;
+      bool fActive;
+   };
+
+   int TargetIndex(Parameter* target);
+
+   AudioClient* fInput;
+   int fControlPeriod;
+
+   std::vector<ControlSource*> fSources;
+   std::vector<float> fSourceValues;
+   std::vector<Parameter*> fTargets;
+   std::vector<float> fTargetSums;
+   std::vector<Route> fRoutes;
+};
+
+#endif
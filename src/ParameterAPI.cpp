@@ -51,6 +51,8 @@ Parameter::Parameter(const int id, const std::string& name, const float initialV
 : _id(id)
 , _name(name)
 , _value(initialValue)
+, _modulation(0.f)
+, _modulated(initialValue)
 , _isBroadcast(true)
 , _isPublished(true)
 {
@@ -94,6 +96,27 @@ void Parameter::SetValue(const float value)
 #endif
 }
 
+void Parameter::SetModulation(const float offset)
+{
+	_modulation = offset;
+	_modulated.Set(_value + offset);
+}
+
+const float Parameter::Modulation() const
+{
+	return _modulation;
+}
+
+const float Parameter::ModulatedValue() const
+{
+	return _value + _modulation;
+}
+
+void Parameter::FillModulated(float* out, int frames) const
+{
+	_modulated.Fill(out, frames);
+}
+
 void Parameter::NotifyObservers()
 {
 	// TODO: post a message for asynchronous consumption
@@ -4,6 +4,8 @@
 #include <string>
 #include <vector>
 
+#include "ControlSignal.h"
+
 class Broadcaster;
 class Observable;
 class Parameter;
@@ -94,6 +96,11 @@ protected:
 /// such as VST or Audio Units such that the host program can collect the necessary
 /// information.  In this case, the implementation of the plug-in's parameter management
 /// can be handled entirely through interaction with the Parameter and ParameterManager classes.
+///
+/// A ModMatrix may add a modulation offset on top of the value, once per control
+/// period.  Setting the modulation neither notifies nor broadcasts, since it
+/// happens on the audio thread; renderers read ModulatedValue (or ramp through
+/// a period with FillModulated) instead.
 class Parameter : public Broadcaster
                 , public Observable
 {
@@ -106,6 +113,16 @@ public:
    const int Id() const;
 	
 	void SetValue(const float value);
+	
+	/// Offset added to the value by modulation, in the parameter's units
+	void SetModulation(const float offset);
+	const float Modulation() const;
+	
+	/// Value plus modulation
+	const float ModulatedValue() const;
+	
+	/// Ramps from the modulated value of the previous control period to this one
+	void FillModulated(float* out, int frames) const;
 
 protected:
 	// override Observable
@@ -116,6 +133,8 @@ protected:
 private:
 	int _id;
 	float _value;
+	float _modulation;
+	ControlSignal _modulated;
 	std::string _name;
 	
 	bool _isPublished;
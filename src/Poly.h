@@ -3,6 +3,9 @@
 
 #include "AudioClient.h"
 #include "MidiServer.h"
+#include "Envelope.h"
+#include "ScratchArena.h"
+#include "QualityGovernor.h"
 #include <deque>
 #include <map>
 
@@ -12,18 +15,27 @@
 ///
 /// Subclasses should call base class versions of NoteOn and NoteOff
 ///
+/// Each voice has an Envelope, gated by NoteOn/NoteOff.  It starts out with
+/// no segments; subclasses that give it a shape should pass their output
+/// through ApplyEnvelope so that Poly can tell when they've gone silent.
+///
+/// Poly sets the MIDI channel of the note before NoteOn (-1 when the note
+/// didn't come from a channel message), so voices can follow the channel's
+/// pitch bend with Tuning::Frequency(note, Channel()).
+///
 class Voice : public AudioClient
 {
 public:
    Voice()
    : fTotalRendered(0)
    , fMax(0)
+   , fChannel(-1)
    , fPlaying(false)
    {}
    
    bool Done() const
    {
-      if (fTotalRendered == fMax)
+      if (fTotalRendered >= fMax)
       {
          return true;
       }
@@ -38,19 +50,43 @@ public:
       return fPlaying;
    }
    
+   /// True when the voice has nothing left to render, either because it ran
+   /// out of material or because its envelope has finished
+   bool Idle() const
+   {
+      return Done() || fEnvelope.Idle();
+   }
+   
+   Envelope& GetEnvelope()
+   {
+      return fEnvelope;
+   }
+   
+   void SetChannel(int channel) { fChannel = channel; }
+   int Channel() const { return fChannel; }
+   
    virtual void NoteOn(int note, int velocity)
    {
       fPlaying = true;
+      fEnvelope.NoteOn();
    }
    
    virtual void NoteOff()
    {
       fPlaying = false;
+      fEnvelope.NoteOff();
    }
    
 protected:
+   void ApplyEnvelope(float* buffer, int frames)
+   {
+      fEnvelope.Apply(buffer, frames);
+   }
+   
+   Envelope fEnvelope;
    int fTotalRendered;
    int fMax;
+   int fChannel;
    bool fPlaying;
 };
 
@@ -58,13 +94,22 @@ protected:
 // ----------------
 /// \brief Manager of Voices.  Accepts midi data and selects from a pool of pre-allocated
 ///   voices.
+///
+/// Below kQualityHigh the voice limit drops to three quarters (kQualityMedium)
+/// or half (kQualityLow) of the pool.  Each note on releases the oldest held
+/// notes over the limit, and new notes at the limit steal a released voice
+/// before a held one, so voices fade out through their envelopes rather than
+/// being cut.  The note map is only touched by NoteOn and NoteOff, on the
+/// MIDI side, never by Render.
 //
 //
 class Poly : public AudioClient
            , public MidiClient
 {
 public:
-	Poly() {}
+	Poly()
+	: fEventChannel(-1)
+	{}
 	
 	~Poly()
 	{
@@ -80,13 +125,13 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
-		float tmp[frames];
+		ScratchBuffer tmp(frames);
 		memset(tmp, 0.f, frames * sizeof(float));
 		
 		std::deque<Voice*>::iterator i;
 		for (i = fVoices.begin(); i != fVoices.end(); ++i)
 		{
-			//if (!(*i)->Done())  // only play voices that have data to render
+			if (!(*i)->Idle())  // only play voices that have data to render
 			{
 				(*i)->Process(buffer, frames);
 				for (int i = 0; i < frames; ++i)
@@ -102,6 +147,25 @@ public:
 		}
 	}
 	
+	void Prepare(int maxFrames)
+	{
+		AudioClient::Prepare(maxFrames);
+		
+		std::deque<Voice*>::iterator i;
+		for (i = fVoices.begin(); i != fVoices.end(); ++i)
+		{
+			(*i)->Prepare(maxFrames);
+		}
+	}
+	
+	void HandleEvent(const MidiEvent& event)
+	{
+		// note ons hand the channel on to their voice
+		fEventChannel = event.fChannel;
+		MidiClient::HandleEvent(event);
+		fEventChannel = -1;
+	}
+	
 	void NoteOn(int note, int velocity)
 	{
       // Check to see if this note is already playing
@@ -111,21 +175,54 @@ public:
          // just re-trigger
          Voice* v = (*i).second;
          
+         v->SetChannel(fEventChannel);
          v->NoteOn(note, velocity);
       }
       else
       {
          Voice* v = NULL;
          
-         // find the first voice that isn't playing
+         // at the voice limit, only sounding voices may be reused
+         const bool atLimit = SoundingVoices() >= VoiceLimit();
+         
+         // prefer a voice that has gone silent, then the oldest released one
          VoiceQueue::iterator i;
-         for (i = fVoices.begin(); i != fVoices.end(); ++i)
+         if (!atLimit)
+         {
+            for (i = fVoices.begin(); i != fVoices.end(); ++i)
+            {
+               if ((*i)->Idle())
+               {
+                  v = (*i);
+                  fVoices.erase(i);
+                  break;
+               }
+            }
+         }
+         
+         if (!v)
+         {
+            for (i = fVoices.begin(); i != fVoices.end(); ++i)
+            {
+               if (!(*i)->Playing() && !(atLimit && (*i)->Idle()))
+               {
+                  v = (*i);
+                  fVoices.erase(i);
+                  break;
+               }
+            }
+         }
+         
+         if (!v && atLimit) // steal the oldest sounding one
          {
-            if (!(*i)->Playing())
+            for (i = fVoices.begin(); i != fVoices.end(); ++i)
             {
-               v = (*i);
-               fVoices.erase(i);
-               break;
+               if (!(*i)->Idle())
+               {
+                  v = (*i);
+                  fVoices.erase(i);
+                  break;
+               }
             }
          }
          
@@ -135,11 +232,26 @@ public:
             fVoices.pop_front();
          }
          
+         // a stolen voice may still be mapped to the note it was playing
+         NoteMap::iterator n = fNoteMap.begin();
+         while (n != fNoteMap.end())
+         {
+            if ((*n).second == v)
+               fNoteMap.erase(n++);
+            else
+               ++n;
+         }
+         
          fNoteMap.insert(std::make_pair(note, v)); // insert into note map for note-off handling
+         v->SetChannel(fEventChannel);
          v->NoteOn(note, velocity);
          
          fVoices.push_back(v);
       }
+      
+      const int limit = VoiceLimit();
+      if (limit < (int)fVoices.size())
+         ReleaseOverLimit(limit);
 	}
    
    void NoteOff(int note)
@@ -172,11 +284,66 @@ public:
 	}
 	
 private:
+   /// How many voices may sound at the current quality
+   int VoiceLimit() const
+   {
+      const int voices = (int)fVoices.size();
+      const int quality = QualityGovernor::GetInstance()->Quality();
+      if (quality <= QualityGovernor::kQualityLow)
+         return std::max(voices / 2, 1);
+      if (quality < QualityGovernor::kQualityHigh)
+         return std::max(voices * 3 / 4, 1);
+      return voices;
+   }
+   
+   int SoundingVoices() const
+   {
+      int sounding = 0;
+      for (VoiceQueue::const_iterator i = fVoices.begin(); i != fVoices.end(); ++i)
+      {
+         if (!(*i)->Idle())
+            ++sounding;
+      }
+      return sounding;
+   }
+   
+   /// Releases the oldest held notes until no more than limit are held
+   void ReleaseOverLimit(int limit)
+   {
+      int held = 0;
+      for (VoiceQueue::iterator i = fVoices.begin(); i != fVoices.end(); ++i)
+      {
+         if ((*i)->Playing())
+            ++held;
+      }
+      
+      for (VoiceQueue::iterator i = fVoices.begin(); i != fVoices.end() && held > limit; ++i)
+      {
+         Voice* v = (*i);
+         if (v->Playing())
+         {
+            v->NoteOff();
+            --held;
+            
+            NoteMap::iterator n = fNoteMap.begin();
+            while (n != fNoteMap.end())
+            {
+               if ((*n).second == v)
+                  fNoteMap.erase(n++);
+               else
+                  ++n;
+            }
+         }
+      }
+   }
+   
    typedef std::deque<Voice*> VoiceQueue;
 	VoiceQueue fVoices;
    
    typedef std::map<int, Voice*> NoteMap;
    NoteMap fNoteMap;
+   
+   int fEventChannel;  // of the event being handled, -1 outside HandleEvent
 };
 
 #endif
@@ -0,0 +1,238 @@
+#ifndef h_PolyBank
+#define h_PolyBank
+
+#include <map>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioClient.h"
+#include "AudioServer.h"
+#include "MidiServer.h"
+#include "Envelope.h"
+
+// PolyBank
+// ----------------
+/// \brief Polyphonic player for one kind of voice whose state is kept by a
+/// kernel in structure-of-arrays form, so several voices render at once in
+/// the lanes of a SIMD register.
+///
+/// Where Poly holds a pool of Voice objects and calls each one's Process in
+/// turn, a PolyBank holds a single Kernel that owns every voice's state in
+/// arrays indexed by voice, and renders kLanes voices per call with loops
+/// over the lanes that the compiler vectorizes.  A Kernel provides:
+///
+///    enum { kLanes = ..., kMaxVoices = ... };   // kMaxVoices a multiple of kLanes
+///    void Start(int v, int note, int velocity);
+///    bool Done(int v) const;                    // out of material
+///    void Render(float* out, int frames, int first, float* gain, const float* gainStep);
+///
+/// Render adds voices first .. first + kLanes - 1 into out, each scaled by
+/// gain[lane], which moves by gainStep[lane] per sample and is left at its
+/// final value.  Lanes whose voice isn't sounding get a gain of 0 and must
+/// still produce finite output.
+///
+/// Voice allocation is Poly's: a note map for note offs and retriggers, and
+/// on note on a silent voice first, then the oldest released one, then the
+/// oldest of all.  Silent voices are taken from the lowest index so that
+/// sounding voices gather into as few lane groups as possible, and groups
+/// with no sounding voice are skipped.
+///
+/// Every voice has a copy of the bank's envelope (GetEnvelope), taken at
+/// note on and rendered at control rate, once per kControlPeriod samples,
+/// then ramped per sample through the kernel's gain.
+template <class Kernel>
+class PolyBank : public AudioClient
+               , public MidiClient
+{
+public:
+   enum
+   {
+      kLanes = Kernel::kLanes,
+      kMaxVoices = Kernel::kMaxVoices,
+      kNumGroups = kMaxVoices / kLanes,
+      kControlPeriod = 16
+   };
+
+   PolyBank(int numVoices = kMaxVoices)
+   : fNumVoices(std::min(std::max(numVoices, 1), (int)kMaxVoices))
+   , fNextAge(0)
+   , fControlRemaining(0)
+   {
+      memset(fGain, 0, sizeof(fGain));
+      memset(fGainStep, 0, sizeof(fGainStep));
+      memset(fActive, 0, sizeof(fActive));
+      memset(fPlaying, 0, sizeof(fPlaying));
+      memset(fAge, 0, sizeof(fAge));
+      memset(fGroupActive, 0, sizeof(fGroupActive));
+
+      fEnvelopeShape.SetADSR(0.f, 0.f, 1.f, 0.2f);
+   }
+
+   void Render(float* buffer, int frames)
+   {
+      memset(buffer, 0, frames * sizeof(float));
+
+      int done = 0;
+      while (done < frames)
+      {
+         if (fControlRemaining == 0)
+         {
+            UpdateEnvelopes(kControlPeriod);
+            fControlRemaining = kControlPeriod;
+         }
+
+         const int n = std::min(frames - done, fControlRemaining);
+         for (int g = 0; g < kNumGroups; ++g)
+         {
+            if (fGroupActive[g] > 0)
+               fKernel.Render(buffer + done, n, g * kLanes, fGain + g * kLanes, fGainStep + g * kLanes);
+         }
+
+         done += n;
+         fControlRemaining -= n;
+      }
+   }
+
+   void NoteOn(int note, int velocity)
+   {
+      NoteMap::iterator i = fNoteMap.find(note);
+      if (i != fNoteMap.end())
+      {
+         // just re-trigger
+         StartVoice((*i).second, note, velocity);
+         return;
+      }
+
+      // prefer a voice that has gone silent, then the oldest released one,
+      // then steal the oldest
+      int v = -1;
+      for (int k = 0; k < fNumVoices && v < 0; ++k)
+      {
+         if (!fActive[k])
+            v = k;
+      }
+      if (v < 0)
+         v = Oldest(false);
+      if (v < 0)
+         v = Oldest(true);
+
+      // a stolen voice may still be mapped to the note it was playing
+      NoteMap::iterator n = fNoteMap.begin();
+      while (n != fNoteMap.end())
+      {
+         if ((*n).second == v)
+            fNoteMap.erase(n++);
+         else
+            ++n;
+      }
+
+      fNoteMap.insert(std::make_pair(note, v));
+      StartVoice(v, note, velocity);
+   }
+
+   void NoteOff(int note)
+   {
+      NoteMap::iterator i = fNoteMap.find(note);
+      if (i != fNoteMap.end())
+      {
+         const int v = (*i).second;
+         fPlaying[v] = false;
+         fEnvelopes[v].NoteOff();
+         fNoteMap.erase(i);
+      }
+   }
+
+   /// Shape given to each voice's envelope at note on
+   Envelope& GetEnvelope() { return fEnvelopeShape; }
+
+   Kernel& GetKernel() { return fKernel; }
+
+   int ActiveVoices() const
+   {
+      int count = 0;
+      for (int g = 0; g < kNumGroups; ++g)
+         count += fGroupActive[g];
+      return count;
+   }
+
+private:
+   typedef std::map<int, int> NoteMap;
+
+   void StartVoice(int v, int note, int velocity)
+   {
+      if (!fActive[v])
+      {
+         fActive[v] = true;
+         ++fGroupActive[v / kLanes];
+      }
+      fPlaying[v] = true;
+      fAge[v] = fNextAge++;
+
+      fKernel.Start(v, note, velocity);
+
+      fEnvelopes[v] = fEnvelopeShape;
+      fEnvelopes[v].SetRate(AudioServer::GetInstance()->Fs() / kControlPeriod);
+      fEnvelopes[v].Reset();
+      fEnvelopes[v].NoteOn();
+      fGain[v] = 0.f;
+      fGainStep[v] = 0.f;
+   }
+
+   /// Oldest voice, among all of them or only released ones
+   int Oldest(bool includePlaying) const
+   {
+      int oldest = -1;
+      for (int k = 0; k < fNumVoices; ++k)
+      {
+         if (!includePlaying && fPlaying[k])
+            continue;
+         if (oldest < 0 || fAge[k] - fNextAge < fAge[oldest] - fNextAge)
+            oldest = k;
+      }
+      return oldest;
+   }
+
+   void UpdateEnvelopes(int frames)
+   {
+      for (int v = 0; v < fNumVoices; ++v)
+      {
+         if (!fActive[v])
+            continue;
+
+         // a voice is done once its envelope finished last period (the ramp
+         // to zero has played out by now) or its kernel ran dry
+         if (fEnvelopes[v].Idle() || fKernel.Done(v))
+         {
+            fActive[v] = false;
+            fPlaying[v] = false;
+            --fGroupActive[v / kLanes];
+            fGain[v] = 0.f;
+            fGainStep[v] = 0.f;
+            continue;
+         }
+
+         float level;
+         fEnvelopes[v].Render(&level, 1);
+         fGainStep[v] = (level - fGain[v]) / frames;
+      }
+   }
+
+   Kernel fKernel;
+   int fNumVoices;
+
+   Envelope fEnvelopeShape;
+   Envelope fEnvelopes[kMaxVoices];
+
+   float fGain[kMaxVoices];
+   float fGainStep[kMaxVoices];
+   bool fActive[kMaxVoices];
+   bool fPlaying[kMaxVoices];
+   unsigned fAge[kMaxVoices];
+   int fGroupActive[kNumGroups];
+
+   NoteMap fNoteMap;
+   unsigned fNextAge;
+   int fControlRemaining;
+};
+
+#endif
@@ -0,0 +1,286 @@
+#include "Profiler.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+#ifdef __GNUC__
+#include <cxxabi.h>
+#endif
+
+#include "AudioServer.h"
+
+Profiler* Profiler::sInstance = NULL;
+thread_local ProfileScope* ProfileScope::sCurrent = NULL;
+
+//------ Profiler::Stats ------//
+
+Profiler::Stats::Stats()
+: fCount(0)
+, fMin(0.0)
+, fMax(0.0)
+, fSum(0.0)
+, fOverruns(0)
+{
+   memset(fBuckets, 0, sizeof(fBuckets));
+}
+
+void Profiler::Stats::Add(double ns)
+{
+   fMin = fCount == 0 ? ns : std::min(fMin, ns);
+   fMax = std::max(fMax, ns);
+   fSum += ns;
+   ++fCount;
+
+   const int bucket = ns < 1.0 ? 0 : (int)(log2(ns) * kBucketsPerOctave);
+   ++fBuckets[std::min(bucket, (int)kNumBuckets - 1)];
+}
+
+double Profiler::Stats::Percentile(double p) const
+{
+   const double target = p * fCount;
+   double seen = 0.0;
+   for (int b = 0; b < kNumBuckets; ++b)
+   {
+      seen += fBuckets[b];
+      if (seen >= target)
+      {
+         // upper edge of the bucket, but never past what was measured
+         return std::min(fMax, pow(2.0, (double)(b + 1) / kBucketsPerOctave));
+      }
+   }
+   return fMax;
+}
+
+//------ Profiler ------//
+
+Profiler::Profiler()
+: fEnabled(false)
+, fRunning(false)
+, fXruns(0)
+, fDropped(0)
+, fTrace(false)
+, fStartTicks(MusKit::ReadTicks())
+, fStartClock(std::chrono::steady_clock::now())
+{
+   fBlockStats.fName = "block";
+}
+
+Profiler::~Profiler()
+{
+   Stop();
+   for (size_t i = 0; i < fLogs.size(); ++i)
+   {
+      delete fLogs[i];
+   }
+}
+
+void Profiler::Start(bool trace)
+{
+   if (fRunning.load())
+      return;
+
+   fTrace = trace;
+   fRunning.store(true);
+   fThread = std::thread(&Profiler::Run, this);
+   fEnabled.store(true);
+}
+
+void Profiler::Stop()
+{
+   fEnabled.store(false);
+   if (fRunning.exchange(false))
+   {
+      fThread.join();
+   }
+   Drain();
+}
+
+void Profiler::Reset()
+{
+   std::lock_guard<std::mutex> lock(fStatsLock);
+   fClientStats.clear();
+   fBlockStats = Stats();
+   fBlockStats.fName = "block";
+   fTraceRecords.clear();
+}
+
+void Profiler::SetName(const void* client, const std::string& name)
+{
+   std::lock_guard<std::mutex> lock(fStatsLock);
+   fNames[client] = name;
+}
+
+Profiler::ThreadLog* Profiler::CurrentLog()
+{
+   static thread_local ThreadLog* sLog = NULL;
+   if (!sLog)
+   {
+      // once per thread: the only allocation the audio thread makes here
+      std::lock_guard<std::mutex> lock(fLogLock);
+      sLog = new ThreadLog((int)fLogs.size());
+      fLogs.push_back(sLog);
+   }
+   return sLog;
+}
+
+void Profiler::Record(ProfileRecord& record)
+{
+   ThreadLog* log = CurrentLog();
+   record.fThread = log->fIndex;
+   if (!log->fRing.Push(record))
+      fDropped.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Profiler::Run()
+{
+   while (fRunning.load())
+   {
+      Drain();
+      std::this_thread::sleep_for(std::chrono::milliseconds(50));
+   }
+}
+
+double Profiler::NanosecondsPerTick()
+{
+#if defined(__x86_64__) || defined(__i386__) || defined(__aarch64__)
+   const uint64_t ticks = MusKit::ReadTicks() - fStartTicks;
+   const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - fStartClock).count();
+   return ticks > 0 ? ns / ticks : 1.0;
+#else
+   return 1.0;
+#endif
+}
+
+void Profiler::Drain()
+{
+   std::vector<ThreadLog*> logs;
+   {
+      std::lock_guard<std::mutex> lock(fLogLock);
+      logs = fLogs;
+   }
+
+   std::lock_guard<std::mutex> lock(fStatsLock);
+   const double nsPerTick = NanosecondsPerTick();
+   const double fs = AudioServer::GetInstance()->Fs();
+
+   ProfileRecord record;
+   for (size_t i = 0; i < logs.size(); ++i)
+   {
+      while (logs[i]->fRing.Pop(record))
+      {
+         const double ns = (record.fEnd - record.fStart) * nsPerTick;
+         if (record.fClient)
+         {
+            Stats& stats = fClientStats[record.fClient];
+            if (stats.fCount == 0)
+               stats.fName = NameOf(record);
+            stats.Add(ns - record.fChildTicks * nsPerTick);
+         }
+         else
+         {
+            fBlockStats.Add(ns);
+            if (ns > record.fFrames / fs * 1e9)
+               ++fBlockStats.fOverruns;
+         }
+
+         if (fTrace && fTraceRecords.size() < kMaxTraceRecords)
+            fTraceRecords.push_back(record);
+      }
+   }
+}
+
+std::string Profiler::NameOf(const ProfileRecord& record) const
+{
+   std::map<const void*, std::string>::const_iterator i = fNames.find(record.fClient);
+   if (i != fNames.end())
+      return i->second;
+
+   std::string name = record.fName ? record.fName : "client";
+#ifdef __GNUC__
+   int status = 0;
+   char* demangled = abi::__cxa_demangle(name.c_str(), NULL, NULL, &status);
+   if (status == 0 && demangled)
+      name = demangled;
+   free(demangled);
+#endif
+
+   std::ostringstream out;
+   out << name << " " << record.fClient;
+   return out.str();
+}
+
+void Profiler::Report(std::ostream& out)
+{
+   std::lock_guard<std::mutex> lock(fStatsLock);
+
+   out << std::fixed << std::setprecision(2);
+   out << std::setw(40) << std::left << "client" << std::right
+       << std::setw(10) << "count" << std::setw(10) << "min"
+       << std::setw(10) << "mean" << std::setw(10) << "p99"
+       << std::setw(10) << "max" << "  (us)\n";
+
+   std::vector<const Stats*> rows;
+   rows.push_back(&fBlockStats);
+   for (std::map<const void*, Stats>::const_iterator i = fClientStats.begin(); i != fClientStats.end(); ++i)
+   {
+      rows.push_back(&i->second);
+   }
+
+   for (size_t r = 0; r < rows.size(); ++r)
+   {
+      const Stats& s = *rows[r];
+      if (s.fCount == 0)
+         continue;
+      out << std::setw(40) << std::left << s.fName.substr(0, 39) << std::right
+          << std::setw(10) << s.fCount
+          << std::setw(10) << s.fMin / 1000.0
+          << std::setw(10) << s.fSum / s.fCount / 1000.0
+          << std::setw(10) << s.Percentile(0.99) / 1000.0
+          << std::setw(10) << s.fMax / 1000.0 << "\n";
+   }
+
+   out << "overruns " << fBlockStats.fOverruns
+       << "  xruns " << XRuns()
+       << "  dropped " << Dropped() << "\n";
+}
+
+bool Profiler::WriteChromeTrace(const std::string& path)
+{
+   std::ofstream file(path.c_str());
+   if (!file)
+      return false;
+
+   std::lock_guard<std::mutex> lock(fStatsLock);
+   const double usPerTick = NanosecondsPerTick() / 1000.0;
+
+   file << "{\"traceEvents\":[\n";
+   for (size_t i = 0; i < fTraceRecords.size(); ++i)
+   {
+      const ProfileRecord& record = fTraceRecords[i];
+
+      std::string name = "block";
+      if (record.fClient)
+      {
+         std::map<const void*, Stats>::const_iterator s = fClientStats.find(record.fClient);
+         name = s != fClientStats.end() ? s->second.fName : NameOf(record);
+      }
+
+      // names come from type names and SetName; keep the JSON valid
+      std::replace(name.begin(), name.end(), '"', '\'');
+      std::replace(name.begin(), name.end(), '\\', '/');
+
+      file << std::fixed << std::setprecision(3)
+           << "{\"name\":\"" << name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << record.fThread
+           << ",\"ts\":" << (double)(int64_t)(record.fStart - fStartTicks) * usPerTick
+           << ",\"dur\":" << (record.fEnd - record.fStart) * usPerTick
+           << ",\"args\":{\"time\":" << record.fTime << ",\"frames\":" << record.fFrames << "}}"
+           << (i + 1 < fTraceRecords.size() ? ",\n" : "\n");
+   }
+   file << "]}\n";
+
+   return (bool)file;
+}
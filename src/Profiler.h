@@ -0,0 +1,230 @@
+#ifndef h_Profiler
+#define h_Profiler
+
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "AudioClient.h"
+#include "RingBuffer.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Define qProfile (here or in the build settings) to time every client's
+// Render and every server block.  Without it the instrumentation isn't
+// compiled at all.
+//#define qProfile 1
+
+namespace MusKit
+{
+   /// Cheapest monotonic tick counter available: the TSC on x86, the
+   /// virtual counter on ARM64, steady_clock nanoseconds otherwise.
+   inline uint64_t ReadTicks()
+   {
+#if defined(__x86_64__) || defined(__i386__)
+      return __rdtsc();
+#elif defined(__aarch64__)
+      uint64_t ticks;
+      asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+      return ticks;
+#else
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+   }
+}
+
+// ProfileRecord
+// ----------------
+/// \brief One timed span on the audio thread: a client's Render, or a whole
+/// server block (fClient NULL).
+///
+/// Spans nest (a client's Render pulls its inputs), so fStart to fEnd is
+/// inclusive; fChildTicks is the part of it spent in spans nested inside.
+struct ProfileRecord
+{
+   const void* fClient;
+   const char* fName;   // static string, e.g. typeid name
+   uint64_t fStart;     // ticks
+   uint64_t fEnd;
+   uint64_t fChildTicks;
+   SampleTime fTime;    // server time of the span
+   int fFrames;
+   int fThread;         // filled in by the profiler
+};
+
+// Profiler
+// ----------------
+/// \brief Collects ProfileRecords from the audio thread(s) and aggregates
+/// them on a background thread.
+///
+/// Each thread that records gets its own wait-free ring (allocated the first
+/// time it records), so recording is two tick reads and a ring write.  The
+/// background thread drains the rings a few times a second and keeps, per
+/// client and for whole blocks, count/min/mean/max and a log-spaced
+/// histogram from which it estimates the 99th percentile.  Client figures
+/// are self time, excluding the clients they pull from; block figures are
+/// the whole block.  Blocks that took
+/// longer than their real-time budget are counted as overruns.  With tracing
+/// on it also keeps the raw records (up to kMaxTraceRecords) for
+/// WriteChromeTrace, which writes JSON for chrome://tracing or Perfetto, with
+/// the inclusive spans so the viewer shows them nested.
+///
+/// Driver xruns are counted whether or not qProfile is defined.
+class Profiler
+{
+public:
+   enum
+   {
+      kRingSize = 1 << 14,
+      kMaxTraceRecords = 1 << 20,
+      kBucketsPerOctave = 4,
+      kNumBuckets = 40 * kBucketsPerOctave
+   };
+
+   static Profiler* GetInstance()
+   {
+      if (!sInstance)
+      {
+         sInstance = new Profiler;
+      }
+      return sInstance;
+   }
+
+   ~Profiler();
+
+   /// Starts recording and the background thread
+   void Start(bool trace = false);
+   void Stop();
+   bool Enabled() const { return fEnabled.load(std::memory_order_relaxed); }
+
+   /// Forgets all statistics and trace records
+   void Reset();
+
+   /// Gives a client a readable name in reports (instead of its type)
+   void SetName(const void* client, const std::string& name);
+
+   /// Audio thread: stores a record in this thread's ring
+   void Record(ProfileRecord& record);
+
+   void CountXrun() { fXruns.fetch_add(1, std::memory_order_relaxed); }
+   unsigned long XRuns() const { return fXruns.load(std::memory_order_relaxed); }
+
+   /// Records lost because a ring was full
+   unsigned long Dropped() const { return fDropped.load(std::memory_order_relaxed); }
+
+   /// Writes a table of per-client and per-block timings (microseconds)
+   void Report(std::ostream& out);
+
+   /// Writes the trace records as Chrome trace-event JSON
+   bool WriteChromeTrace(const std::string& path);
+
+private:
+   Profiler();
+
+   struct ThreadLog
+   {
+      ThreadLog(int index) : fRing(kRingSize), fIndex(index) {}
+      RingBuffer<ProfileRecord> fRing;
+      int fIndex;
+   };
+
+   struct Stats
+   {
+      Stats();
+      void Add(double ns);
+      double Percentile(double p) const;
+
+      std::string fName;
+      unsigned long fCount;
+      double fMin;
+      double fMax;
+      double fSum;
+      unsigned long fOverruns;
+      unsigned long fBuckets[kNumBuckets];
+   };
+
+   ThreadLog* CurrentLog();
+   void Run();
+   void Drain();
+   double NanosecondsPerTick();
+   std::string NameOf(const ProfileRecord& record) const;
+
+   static Profiler* sInstance;
+
+   std::atomic<bool> fEnabled;
+   std::atomic<bool> fRunning;
+   std::atomic<unsigned long> fXruns;
+   std::atomic<unsigned long> fDropped;
+   bool fTrace;
+   std::thread fThread;
+
+   std::mutex fLogLock;
+   std::vector<ThreadLog*> fLogs;
+
+   // everything below is guarded by fStatsLock
+   std::mutex fStatsLock;
+   std::map<const void*, Stats> fClientStats;
+   Stats fBlockStats;
+   std::map<const void*, std::string> fNames;
+   std::vector<ProfileRecord> fTraceRecords;
+
+   // tick calibration
+   uint64_t fStartTicks;
+   std::chrono::steady_clock::time_point fStartClock;
+};
+
+// ProfileScope
+// ----------------
+/// \brief Times its own lifetime into a ProfileRecord, if the profiler is
+/// running.  Use inside #ifdef qProfile.
+///
+/// The scopes open on a thread form a stack; each adds its span to the
+/// enclosing scope's fChildTicks when it closes.
+class ProfileScope
+{
+public:
+   ProfileScope(const void* client, const char* name, SampleTime time, int frames)
+   : fActive(Profiler::GetInstance()->Enabled())
+   , fParent(sCurrent)
+   {
+      sCurrent = this;
+      if (fActive)
+      {
+         fRecord.fClient = client;
+         fRecord.fName = name;
+         fRecord.fTime = time;
+         fRecord.fFrames = frames;
+         fRecord.fChildTicks = 0;
+         fRecord.fStart = MusKit::ReadTicks();
+      }
+   }
+
+   ~ProfileScope()
+   {
+      if (fActive)
+      {
+         fRecord.fEnd = MusKit::ReadTicks();
+         if (fParent && fParent->fActive)
+            fParent->fRecord.fChildTicks += fRecord.fEnd - fRecord.fStart;
+         Profiler::GetInstance()->Record(fRecord);
+      }
+      sCurrent = fParent;
+   }
+
+private:
+   static thread_local ProfileScope* sCurrent;
+
+   bool fActive;
+   ProfileScope* fParent;
+   ProfileRecord fRecord;
+};
+
+#endif
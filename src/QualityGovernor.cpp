@@ -0,0 +1,98 @@
+#include "QualityGovernor.h"
+
+#include <algorithm>
+
+QualityGovernor* QualityGovernor::sInstance = NULL;
+
+// an overrun may step down again this soon after the last change...
+static const double kOverrunDwell = 0.05;
+// ...a high smoothed load only once it has had time to settle
+static const double kLoadDwell = 0.5;
+// longest the hold time grows to when stepping up keeps failing
+static const double kMaxBackoff = 16.0;
+
+QualityGovernor::QualityGovernor()
+: fQuality(kQualityHigh)
+, fForced(-1)
+, fShed(0.8f)
+, fRestore(0.5f)
+, fHoldSeconds(2.f)
+, fChanges(0)
+, fSinceChange(0.0)
+, fCalm(0.0)
+, fBackoff(1.0)
+, fSteppedUp(false)
+{
+}
+
+void QualityGovernor::Update(const LoadMonitor& monitor, int frames, float fs)
+{
+   const double seconds = frames / (double)fs;
+   fSinceChange += seconds;
+
+   const int forced = fForced.load(std::memory_order_relaxed);
+   if (forced >= 0)
+   {
+      fQuality.store(forced, std::memory_order_relaxed);
+      fCalm = 0.0;
+      return;
+   }
+
+   const float load = monitor.Load();
+   int quality = fQuality.load(std::memory_order_relaxed);
+
+   if (load < fRestore.load(std::memory_order_relaxed))
+      fCalm += seconds;
+   else
+      fCalm = 0.0;
+
+   const double hold = fHoldSeconds.load(std::memory_order_relaxed);
+
+   // a step up that has held for a while was sustainable, forget past failures
+   if (fSteppedUp && fSinceChange > hold * fBackoff)
+      fBackoff = 1.0;
+
+   const bool overrun = monitor.LastLoad() > 1.f;
+   if (quality > kQualityLow
+       && ((overrun && fSinceChange >= kOverrunDwell)
+           || (load > fShed.load(std::memory_order_relaxed) && fSinceChange >= kLoadDwell)))
+   {
+      // stepping straight back down: wait longer before the next try
+      if (fSteppedUp && fSinceChange < hold * fBackoff)
+         fBackoff = std::min(fBackoff * 2.0, kMaxBackoff);
+      fSteppedUp = false;
+      --quality;
+   }
+   else if (quality < kQualityHigh && fCalm >= hold * fBackoff)
+   {
+      fSteppedUp = true;
+      ++quality;
+   }
+   else
+   {
+      return;
+   }
+
+   fQuality.store(quality, std::memory_order_relaxed);
+   fChanges.fetch_add(1, std::memory_order_relaxed);
+   fSinceChange = 0.0;
+   fCalm = 0.0;
+}
+
+void QualityGovernor::Force(int quality)
+{
+   quality = std::max((int)kQualityLow, std::min(quality, (int)kQualityHigh));
+   fForced.store(quality);
+   fQuality.store(quality);
+}
+
+void QualityGovernor::Release()
+{
+   fForced.store(-1);
+}
+
+void QualityGovernor::SetThresholds(float shed, float restore)
+{
+   fShed.store(shed);
+   fRestore.store(std::min(restore, shed));
+}
@@ -0,0 +1,85 @@
+#ifndef h_QualityGovernor
+#define h_QualityGovernor
+
+#include <atomic>
+
+#include "LoadMonitor.h"
+
+// QualityGovernor
+// ----------------
+/// \brief Picks a quality tier from the measured DSP load, so that an
+/// overloaded patch gets cheaper instead of dropping out.
+///
+/// Clients that have cheaper modes read Quality() at the top of each render
+/// and scale themselves (Interpolator::SetQuality, AdditiveSinOsc, Poly).
+/// kQualityHigh is full quality; each step down trades fidelity for CPU.
+///
+/// The AudioServer calls Update after every block.  The governor steps down
+/// a tier on an overrun, or when the smoothed load (LoadMonitor::Load) is
+/// above the shed threshold, and waits a while between steps for the load
+/// to reflect the last one.  It steps back up only after the load has
+/// stayed below the restore threshold for the hold time, so it doesn't
+/// oscillate around a threshold.  If a step up is quickly followed by a
+/// step down, the hold time doubles for the next try.
+///
+/// Force pins a tier (OfflineDriver forces kQualityHigh, since nothing is
+/// waiting on an offline render); Release hands control back to the load.
+class QualityGovernor
+{
+public:
+   enum Quality
+   {
+      kQualityLow = 0,
+      kQualityMedium,
+      kQualityHigh,
+
+      kNumQualities
+   };
+
+   static QualityGovernor* GetInstance()
+   {
+      if (!sInstance)
+      {
+         sInstance = new QualityGovernor;
+      }
+      return sInstance;
+   }
+
+   /// The tier clients should render at
+   int Quality() const { return fQuality.load(std::memory_order_relaxed); }
+
+   /// Audio thread: reconsiders the tier after a block of frames at fs
+   void Update(const LoadMonitor& monitor, int frames, float fs);
+
+   /// Pins the tier regardless of load
+   void Force(int quality);
+   void Release();
+   bool Forced() const { return fForced.load() >= 0; }
+
+   /// Load above shed steps down, load below restore for holdSeconds steps up
+   void SetThresholds(float shed, float restore);
+   void SetHoldTime(float holdSeconds) { fHoldSeconds.store(holdSeconds); }
+
+   /// Number of tier changes made by Update
+   unsigned long Changes() const { return fChanges.load(std::memory_order_relaxed); }
+
+private:
+   QualityGovernor();
+
+   static QualityGovernor* sInstance;
+
+   std::atomic<int> fQuality;
+   std::atomic<int> fForced;          // tier, or -1
+   std::atomic<float> fShed;
+   std::atomic<float> fRestore;
+   std::atomic<float> fHoldSeconds;
+   std::atomic<unsigned long> fChanges;
+
+   // audio thread only
+   double fSinceChange;  // seconds
+   double fCalm;         // seconds below fRestore
+   double fBackoff;      // hold time multiplier
+   bool fSteppedUp;      // the last change was up
+};
+
+#endif
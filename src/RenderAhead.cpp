@@ -0,0 +1,114 @@
+#include "RenderAhead.h"
+
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "AlignedMemory.h"
+
+RenderAhead::RenderAhead(AudioClient* input, int lookahead, int chunkFrames)
+: fInput(input)
+, fLookahead(std::max(lookahead, chunkFrames))
+, fChunkFrames(chunkFrames)
+, fRing(std::max(lookahead, chunkFrames) + 2 * chunkFrames)
+, fChunk(NULL)
+, fOrigin(0)
+, fNeeded(0)
+, fRunning(false)
+, fUnderruns(0)
+{
+   fChunk = (float*)MusKit::AlignedAlloc(fChunkFrames * sizeof(float));
+   fScratch.Reserve(fChunkFrames);
+}
+
+RenderAhead::~RenderAhead()
+{
+   Stop();
+   MusKit::AlignedFree(fChunk);
+}
+
+void RenderAhead::Start()
+{
+   if (fRunning.load())
+      return;
+
+   // empty the ring and line its start up with now
+   fRing.Skip(fRing.ReadAvailable());
+   fOrigin = AudioServer::GetInstance()->Time() - (SampleTime)fRing.WritePosition();
+   fNeeded.store(fRing.WritePosition());
+
+   if (fInput)
+      fInput->Prepare(fChunkFrames);
+
+   fRunning.store(true);
+   fThread = std::thread(&RenderAhead::Run, this);
+}
+
+void RenderAhead::Stop()
+{
+   if (fRunning.exchange(false))
+      fThread.join();
+}
+
+void RenderAhead::Render(float* buffer, int frames)
+{
+   if (!fRunning.load())
+      return;
+
+   const SampleTime now = AudioServer::GetInstance()->Time();
+   const size_t position = (size_t)(now - fOrigin);
+
+   // drop anything rendered for a time that has passed (this client wasn't
+   // processed for a while, or the worker is catching up)
+   const size_t read = fRing.ReadPosition();
+   if ((ptrdiff_t)(position - read) > 0)
+      fRing.Skip(position - read);
+
+   const size_t n = fRing.Read(buffer, frames);
+   if (n < (size_t)frames)
+   {
+      memset(buffer + n, 0, (frames - n) * sizeof(float));
+      fUnderruns.fetch_add(1, std::memory_order_relaxed);
+      fNeeded.store(position + frames, std::memory_order_relaxed);
+   }
+}
+
+void RenderAhead::Run()
+{
+   ScratchArena::Bind(&fScratch);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const std::chrono::microseconds nap((long)(250000.0 * fChunkFrames / fs));
+
+   while (fRunning.load())
+   {
+      const size_t write = fRing.WritePosition();
+      const size_t needed = fNeeded.load(std::memory_order_relaxed);
+
+      if ((ptrdiff_t)(needed - write) > 0)
+      {
+         // fell behind the callback: pad up to where it is now and render on
+         // from there, rather than render audio that will only be skipped
+         memset(fChunk, 0, fChunkFrames * sizeof(float));
+         fRing.Write(fChunk, std::min(needed - write, (size_t)fChunkFrames));
+      }
+      else if (fRing.ReadAvailable() < (size_t)fLookahead && fRing.WriteAvailable() >= (size_t)fChunkFrames)
+      {
+         memset(fChunk, 0, fChunkFrames * sizeof(float));
+         if (fInput)
+         {
+            std::lock_guard<std::mutex> lock(fLock);
+            AudioServer::WorkerClock clock(fOrigin + (SampleTime)write);
+            fInput->Process(fChunk, fChunkFrames);
+         }
+         fRing.Write(fChunk, fChunkFrames);
+      }
+      else
+      {
+         std::this_thread::sleep_for(nap);
+      }
+   }
+
+   ScratchArena::Bind(NULL);
+}
@@ -0,0 +1,80 @@
+#ifndef h_RenderAhead
+#define h_RenderAhead
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "AudioClient.h"
+#include "RingBuffer.h"
+#include "ScratchArena.h"
+
+// RenderAhead
+// ----------------
+/// \brief Renders its input on a worker thread, ahead of the audio callback,
+/// and plays it back from a ring buffer.
+///
+/// Use it for subgraphs that don't depend on live input: a Sequencer and
+/// the instrument it plays, oscillators driven only by scheduled changes.
+/// The worker renders in chunks of chunkFrames and keeps up to lookahead
+/// frames ready, so the callback only copies them out and a slow chunk is
+/// absorbed by the lookahead instead of causing an xrun.
+///
+/// The input is rendered under an AudioServer::WorkerClock, so Time() in
+/// the subgraph is the time being rendered for and BlockCache and
+/// sub-block scheduling work as usual.  Things the subgraph reads at
+/// render time from outside it (live MIDI, parameter changes, the
+/// Transport snapshot) take effect up to lookahead frames late.
+///
+/// The subgraph belongs to the worker: don't also connect its clients to
+/// the server or to other clients, and make changes to it between
+/// EnterLock and ExitLock (not the server's lock).  The callback never
+/// waits for the worker; if it runs dry the block is padded with silence
+/// and counted in Underruns(), and the worker skips ahead to catch up.
+///
+/// Start and Stop must be called with the AudioServer lock held (or before
+/// the stream starts), like other changes to a running graph.
+class RenderAhead : public AudioClient
+{
+public:
+   RenderAhead(AudioClient* input, int lookahead = 8192, int chunkFrames = 1024);
+   ~RenderAhead();
+
+   void Render(float* buffer, int frames);
+
+   /// Starts the worker, rendering from the server's current time
+   void Start();
+   void Stop();
+   bool Running() const { return fRunning.load(); }
+
+   void EnterLock() { fLock.lock(); }
+   void ExitLock() { fLock.unlock(); }
+
+   /// Blocks that were short of pre-rendered audio
+   unsigned long Underruns() const { return fUnderruns.load(std::memory_order_relaxed); }
+
+   /// Frames rendered and not yet played
+   int Ready() const { return (int)fRing.ReadAvailable(); }
+
+private:
+   void Run();
+
+   AudioClient* fInput;
+   const int fLookahead;
+   const int fChunkFrames;
+
+   RingBuffer<float> fRing;
+   float* fChunk;
+   ScratchArena fScratch;  // the worker's
+
+   // ring position p holds the sample for time fOrigin + p
+   SampleTime fOrigin;
+   std::atomic<size_t> fNeeded;  // position the callback wanted and didn't get
+
+   std::atomic<bool> fRunning;
+   std::atomic<unsigned long> fUnderruns;
+   std::thread fThread;
+   std::mutex fLock;
+};
+
+#endif
@@ -0,0 +1,303 @@
+#include "Reverb.h"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AlignedMemory.h"
+#include "AudioServer.h"
+#include "QualityGovernor.h"
+#include "ScratchArena.h"
+
+// deepest sweep SetModulation allows, in seconds
+static const float kMaxModulation = 0.002f;
+
+static bool IsPrime(int n)
+{
+   if (n < 2)
+      return false;
+   for (int d = 2; d * d <= n; ++d)
+   {
+      if (n % d == 0)
+         return false;
+   }
+   return true;
+}
+
+// input polarity per line, and which output (and polarity) each line feeds
+static float Sign(int line)
+{
+   return (line / 2) % 2 ? -1.f : 1.f;
+}
+
+FdnReverb::FdnReverb(AudioClient* input, int lines)
+: MultiOutputClient(2)
+, fInput(input)
+, fNumLines(lines > 8 ? 16 : 8)
+, fMaxFrames(0)
+, fStorage(NULL)
+, fOut(NULL)
+, fDelays(NULL)
+, fMatrix(kHadamard)
+, fDecay(2.f)
+, fDamping(0.4f)
+, fSize(1.f)
+, fModDepth(0.0005f)
+, fMix(0.3f)
+{
+   for (int j = 0; j < kMaxLines; ++j)
+   {
+      fLength[j] = 0.f;
+      fCentre[j] = -1.f;
+      fGain[j] = 0.f;
+      fPole[j] = 0.f;
+      fLowpass[j] = 0.f;
+   }
+   SetModulation(fModDepth, 0.5f);
+}
+
+FdnReverb::~FdnReverb()
+{
+   MusKit::AlignedFree(fStorage);
+}
+
+void FdnReverb::SetModulation(float depth, float rate)
+{
+   fModDepth = std::max(0.f, std::min(depth, kMaxModulation));
+
+   // rates spread over ±30% so the lines don't sweep together
+   for (int j = 0; j < fNumLines; ++j)
+   {
+      fSweeps[j].SetRate(rate * (0.7f + 0.6f * j / (fNumLines - 1)));
+      fSweeps[j].Reset((float)j / fNumLines);
+   }
+}
+
+void FdnReverb::Prepare(int maxFrames)
+{
+   MultiOutputClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const int modulation = (int)ceilf(kMaxModulation * fs) + 1;
+
+   // mutually prime lengths, so the lines' echoes don't pile up
+   int previous = 0;
+   for (int j = 0; j < fNumLines; ++j)
+   {
+      const float ms = kMinMilliseconds * powf((float)kMaxMilliseconds / kMinMilliseconds, (float)j / (fNumLines - 1));
+      int length = std::max((int)(ms * fs / 1000.f + 0.5f), previous + 1);
+      while (!IsPrime(length))
+         ++length;
+      fLength[j] = (float)length;
+      previous = length;
+   }
+
+   // one block: the lines, then fOut and fDelays, each row a whole number of
+   // cache lines
+   fMaxFrames = (maxFrames + 15) & ~15;
+   size_t total = 2 * (size_t)fNumLines * fMaxFrames;
+   for (int j = 0; j < fNumLines; ++j)
+      total += DelayLine::StorageSize((int)fLength[j] + modulation, maxFrames);
+
+   float* storage = (float*)MusKit::AlignedAlloc(total * sizeof(float));
+   float* next = storage;
+   for (int j = 0; j < fNumLines; ++j)
+   {
+      const int maxDelay = (int)fLength[j] + modulation;
+      fLines[j].Attach(next, maxDelay, maxFrames);
+      next += DelayLine::StorageSize(maxDelay, maxFrames);
+      fCentre[j] = -1.f;
+      fLowpass[j] = 0.f;
+   }
+   fOut = next;
+   fDelays = next + (size_t)fNumLines * fMaxFrames;
+
+   MusKit::AlignedFree(fStorage);
+   fStorage = storage;
+}
+
+void FdnReverb::Clear()
+{
+   for (int j = 0; j < fNumLines; ++j)
+   {
+      if (fStorage)
+         fLines[j].Clear();
+      fLowpass[j] = 0.f;
+   }
+}
+
+void FdnReverb::UpdateGains(float fs)
+{
+   // loop gain for a 60dB decay over the decay time, at DC and (times the
+   // damping) at Nyquist; the one-pole's pole sets the ratio between them
+   const float decay = std::max(fDecay, 0.01f);
+   const float damping = std::max(0.01f, std::min(fDamping, 1.f));
+   for (int j = 0; j < fNumLines; ++j)
+   {
+      const float low = powf(10.f, -3.f * fCentre[j] / (fs * decay));
+      const float high = powf(10.f, -3.f * fCentre[j] / (fs * decay * damping));
+      fGain[j] = low;
+      fPole[j] = (low - high) / (low + high);
+   }
+}
+
+void FdnReverb::Mix(int pos, int frames)
+{
+   const int n = fNumLines;
+
+   if (fMatrix == kHouseholder)
+   {
+      // I - 2/N * ones
+      ScratchBuffer sum(frames);
+      memset(sum, 0, frames * sizeof(float));
+      for (int j = 0; j < n; ++j)
+      {
+         const float* x = fOut + j * fMaxFrames + pos;
+         for (int i = 0; i < frames; ++i)
+            sum[i] += x[i];
+      }
+
+      const float scale = -2.f / n;
+      for (int i = 0; i < frames; ++i)
+         sum[i] *= scale;
+
+      for (int j = 0; j < n; ++j)
+      {
+         float* x = fOut + j * fMaxFrames + pos;
+         for (int i = 0; i < frames; ++i)
+            x[i] += sum[i];
+      }
+      return;
+   }
+
+   // fast Walsh-Hadamard transform, normalized in the last stage
+   const float norm = 1.f / sqrtf((float)n);
+   for (int h = 1; h < n; h *= 2)
+   {
+      const float scale = h * 2 == n ? norm : 1.f;
+      for (int a = 0; a < n; a += 2 * h)
+      {
+         for (int k = a; k < a + h; ++k)
+         {
+            float* x = fOut + k * fMaxFrames + pos;
+            float* y = fOut + (k + h) * fMaxFrames + pos;
+            for (int i = 0; i < frames; ++i)
+            {
+               const float t = x[i];
+               x[i] = (t + y[i]) * scale;
+               y[i] = (t - y[i]) * scale;
+            }
+         }
+      }
+   }
+}
+
+void FdnReverb::RenderChannels(float** buffers, int numChannels, int frames)
+{
+   float* left = buffers[0];
+   float* right = buffers[1];
+
+   if (fInput)
+      fInput->Process(left, frames);
+
+   if (!fStorage || frames > fMaxFrames)
+   {
+      memcpy(right, left, frames * sizeof(float));
+      return;
+   }
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   const bool modulate = fModDepth > 0.f && QualityGovernor::GetInstance()->Quality() >= QualityGovernor::kQualityHigh;
+   const float depth = modulate ? fModDepth * fs : 0.f;
+   const float size = std::max(0.1f, std::min(fSize, 1.f));
+
+   // this block's delays: fixed, or gliding to a new size and/or swept
+   bool fixed[kMaxLines];
+   float shortest = 1e9f;
+   for (int j = 0; j < fNumLines; ++j)
+   {
+      const float to = fLength[j] * size;
+      const float from = fCentre[j] < 0.f ? to : fCentre[j];
+      float* delays = fDelays + j * fMaxFrames;
+
+      fixed[j] = !modulate && from == to;
+      if (!fixed[j])
+      {
+         if (modulate)
+            fSweeps[j].Fill(delays, frames, 0.f, depth);
+         else
+            memset(delays, 0, frames * sizeof(float));
+
+         const float step = (to - from) / frames;
+         for (int i = 0; i < frames; ++i)
+            delays[i] += from + step * (i + 1);
+      }
+
+      fCentre[j] = to;
+      shortest = std::min(shortest, std::min(from, to) - depth);
+   }
+   UpdateGains(fs);
+
+   ScratchBuffer wetLeft(frames);
+   ScratchBuffer wetRight(frames);
+   ScratchBuffer send(frames);
+   memset(wetLeft, 0, frames * sizeof(float));
+   memset(wetRight, 0, frames * sizeof(float));
+
+   const float inputGain = 1.f / sqrtf((float)fNumLines);
+   const float outputGain = sqrtf(2.f / fNumLines);
+
+   // linear ReadNext needs every delay at least one sample past its frame
+   const int chunk = std::max((int)shortest, 1);
+   for (int pos = 0; pos < frames; pos += chunk)
+   {
+      const int n = std::min(chunk, frames - pos);
+
+      for (int j = 0; j < fNumLines; ++j)
+      {
+         float* out = fOut + j * fMaxFrames + pos;
+         if (fixed[j])
+            fLines[j].ReadNext(out, n, fCentre[j]);
+         else
+            fLines[j].ReadNext(out, n, fDelays + j * fMaxFrames + pos);
+
+         // damping and decay
+         const float gain = fGain[j];
+         const float pole = fPole[j];
+         float y = fLowpass[j];
+         for (int i = 0; i < n; ++i)
+         {
+            y = (1.f - pole) * out[i] + pole * y;
+            out[i] = gain * y;
+         }
+         fLowpass[j] = y;
+
+         // even lines to the left, odd to the right
+         float* wet = (j % 2 ? wetRight : wetLeft) + pos;
+         const float tap = Sign(j) * outputGain;
+         for (int i = 0; i < n; ++i)
+            wet[i] += tap * out[i];
+      }
+
+      Mix(pos, n);
+
+      for (int j = 0; j < fNumLines; ++j)
+      {
+         const float* out = fOut + j * fMaxFrames + pos;
+         const float gain = Sign(j + 1) * inputGain;
+         for (int i = 0; i < n; ++i)
+            send[i] = out[i] + gain * left[pos + i];
+         fLines[j].Write(send, n);
+      }
+   }
+
+   const float dry = 1.f - fMix;
+   for (int i = 0; i < frames; ++i)
+   {
+      const float input = left[i];
+      left[i] = dry * input + fMix * wetLeft[i];
+      right[i] = dry * input + fMix * wetRight[i];
+   }
+}
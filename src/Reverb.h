@@ -0,0 +1,102 @@
+#ifndef h_Reverb
+#define h_Reverb
+
+#include "AudioClient.h"
+#include "DelayLine.h"
+#include "DelayEffects.h"
+
+// FdnReverb
+// ----------------
+/// \brief Feedback delay network reverb: a mono input into 8 or 16 delay
+/// lines whose outputs are damped, mixed by an orthogonal matrix and fed
+/// back.  Output(0) and Output(1) are left and right, a crossfade (mix)
+/// from the dry input to the wet signal.
+///
+/// Line lengths are primes spread exponentially between kMinMilliseconds
+/// and kMaxMilliseconds, times size.  Each line has a one-pole lowpass that
+/// sets its loop gain for the decay time at DC and for decay × damping at
+/// Nyquist, so the high end dies away first.  Lines are swept slightly by
+/// their own LFOs to break up metallic ringing; below kQualityHigh they
+/// aren't, which is noticeably cheaper.
+///
+/// The feedback matrix is a Hadamard matrix, applied as a fast
+/// Walsh-Hadamard transform (N log N), or a Householder reflection (N).
+/// Either way it runs a chunk of frames at a time on arrays laid out line by
+/// line, so every step is a vector operation across frames.  The lines and
+/// the working arrays share one allocation, made in Prepare.
+class FdnReverb : public MultiOutputClient
+{
+public:
+   enum
+   {
+      kMaxLines = 16,
+      kMinMilliseconds = 20,
+      kMaxMilliseconds = 70
+   };
+
+   enum MatrixType
+   {
+      kHadamard = 0,
+      kHouseholder
+   };
+
+   /// lines is 8 or 16
+   FdnReverb(AudioClient* input = NULL, int lines = 8);
+   ~FdnReverb();
+
+   void RenderChannels(float** buffers, int numChannels, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   void SetMatrix(int type) { fMatrix = type; }
+
+   /// Seconds to decay by 60dB at low frequencies
+   void SetDecay(float seconds) { fDecay = seconds; }
+
+   /// High frequency decay as a fraction of the low (0-1, 1 for none)
+   void SetDamping(float damping) { fDamping = damping; }
+
+   /// Scales the line lengths (0.1-1); changes glide over a block
+   void SetSize(float size) { fSize = size; }
+
+   /// Sweep depth (seconds) and rate (Hz, spread across the lines)
+   void SetModulation(float depth, float rate);
+
+   void SetMix(float mix) { fMix = mix; }
+
+   /// Silences the tails.  Call with the AudioServer lock held.
+   void Clear();
+
+private:
+   FdnReverb(const FdnReverb&);
+   FdnReverb& operator=(const FdnReverb&);
+
+   void UpdateGains(float fs);
+   void Mix(int pos, int frames);
+
+   AudioClient* fInput;
+   int fNumLines;
+   int fMaxFrames;
+   float* fStorage;  // line buffers, then fOut and fDelays
+
+   DelayLine fLines[kMaxLines];
+   DelaySweep fSweeps[kMaxLines];
+   float fLength[kMaxLines];  // samples at size 1
+   float fCentre[kMaxLines];  // samples, as of the last block
+   float fGain[kMaxLines];
+   float fPole[kMaxLines];
+   float fLowpass[kMaxLines];
+
+   float* fOut;     // [line][fMaxFrames]
+   float* fDelays;  // [line][fMaxFrames]
+
+   int fMatrix;
+   float fDecay;
+   float fDamping;
+   float fSize;
+   float fModDepth;
+   float fMix;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef h_RingBuffer
+#define h_RingBuffer
+
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+
+#include "AlignedMemory.h"
+
+// RingBuffer
+// ----------------
+/// \brief Wait-free single-producer/single-consumer ring buffer.
+///
+/// One thread may write and one (other) thread may read without locks.
+/// Capacity is rounded up to a power of 2 so indices wrap with a mask.  Read
+/// and write positions are free-running counters, which lets the consumer
+/// skip to a position the producer has published (see SeekRead).
+///
+/// T must be trivially copyable.  Storage is allocated once at construction.
+template <typename T>
+class RingBuffer
+{
+public:
+   RingBuffer(size_t capacity)
+   : fCapacity(1)
+   , fData(NULL)
+   , fWrite(0)
+   , fRead(0)
+   {
+      while (fCapacity < capacity)
+         fCapacity <<= 1;
+      fMask = fCapacity - 1;
+      fData = (T*)MusKit::AlignedAlloc(fCapacity * sizeof(T));
+      memset(fData, 0, fCapacity * sizeof(T));
+   }
+
+   ~RingBuffer()
+   {
+      MusKit::AlignedFree(fData);
+   }
+
+   size_t Capacity() const { return fCapacity; }
+
+   // producer side
+
+   size_t WriteAvailable() const
+   {
+      return fCapacity - (fWrite.load(std::memory_order_relaxed) - fRead.load(std::memory_order_acquire));
+   }
+
+   /// Writes up to n items, returns the number written
+   size_t Write(const T* src, size_t n)
+   {
+      const size_t w = fWrite.load(std::memory_order_relaxed);
+      n = std::min(n, fCapacity - (w - fRead.load(std::memory_order_acquire)));
+      const size_t start = w & fMask;
+      const size_t first = std::min(n, fCapacity - start);
+      memcpy(fData + start, src, first * sizeof(T));
+      memcpy(fData, src + first, (n - first) * sizeof(T));
+      fWrite.store(w + n, std::memory_order_release);
+      return n;
+   }
+
+   bool Push(const T& item)
+   {
+      return Write(&item, 1) == 1;
+   }
+
+   /// Free-running count of items ever written
+   size_t WritePosition() const { return fWrite.load(std::memory_order_acquire); }
+
+   // consumer side
+
+   size_t ReadAvailable() const
+   {
+      return fWrite.load(std::memory_order_acquire) - fRead.load(std::memory_order_relaxed);
+   }
+
+   /// Reads up to n items, returns the number read
+   size_t Read(T* dst, size_t n)
+   {
+      const size_t r = fRead.load(std::memory_order_relaxed);
+      n = std::min(n, fWrite.load(std::memory_order_acquire) - r);
+      const size_t start = r & fMask;
+      const size_t first = std::min(n, fCapacity - start);
+      memcpy(dst, fData + start, first * sizeof(T));
+      memcpy(dst + first, fData, (n - first) * sizeof(T));
+      fRead.store(r + n, std::memory_order_release);
+      return n;
+   }
+
+   bool Pop(T& item)
+   {
+      return Read(&item, 1) == 1;
+   }
+
+   /// Drops up to n items without copying them
+   size_t Skip(size_t n)
+   {
+      const size_t r = fRead.load(std::memory_order_relaxed);
+      n = std::min(n, fWrite.load(std::memory_order_acquire) - r);
+      fRead.store(r + n, std::memory_order_release);
+      return n;
+   }
+
+   /// Moves the read position forward to a position obtained from
+   /// WritePosition(), discarding everything written before it
+   void SeekRead(size_t position)
+   {
+      assert(position - fRead.load(std::memory_order_relaxed) <= fCapacity);
+      fRead.store(position, std::memory_order_release);
+   }
+
+   size_t ReadPosition() const { return fRead.load(std::memory_order_acquire); }
+
+private:
+   RingBuffer(const RingBuffer&);
+   RingBuffer& operator=(const RingBuffer&);
+
+   size_t fCapacity;
+   size_t fMask;
+   T* fData;
+
+   // pad the two indices onto separate cache lines so producer and consumer
+   // don't invalidate each other's line on every update
+   char fPad0[MusKit::kCacheLineSize];
+   std::atomic<size_t> fWrite;
+   char fPad1[MusKit::kCacheLineSize];
+   std::atomic<size_t> fRead;
+};
+
+#endif
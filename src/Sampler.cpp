@@ -0,0 +1,627 @@
+#include "Sampler.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "AudioServer.h"
+#include "Tuning.h"
+
+static unsigned int ReadLE16(const unsigned char* p)
+{
+   return p[0] | (p[1] << 8);
+}
+
+static unsigned int ReadLE32(const unsigned char* p)
+{
+   return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned int)p[3] << 24);
+}
+
+//------ SampleFile ------//
+
+SampleFile::SampleFile()
+: fFd(-1)
+, fMap(NULL)
+, fMapSize(0)
+, fDataOffset(0)
+, fFrames(0)
+, fChannels(0)
+, fBytesPerSample(0)
+, fIsFloat(false)
+, fSampleRate(44100.f)
+, fStaging(NULL)
+, fStagingFrames(0)
+{
+}
+
+SampleFile::~SampleFile()
+{
+   Close();
+}
+
+bool SampleFile::Open(const std::string& path, bool memoryMap)
+{
+   Close();
+
+   fFd = open(path.c_str(), O_RDONLY);
+   if (fFd < 0)
+      return false;
+
+   if (memoryMap)
+   {
+      struct stat info;
+      if (fstat(fFd, &info) == 0 && info.st_size > 0)
+      {
+         void* map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fFd, 0);
+         if (map != MAP_FAILED)
+         {
+            fMap = (unsigned char*)map;
+            fMapSize = info.st_size;
+         }
+      }
+   }
+
+   if (!ParseHeader())
+   {
+      Close();
+      return false;
+   }
+
+   return true;
+}
+
+void SampleFile::Close()
+{
+   if (fMap)
+   {
+      munmap(fMap, fMapSize);
+      fMap = NULL;
+      fMapSize = 0;
+   }
+   if (fFd >= 0)
+   {
+      close(fFd);
+      fFd = -1;
+   }
+   delete[] fStaging;
+   fStaging = NULL;
+   fStagingFrames = 0;
+   fFrames = 0;
+}
+
+bool SampleFile::ParseHeader()
+{
+   unsigned char header[12];
+   if (pread(fFd, header, 12, 0) != 12
+       || memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0)
+   {
+      return false;
+   }
+
+   bool haveFormat = false;
+   int64_t offset = 12;
+   for (;;)
+   {
+      unsigned char chunk[8];
+      if (pread(fFd, chunk, 8, offset) != 8)
+         return false;
+
+      const unsigned int size = ReadLE32(chunk + 4);
+      if (memcmp(chunk, "fmt ", 4) == 0)
+      {
+         unsigned char fmt[40];
+         memset(fmt, 0, sizeof(fmt));
+         const int n = std::min(size, (unsigned int)sizeof(fmt));
+         if (n < 16 || pread(fFd, fmt, n, offset + 8) != n)
+            return false;
+
+         unsigned int format = ReadLE16(fmt);
+         if (format == 0xFFFE && n >= 26)
+         {
+            // WAVE_FORMAT_EXTENSIBLE: the real format leads the sub-format GUID
+            format = ReadLE16(fmt + 24);
+         }
+         fChannels = ReadLE16(fmt + 2);
+         fSampleRate = (float)ReadLE32(fmt + 4);
+         fBytesPerSample = ReadLE16(fmt + 14) / 8;
+         fIsFloat = (format == 3);
+
+         if (fChannels < 1 || !(format == 1 || format == 3)
+             || (fIsFloat && fBytesPerSample != 4)
+             || (!fIsFloat && (fBytesPerSample < 2 || fBytesPerSample > 4)))
+         {
+            return false;
+         }
+         haveFormat = true;
+      }
+      else if (memcmp(chunk, "data", 4) == 0)
+      {
+         if (!haveFormat)
+            return false;
+
+         fDataOffset = offset + 8;
+         int64_t bytes = size;
+         if (fMap)
+         {
+            bytes = std::min(bytes, (int64_t)fMapSize - fDataOffset);
+         }
+         fFrames = bytes / (fChannels * fBytesPerSample);
+         return true;
+      }
+
+      // chunks are padded to an even length
+      offset += 8 + size + (size & 1);
+   }
+}
+
+void SampleFile::Convert(const unsigned char* bytes, float* dst, int n) const
+{
+   const float channelScale = 1.f / fChannels;
+   for (int i = 0; i < n; ++i)
+   {
+      float sum = 0.f;
+      for (int c = 0; c < fChannels; ++c)
+      {
+         const unsigned char* p = bytes;
+         bytes += fBytesPerSample;
+
+         if (fIsFloat)
+         {
+            float f;
+            memcpy(&f, p, sizeof(float));
+            sum += f;
+            continue;
+         }
+
+         switch (fBytesPerSample)
+         {
+         case 2:
+            sum += (short)ReadLE16(p) * (1.f / 32768.f);
+            break;
+         case 3:
+            sum += ((int)((p[0] << 8) | (p[1] << 16) | ((unsigned int)p[2] << 24)) >> 8) * (1.f / 8388608.f);
+            break;
+         default:
+            sum += (int)ReadLE32(p) * (1.f / 2147483648.f);
+            break;
+         }
+      }
+      dst[i] = sum * channelScale;
+   }
+}
+
+int SampleFile::ReadFrames(int64_t start, float* dst, int n) const
+{
+   const int available = (int)std::max((int64_t)0, std::min((int64_t)n, fFrames - start));
+   const int frameBytes = fChannels * fBytesPerSample;
+
+   if (available > 0)
+   {
+      if (fMap)
+      {
+         Convert(fMap + fDataOffset + start * frameBytes, dst, available);
+      }
+      else
+      {
+         if (available > fStagingFrames)
+         {
+            delete[] fStaging;
+            fStaging = new unsigned char[available * frameBytes];
+            fStagingFrames = available;
+         }
+
+         const ssize_t bytes = pread(fFd, fStaging, available * frameBytes, fDataOffset + start * frameBytes);
+         const int got = bytes > 0 ? (int)(bytes / frameBytes) : 0;
+         Convert(fStaging, dst, got);
+         memset(dst + got, 0, (available - got) * sizeof(float));
+      }
+   }
+
+   memset(dst + available, 0, (n - available) * sizeof(float));
+   return available;
+}
+
+void SampleFile::Prefetch(int64_t start, int n) const
+{
+   if (!fMap || start >= fFrames)
+      return;
+
+   const int frameBytes = fChannels * fBytesPerSample;
+   const int64_t end = std::min(start + n, fFrames);
+   const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+   // madvise wants a page-aligned address
+   size_t first = (size_t)(fDataOffset + start * frameBytes);
+   size_t last = (size_t)(fDataOffset + end * frameBytes);
+   first -= first % page;
+   posix_madvise(fMap + first, last - first, POSIX_MADV_WILLNEED);
+}
+
+//------ SampleZone ------//
+
+SampleZone::SampleZone()
+: fPreload(NULL)
+, fPreloadFrames(0)
+, fRootNote(60)
+, fLowNote(0)
+, fHighNote(127)
+, fLowVelocity(1)
+, fHighVelocity(127)
+{
+}
+
+SampleZone::~SampleZone()
+{
+   delete[] fPreload;
+}
+
+//------ SampleStream ------//
+
+SampleStream::SampleStream(int ringFrames, bool memoryMapped)
+: fRing(ringFrames)
+, fMapped(memoryMapped)
+, fRequestGen(0)
+, fRequestZone(NULL)
+, fRequestStart(0)
+, fFillGen(0)
+, fFillStart(0)
+, fPlayFrame(0)
+, fGen(0)
+, fSynced(false)
+, fZone(NULL)
+, fServedGen(0)
+, fServedZone(NULL)
+, fNextFrame(0)
+{
+}
+
+void SampleStream::Start(const SampleZone* zone, int64_t startFrame)
+{
+   // free the ring for the new request; anything the producer writes before
+   // it picks the request up is skipped in Sync
+   fRing.Skip(fRing.ReadAvailable());
+
+   fZone = zone;
+   fSynced = false;
+   fPlayFrame.store(startFrame, std::memory_order_relaxed);
+
+   fRequestZone.store(zone, std::memory_order_relaxed);
+   fRequestStart.store(startFrame, std::memory_order_relaxed);
+   fRequestGen.store(++fGen, std::memory_order_release);
+}
+
+void SampleStream::Stop()
+{
+   Start(NULL, 0);
+}
+
+void SampleStream::Sync()
+{
+   if (fSynced || fMapped || fFillGen.load(std::memory_order_acquire) != fGen)
+      return;
+
+   fRing.SeekRead(fFillStart.load(std::memory_order_relaxed));
+   fSynced = true;
+}
+
+int SampleStream::Read(float* dst, int n)
+{
+   if (!fZone)
+      return 0;
+
+   if (fMapped)
+   {
+      // pages were prefetched by the streaming thread, read the mapping directly
+      const int64_t position = fPlayFrame.load(std::memory_order_relaxed);
+      const int got = fZone->fFile.ReadFrames(position, dst, n);
+      fPlayFrame.store(position + n, std::memory_order_relaxed);
+      return got;
+   }
+
+   // wait (without blocking) for the producer to acknowledge our request
+   Sync();
+   if (!fSynced)
+      return 0;
+
+   const int got = (int)fRing.Read(dst, n);
+   fPlayFrame.store(fPlayFrame.load(std::memory_order_relaxed) + got, std::memory_order_relaxed);
+   return got;
+}
+
+void SampleStream::Service(int chunkFrames, float* staging)
+{
+   const unsigned gen = fRequestGen.load(std::memory_order_acquire);
+   if (gen != fServedGen)
+   {
+      const SampleZone* zone = fRequestZone.load(std::memory_order_relaxed);
+      const int64_t start = fRequestStart.load(std::memory_order_relaxed);
+
+      // the request changed while we read it, pick it up next time around
+      if (fRequestGen.load(std::memory_order_acquire) != gen)
+         return;
+
+      fServedGen = gen;
+      fServedZone = zone;
+      fNextFrame = start;
+
+      // everything written from here on belongs to the new request
+      fFillStart.store(fRing.WritePosition(), std::memory_order_relaxed);
+      fFillGen.store(gen, std::memory_order_release);
+   }
+
+   if (!fServedZone)
+      return;
+
+   const SampleFile& file = fServedZone->fFile;
+   if (fMapped)
+   {
+      file.Prefetch(fPlayFrame.load(std::memory_order_relaxed), (int)fRing.Capacity());
+      return;
+   }
+
+   while (fNextFrame < file.Frames() && fRing.WriteAvailable() >= (size_t)chunkFrames)
+   {
+      const int got = file.ReadFrames(fNextFrame, staging, chunkFrames);
+      fRing.Write(staging, got);
+      fNextFrame += got;
+
+      // stop filling for a stale request as soon as a new one arrives
+      if (fRequestGen.load(std::memory_order_relaxed) != fServedGen)
+         break;
+   }
+}
+
+//------ SampleLibrary ------//
+
+SampleLibrary::SampleLibrary(int streamMode, int preloadFrames, int maxVoices, int ringFrames)
+: fMode(streamMode)
+, fPreloadFrames(preloadFrames)
+, fStreamsInUse(0)
+, fUnderruns(0)
+, fRunning(true)
+{
+   for (int i = 0; i < maxVoices; ++i)
+   {
+      fStreams.push_back(new SampleStream(ringFrames, streamMode == kStreamMemoryMapped));
+   }
+
+   fThread = std::thread(&SampleLibrary::StreamThread, this);
+}
+
+SampleLibrary::~SampleLibrary()
+{
+   fRunning = false;
+   fThread.join();
+
+   for (size_t i = 0; i < fStreams.size(); ++i)
+   {
+      delete fStreams[i];
+   }
+   for (size_t i = 0; i < fZones.size(); ++i)
+   {
+      delete fZones[i];
+   }
+}
+
+bool SampleLibrary::AddZone(const std::string& path, int rootNote, int lowNote, int highNote,
+                            int lowVelocity, int highVelocity)
+{
+   SampleZone* zone = new SampleZone;
+   if (!zone->fFile.Open(path, fMode == kStreamMemoryMapped))
+   {
+      delete zone;
+      return false;
+   }
+
+   zone->fPreloadFrames = (int)std::min((int64_t)fPreloadFrames, zone->fFile.Frames());
+   zone->fPreload = new float[std::max(1, zone->fPreloadFrames)];
+   zone->fFile.ReadFrames(0, zone->fPreload, zone->fPreloadFrames);
+   zone->fRootNote = rootNote;
+   zone->fLowNote = lowNote;
+   zone->fHighNote = highNote;
+   zone->fLowVelocity = lowVelocity;
+   zone->fHighVelocity = highVelocity;
+
+   fZones.push_back(zone);
+   return true;
+}
+
+const SampleZone* SampleLibrary::FindZone(int note, int velocity) const
+{
+   for (size_t i = 0; i < fZones.size(); ++i)
+   {
+      if (fZones[i]->Contains(note, velocity))
+         return fZones[i];
+   }
+   return NULL;
+}
+
+SampleStream* SampleLibrary::AcquireStream()
+{
+   const int index = fStreamsInUse.fetch_add(1);
+   if (index >= (int)fStreams.size())
+   {
+      fStreamsInUse.fetch_sub(1);
+      return NULL;
+   }
+   return fStreams[index];
+}
+
+void SampleLibrary::StreamThread()
+{
+   float* staging = new float[kStreamChunkFrames];
+
+   while (fRunning.load())
+   {
+      for (size_t i = 0; i < fStreams.size(); ++i)
+      {
+         fStreams[i]->Service(kStreamChunkFrames, staging);
+      }
+
+      // a 32k ring lasts ~0.7s at 44.1k, so a couple of ms between passes
+      // leaves plenty of headroom
+      std::this_thread::sleep_for(std::chrono::milliseconds(2));
+   }
+
+   delete[] staging;
+}
+
+//------ SamplerVoice ------//
+
+SamplerVoice::SamplerVoice(SampleLibrary* library)
+: fLibrary(library)
+, fStream(library->AcquireStream())
+, fZone(NULL)
+, fInterpolator(Interpolator::kInterpolationTypeLinear)
+, fFetched(0)
+, fSourceFrame(0)
+, fEndPos(0)
+, fReadPos(0)
+, fRatio(1)
+, fNote(0)
+, fBend(0)
+, fGain(0)
+{
+   assert(fStream);
+   memset(fWindow, 0, sizeof(fWindow));
+
+   fEnvelope.SetADSR(0.f, 0.f, 1.f, 0.05f);
+}
+
+void SamplerVoice::NoteOn(int note, int velocity)
+{
+   Voice::NoteOn(note, velocity);
+
+   fZone = fLibrary->FindZone(note, velocity);
+   if (!fZone)
+   {
+      Finish();
+      return;
+   }
+
+   fNote = note;
+   UpdateRatio();
+
+   fFetched = 0;
+   fSourceFrame = 0;
+   fEndPos = INT64_MAX;
+   fReadPos = 0;
+   fGain = velocity / 127.f;
+
+   // the stream starts where the preload ends; the preload covers the
+   // streaming thread's latency
+   fStream->Start(fZone, fZone->fPreloadFrames);
+
+   fTotalRendered = 0;
+   fMax = 1;
+}
+
+void SamplerVoice::UpdateRatio()
+{
+   const Tuning* tuning = Tuning::GetInstance();
+   fBend = tuning->PitchBend(Channel());
+   fRatio = (double)tuning->Frequency(fNote, Channel()) / tuning->Frequency(fZone->fRootNote) * fZone->fFile.SampleRate() / AudioServer::GetInstance()->Fs();
+   fRatio = std::min(fRatio, (double)kMaxRatio);
+}
+
+void SamplerVoice::Finish()
+{
+   fZone = NULL;
+   fStream->Stop();
+   fTotalRendered = fMax;
+}
+
+void SamplerVoice::Fetch(float* dst, int n)
+{
+   const int64_t total = fZone->fFile.Frames();
+
+   int done = 0;
+   if (fSourceFrame < fZone->fPreloadFrames)
+   {
+      const int count = (int)std::min((int64_t)n, fZone->fPreloadFrames - fSourceFrame);
+      memcpy(dst, fZone->fPreload + fSourceFrame, count * sizeof(float));
+      fSourceFrame += count;
+      done = count;
+   }
+
+   if (done < n && fSourceFrame < total)
+   {
+      const int wanted = (int)std::min((int64_t)(n - done), total - fSourceFrame);
+      const int got = fStream->Read(dst + done, wanted);
+      fSourceFrame += got;
+      done += got;
+
+      if (got < wanted)
+      {
+         // the streaming thread fell behind; play silence rather than wait
+         fLibrary->CountUnderrun();
+      }
+   }
+
+   memset(dst + done, 0, (n - done) * sizeof(float));
+
+   if (fSourceFrame >= total && fEndPos == INT64_MAX)
+   {
+      // window position of the last real frame
+      fEndPos = fFetched + done;
+   }
+}
+
+void SamplerVoice::Render(float* buffer, int frames)
+{
+   if (!fZone)
+      return;
+
+   fInterpolator.SetQuality(QualityGovernor::GetInstance()->Quality());
+
+   if (Tuning::GetInstance()->PitchBend(Channel()) != fBend)
+      UpdateRatio();
+
+   // while the preload plays, so the stream has filled by the time it's read
+   fStream->Sync();
+
+   const double mask = kWindowSize - 1;
+   int done = 0;
+   while (done < frames)
+   {
+      const int n = std::min(frames - done, (int)kRenderChunk);
+
+      // make sure the window holds every frame this chunk interpolates from:
+      // Lagrange3's four taps run from the read position to three past it
+      const int64_t needed = (int64_t)(fReadPos + n * fRatio) + 4;
+      while (fFetched < needed)
+      {
+         const int start = (int)(fFetched & (kWindowSize - 1));
+         const int count = (int)std::min(needed - fFetched, (int64_t)(kWindowSize - start));
+         Fetch(fWindow + start, count);
+         fFetched += count;
+      }
+
+      const double whole = floor(fReadPos);
+      const double index = ((int64_t)whole & (int64_t)mask) + (fReadPos - whole);
+      fInterpolator.InterpolateBlock(fWindow, kWindowSize, index, fRatio, buffer + done, n);
+      fReadPos += n * fRatio;
+
+      float* out = buffer + done;
+      for (int i = 0; i < n; ++i)
+      {
+         out[i] *= fGain;
+      }
+      ApplyEnvelope(out, n);
+
+      done += n;
+
+      if (fReadPos >= fEndPos || fEnvelope.Idle())
+      {
+         Finish();
+         return;
+      }
+   }
+}
@@ -0,0 +1,269 @@
+#ifndef h_Sampler
+#define h_Sampler
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include "Poly.h"
+#include "Interpolators.h"
+#include "RingBuffer.h"
+
+// SampleFile
+// ----------------
+/// \brief Read-only access to the sample frames of a WAV file (16/24/32-bit PCM
+/// or 32-bit float, any channel count, mixed down to mono on read).
+///
+/// The file is either memory-mapped, in which case ReadFrames just converts
+/// from the mapping, or read with pread into a staging buffer.  In the latter
+/// case ReadFrames must only be called from one thread at a time.
+class SampleFile
+{
+public:
+   SampleFile();
+   ~SampleFile();
+
+   /// returns false if the file can't be opened or isn't a supported WAV
+   bool Open(const std::string& path, bool memoryMap);
+   void Close();
+
+   int64_t Frames() const { return fFrames; }
+   int Channels() const { return fChannels; }
+   float SampleRate() const { return fSampleRate; }
+   bool IsMapped() const { return fMap != NULL; }
+
+   /// Reads n frames starting at start.  Frames past the end read as 0.
+   /// Returns the number of frames that came from the file.
+   int ReadFrames(int64_t start, float* dst, int n) const;
+
+   /// Asks the OS to page in frames ahead of use (memory-mapped files only)
+   void Prefetch(int64_t start, int n) const;
+
+private:
+   SampleFile(const SampleFile&);
+   SampleFile& operator=(const SampleFile&);
+
+   bool ParseHeader();
+   void Convert(const unsigned char* bytes, float* dst, int n) const;
+
+   int fFd;
+   unsigned char* fMap;
+   size_t fMapSize;
+   int64_t fDataOffset;
+   int64_t fFrames;
+   int fChannels;
+   int fBytesPerSample;
+   bool fIsFloat;
+   float fSampleRate;
+
+   mutable unsigned char* fStaging;
+   mutable int fStagingFrames;
+};
+
+// SampleZone
+// ----------------
+/// \brief One sample in a library: the file, the key/velocity range it covers
+/// and the resident attack portion.
+///
+class SampleZone
+{
+public:
+   SampleZone();
+   ~SampleZone();
+
+   bool Contains(int note, int velocity) const
+   {
+      return note >= fLowNote && note <= fHighNote
+          && velocity >= fLowVelocity && velocity <= fHighVelocity;
+   }
+
+   SampleFile fFile;
+   float* fPreload;
+   int fPreloadFrames;
+   int fRootNote;
+   int fLowNote;
+   int fHighNote;
+   int fLowVelocity;
+   int fHighVelocity;
+};
+
+class SampleLibrary;
+
+// SampleStream
+// ----------------
+/// \brief Feeds one voice with the part of a sample that follows the preload.
+///
+/// The voice (consumer, audio thread) calls Start/Stop/Read.  The library's
+/// streaming thread (producer) fills the ring buffer from disk, or for
+/// memory-mapped libraries prefetches pages ahead of the play position while
+/// the voice reads the mapping directly.
+///
+/// Requests are handed over with generation counters, so Start never waits
+/// on the streaming thread: data written for an older request is skipped by
+/// seeking the read position to where the new request's data begins.  Start
+/// and Stop drop what is already in the ring, and the voice calls Sync every
+/// block, so the stale data is gone as soon as the request is acknowledged
+/// and the ring is free to fill while the preload plays.
+class SampleStream
+{
+public:
+   SampleStream(int ringFrames, bool memoryMapped);
+
+   // consumer side
+   void Start(const SampleZone* zone, int64_t startFrame);
+   void Stop();
+
+   /// Drops data written for older requests once the streaming thread has
+   /// acknowledged the current one
+   void Sync();
+
+   /// Reads up to n frames, returns the number read.  Fewer than n before the
+   /// end of the sample means the stream underran.
+   int Read(float* dst, int n);
+
+   // producer side
+   void Service(int chunkFrames, float* staging);
+
+private:
+   RingBuffer<float> fRing;
+   bool fMapped;
+
+   // request, written by the consumer
+   std::atomic<unsigned> fRequestGen;
+   std::atomic<const SampleZone*> fRequestZone;
+   std::atomic<int64_t> fRequestStart;
+
+   // acknowledgement, written by the producer
+   std::atomic<unsigned> fFillGen;
+   std::atomic<size_t> fFillStart;
+
+   // consumer's play position, read by the producer for prefetching
+   std::atomic<int64_t> fPlayFrame;
+
+   // consumer state
+   unsigned fGen;
+   bool fSynced;
+   const SampleZone* fZone;
+
+   // producer state
+   unsigned fServedGen;
+   const SampleZone* fServedZone;
+   int64_t fNextFrame;
+};
+
+// SampleLibrary
+// ----------------
+/// \brief A set of SampleZones plus the background thread that streams them.
+///
+/// Only the first PreloadFrames() of each zone are kept in memory; the rest
+/// is streamed per voice through a fixed-size ring, so resident memory is
+/// bounded by (zones * preload) + (voices * ring) regardless of library size.
+///
+/// Create the library, add zones, then create SamplerVoices (at most
+/// maxVoices) for a Poly.  The library must outlive its voices.
+class SampleLibrary
+{
+public:
+   enum StreamMode
+   {
+      kStreamFromDisk = 0,
+      kStreamMemoryMapped,
+
+      kNumStreamModes
+   };
+
+   SampleLibrary(int streamMode = kStreamFromDisk, int preloadFrames = 32768,
+                 int maxVoices = 64, int ringFrames = 32768);
+   ~SampleLibrary();
+
+   /// Loads a WAV file and its preload.  Not safe to call while voices play.
+   bool AddZone(const std::string& path, int rootNote, int lowNote = 0, int highNote = 127,
+                int lowVelocity = 1, int highVelocity = 127);
+
+   /// First zone covering note and velocity, or NULL
+   const SampleZone* FindZone(int note, int velocity) const;
+
+   /// Hands out one of the pre-allocated streams, NULL when all are taken
+   SampleStream* AcquireStream();
+
+   int Mode() const { return fMode; }
+   int PreloadFrames() const { return fPreloadFrames; }
+
+   /// number of blocks in which a voice ran out of streamed data
+   unsigned Underruns() const { return fUnderruns.load(); }
+   void CountUnderrun() { fUnderruns.fetch_add(1, std::memory_order_relaxed); }
+
+   enum
+   {
+      kStreamChunkFrames = 4096
+   };
+
+private:
+   void StreamThread();
+
+   int fMode;
+   int fPreloadFrames;
+   std::vector<SampleZone*> fZones;
+   std::vector<SampleStream*> fStreams;
+   std::atomic<int> fStreamsInUse;
+   std::atomic<unsigned> fUnderruns;
+
+   std::atomic<bool> fRunning;
+   std::thread fThread;
+};
+
+// SamplerVoice
+// ----------------
+/// \brief Plays zones from a SampleLibrary, repitched from the zone's root note.
+///
+/// Note-on only touches memory that is already resident (the zone preload),
+/// so its cost doesn't depend on the library size or on disk latency.
+///
+/// The voice envelope defaults to a 50ms release; the voice stops as soon as
+/// the envelope or the sample ends.
+class SamplerVoice : public Voice
+{
+public:
+   SamplerVoice(SampleLibrary* library);
+
+   void Render(float* buffer, int frames);
+
+   void NoteOn(int note, int velocity);
+
+   void SetInterpolationType(int type) { fInterpolator.SetType(type); }
+
+   enum
+   {
+      kWindowSize = 4096,
+      kRenderChunk = 256,
+      kMaxRatio = 8
+   };
+
+private:
+   void Fetch(float* dst, int n);
+   void Finish();
+   void UpdateRatio();
+
+   SampleLibrary* fLibrary;
+   SampleStream* fStream;
+   const SampleZone* fZone;
+
+   Interpolator fInterpolator;
+
+   // source frames are fetched into a circular window and resampled from there
+   float fWindow[kWindowSize];
+   int64_t fFetched;
+   int64_t fSourceFrame;
+   int64_t fEndPos;
+   double fReadPos;
+   double fRatio;
+
+   int fNote;
+   float fBend;  // the channel's pitch bend fRatio was computed with
+
+   float fGain;
+};
+
+#endif
@@ -0,0 +1,106 @@
+#include "ScratchArena.h"
+
+#include <algorithm>
+
+#include "AlignedMemory.h"
+
+static thread_local ScratchArena* sCurrentArena = NULL;
+
+ScratchArena::ScratchArena()
+: fChunk(0)
+, fOffset(0)
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+   Clear();
+}
+
+void ScratchArena::Clear()
+{
+   for (size_t i = 0; i < fChunks.size(); ++i)
+   {
+      MusKit::AlignedFree(fChunks[i].fData);
+   }
+   fChunks.clear();
+   fChunk = 0;
+   fOffset = 0;
+}
+
+void ScratchArena::Reserve(int maxFrames, int numBuffers)
+{
+   Clear();
+
+   Chunk chunk;
+   chunk.fSize = MusKit::RoundToCacheLine(maxFrames * sizeof(float)) * numBuffers;
+   chunk.fData = (char*)MusKit::AlignedAlloc(chunk.fSize);
+   fChunks.push_back(chunk);
+}
+
+float* ScratchArena::Acquire(int frames)
+{
+   const size_t bytes = MusKit::RoundToCacheLine(std::max(frames, 1) * sizeof(float));
+
+   if (fChunks.empty() || fOffset + bytes > fChunks[fChunk].fSize)
+   {
+      // Move on to the next chunk.  Nothing is borrowed from chunks past the
+      // current one, so a chunk that's too small can be replaced.
+      const size_t next = fChunks.empty() ? 0 : fChunk + 1;
+      if (next == fChunks.size() || fChunks[next].fSize < bytes)
+      {
+         const size_t size = std::max(bytes, fChunks.empty() ? bytes : fChunks[0].fSize);
+         Chunk chunk;
+         chunk.fData = (char*)MusKit::AlignedAlloc(size);
+         chunk.fSize = size;
+         if (next == fChunks.size())
+         {
+            fChunks.push_back(chunk);
+         }
+         else
+         {
+            MusKit::AlignedFree(fChunks[next].fData);
+            fChunks[next] = chunk;
+         }
+      }
+      fChunk = next;
+      fOffset = 0;
+   }
+
+   float* p = (float*)(fChunks[fChunk].fData + fOffset);
+   fOffset += bytes;
+   return p;
+}
+
+ScratchArena::Marker ScratchArena::Mark() const
+{
+   Marker mark;
+   mark.fChunk = fChunk;
+   mark.fOffset = fOffset;
+   return mark;
+}
+
+void ScratchArena::Release(const Marker& mark)
+{
+   fChunk = mark.fChunk;
+   fOffset = mark.fOffset;
+}
+
+ScratchArena* ScratchArena::Current()
+{
+   if (!sCurrentArena)
+   {
+      static thread_local ScratchArena sThreadArena;
+      if (sThreadArena.fChunks.empty())
+      {
+         sThreadArena.Reserve(4096, 16);
+      }
+      sCurrentArena = &sThreadArena;
+   }
+   return sCurrentArena;
+}
+
+void ScratchArena::Bind(ScratchArena* arena)
+{
+   sCurrentArena = arena;
+}
@@ -0,0 +1,112 @@
+#ifndef h_ScratchArena
+#define h_ScratchArena
+
+#include <vector>
+#include <cstddef>
+
+// ScratchArena
+// ----------------
+/// \brief Stack-like pool of cache-line aligned temporary buffers for render
+/// code.
+///
+/// Clients that need a temporary block while rendering borrow one with a
+/// ScratchBuffer instead of declaring `float tmp[frames]`: the memory is
+/// aligned for vector loads, doesn't grow the stack with the block size, and
+/// doesn't come from the heap.  Buffers are handed out by bumping an offset
+/// and given back in reverse order when the ScratchBuffer goes out of scope.
+///
+/// Each render thread has its own arena (see Current).  AudioServer owns the
+/// one for the audio callback and sizes it with SetMaxBlockSize before the
+/// stream starts.  If a graph nests deeper than the arena was sized for, a
+/// further chunk is allocated once and kept, so later blocks don't allocate.
+
+class ScratchArena
+{
+public:
+   ScratchArena();
+   ~ScratchArena();
+
+   enum
+   {
+      kDefaultBuffers = 64
+   };
+
+   /// Sizes the first chunk for numBuffers blocks of maxFrames.  Frees
+   /// everything, so don't call it while buffers are borrowed.
+   void Reserve(int maxFrames, int numBuffers = kDefaultBuffers);
+
+   struct Marker
+   {
+      size_t fChunk;
+      size_t fOffset;
+   };
+
+   /// Returns a cache-line aligned block of frames floats.  Contents are
+   /// undefined.
+   float* Acquire(int frames);
+
+   Marker Mark() const;
+
+   /// Gives back everything acquired since mark was taken
+   void Release(const Marker& mark);
+
+   /// Arena bound to the calling thread; a thread that hasn't bound one gets
+   /// a default-sized arena of its own
+   static ScratchArena* Current();
+
+   /// Makes arena the calling thread's current arena
+   static void Bind(ScratchArena* arena);
+
+private:
+   ScratchArena(const ScratchArena&);
+   ScratchArena& operator=(const ScratchArena&);
+
+   struct Chunk
+   {
+      char* fData;
+      size_t fSize;
+   };
+
+   void Clear();
+
+   std::vector<Chunk> fChunks;
+   size_t fChunk;
+   size_t fOffset;
+};
+
+// ScratchBuffer
+// ----------------
+/// \brief Borrows a buffer from the current thread's ScratchArena for the
+/// lifetime of the object.
+///
+///    ScratchBuffer tmp(frames);
+///    fInput->Process(tmp, frames);
+///
+class ScratchBuffer
+{
+public:
+   ScratchBuffer(int frames)
+   : fArena(ScratchArena::Current())
+   , fMark(fArena->Mark())
+   , fData(fArena->Acquire(frames))
+   {
+   }
+
+   ~ScratchBuffer()
+   {
+      fArena->Release(fMark);
+   }
+
+   float* Get() const { return fData; }
+   operator float*() const { return fData; }
+
+private:
+   ScratchBuffer(const ScratchBuffer&);
+   ScratchBuffer& operator=(const ScratchBuffer&);
+
+   ScratchArena* fArena;
+   ScratchArena::Marker fMark;
+   float* fData;
+};
+
+#endif
@@ -0,0 +1,184 @@
+#include "Sequencer.h"
+
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "Tuning.h"
+
+Sequencer::Sequencer(AudioClient* input, MidiClient* target)
+: fInput(input)
+, fTarget(target)
+, fFile(NULL)
+, fCursor(0)
+, fPlaying(false)
+, fStartPending(false)
+, fStartTime(0)
+, fPosition(0)
+{
+   memset(fHeld, 0, sizeof(fHeld));
+}
+
+void Sequencer::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+}
+
+void Sequencer::SetSequence(const MidiFile* file)
+{
+   Stop();
+
+   fFile = file;
+   fSampleTimes.clear();
+   fCursor = 0;
+   fPosition = 0;
+
+   if (fFile)
+   {
+      const double fs = AudioServer::GetInstance()->Fs();
+      const std::vector<MidiFile::TimedEvent>& events = fFile->Events();
+      fSampleTimes.reserve(events.size());
+      for (size_t i = 0; i < events.size(); ++i)
+      {
+         fSampleTimes.push_back((int64_t)floor(events[i].fTime * fs + 0.5));
+      }
+   }
+}
+
+void Sequencer::Play()
+{
+   if (!fPlaying)
+   {
+      fPlaying = true;
+      fStartPending = true;
+   }
+}
+
+void Sequencer::Stop()
+{
+   if (fPlaying && !fStartPending)
+      fPosition = AudioServer::GetInstance()->Time() - fStartTime;
+   fPlaying = false;
+   ReleaseHeldNotes();
+}
+
+void Sequencer::Locate(double seconds)
+{
+   const bool playing = fPlaying;
+   Stop();
+
+   fPosition = std::max((int64_t)0, (int64_t)floor(seconds * AudioServer::GetInstance()->Fs() + 0.5));
+   fCursor = std::lower_bound(fSampleTimes.begin(), fSampleTimes.end(), fPosition) - fSampleTimes.begin();
+
+   if (playing)
+      Play();
+}
+
+double Sequencer::Position() const
+{
+   int64_t position = fPosition;
+   if (fPlaying && !fStartPending)
+      position = AudioServer::GetInstance()->Time() - fStartTime;
+   return position / (double)AudioServer::GetInstance()->Fs();
+}
+
+void Sequencer::Render(float* buffer, int frames)
+{
+   const SampleTime now = AudioServer::GetInstance()->Time();
+
+   if (!fPlaying || !fFile)
+   {
+      RenderInput(buffer, 0, frames);
+      return;
+   }
+
+   if (fStartPending)
+   {
+      fStartTime = now - fPosition;
+      fStartPending = false;
+   }
+
+   const std::vector<MidiFile::TimedEvent>& events = fFile->Events();
+   const int64_t blockStart = now - fStartTime;
+
+   int done = 0;
+   while (done < frames)
+   {
+      // send everything due at or before this sample, with Time() there
+      {
+         AudioServer::SubBlock subBlock(done);
+         while (fCursor < fSampleTimes.size() && fSampleTimes[fCursor] <= blockStart + done)
+         {
+            Send(events[fCursor].fEvent);
+            ++fCursor;
+         }
+      }
+
+      int next = frames;
+      if (fCursor < fSampleTimes.size())
+         next = (int)std::min((int64_t)frames, fSampleTimes[fCursor] - blockStart);
+
+      RenderInput(buffer, done, next - done);
+      done = next;
+   }
+}
+
+void Sequencer::RenderInput(float* buffer, int offset, int frames)
+{
+   if (!fInput)
+   {
+      memset(buffer + offset, 0, frames * sizeof(float));
+      return;
+   }
+
+   AudioServer::SubBlock subBlock(offset);
+   fInput->Process(buffer + offset, frames);
+}
+
+void Sequencer::Send(const MidiEvent& event)
+{
+   if (event.IsChannelMessage())
+   {
+      if (event.fType == MidiEvent::kNoteOn)
+         fHeld[event.fChannel][event.fData1] = true;
+      else if (event.fType == MidiEvent::kNoteOff)
+         fHeld[event.fChannel][event.fData1] = false;
+   }
+
+   Dispatch(event);
+}
+
+void Sequencer::Dispatch(const MidiEvent& event)
+{
+   if (fTarget)
+   {
+      // the MidiServer applies bends itself on the other path
+      if (event.fType == MidiEvent::kPitchBend)
+         Tuning::GetInstance()->HandlePitchBend(event.fChannel, event.fValue);
+      fTarget->HandleEvent(event);
+   }
+   else
+      MidiServer::GetInstance()->HandleEvent(event);
+}
+
+void Sequencer::ReleaseHeldNotes()
+{
+   MidiEvent event;
+   event.fType = MidiEvent::kNoteOff;
+   for (int channel = 0; channel < MidiServer::kNumChannels; ++channel)
+   {
+      for (int note = 0; note < 128; ++note)
+      {
+         if (fHeld[channel][note])
+         {
+            event.fChannel = channel;
+            event.fData1 = note;
+            Dispatch(event);
+            fHeld[channel][note] = false;
+         }
+      }
+   }
+}
@@ -0,0 +1,82 @@
+#ifndef h_Sequencer
+#define h_Sequencer
+
+#include <stdint.h>
+#include <vector>
+
+#include "AudioClient.h"
+#include "MidiServer.h"
+#include "MidiFile.h"
+
+// Sequencer
+// ----------------
+/// \brief Plays a MidiFile in step with AudioServer::Time().
+///
+/// The sequencer is an AudioClient wrapped around the instrument it plays
+/// (its input).  Each render it splits the block at the sample of every
+/// event due in it, renders the input up to there as a sub-block (see
+/// AudioServer::SubBlock), sends the event and carries on, so notes start on
+/// the exact sample.  Event times are converted to samples once, at
+/// SetSequence, and the sequencer only walks that array.
+///
+/// Events go to the target's HandleEvent, or through the MidiServer's
+/// routing if there is no target.  Clients that aren't rendered under the
+/// sequencer receive events at the start of the block they fall in.
+///
+/// Play, Stop and Locate must be called with the AudioServer lock held (or
+/// before the stream starts), like other changes to a running graph.
+class Sequencer : public AudioClient
+{
+public:
+   Sequencer(AudioClient* input = NULL, MidiClient* target = NULL);
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+   /// Events go to target instead of the MidiServer.  Pitch bends still set
+   /// the Tuning's bend for their channel, as the MidiServer would.
+   void SetTarget(MidiClient* target) { fTarget = target; }
+
+   /// The file must outlive the sequencer (or the next SetSequence).  Stops.
+   void SetSequence(const MidiFile* file);
+
+   /// Starts from the current position at the next render
+   void Play();
+
+   /// Stops, sending note offs for every note still held
+   void Stop();
+
+   /// Moves to seconds from the start of the sequence
+   void Locate(double seconds);
+
+   bool Playing() const { return fPlaying; }
+
+   /// True once every event has been sent
+   bool Finished() const { return fCursor >= fSampleTimes.size(); }
+
+   /// Position in the sequence, in seconds
+   double Position() const;
+
+private:
+   void Send(const MidiEvent& event);
+   void Dispatch(const MidiEvent& event);
+   void ReleaseHeldNotes();
+   void RenderInput(float* buffer, int offset, int frames);
+
+   AudioClient* fInput;
+   MidiClient* fTarget;
+   const MidiFile* fFile;
+
+   std::vector<int64_t> fSampleTimes;
+   size_t fCursor;
+
+   bool fPlaying;
+   bool fStartPending;
+   SampleTime fStartTime;  // AudioServer::Time() at sample 0 of the sequence
+   int64_t fPosition;      // sample to resume from
+
+   bool fHeld[MidiServer::kNumChannels][128];
+};
+
+#endif
@@ -10,6 +10,10 @@
 #include "AudioServer.h"
 #include "MathHelpers.h"
 #include "Interpolators.h"
+#include "ParameterAPI.h"
+#include "ScratchArena.h"
+#include "RingBuffer.h"
+#include "Waveform.h"
 
 // Noise Source
 // ----------------
@@ -66,12 +70,7 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
-		float inputBuffer[frames];
-		AudioServer::GetInstance()->GetInput(inputBuffer, frames, fChannel);
-		for (int i = 0; i < frames; ++i)
-		{
-			buffer[i] = inputBuffer[i];
-		}
+		AudioServer::GetInstance()->GetInput(buffer, frames, fChannel);
 	}
 	
 private:
@@ -80,20 +79,30 @@ private:
 
 // SampleAccumulator
 // --------------------
-/// \brief Stores all samples that come in and provides access to them
+/// \brief Summarizes the samples that pass through it for waveform displays
 ///
-/// Stored buffer is cleared when accessed
+/// Every SamplesPerSummary() samples the audio thread pushes one
+/// WaveformSummary (min, max, mean square) into a wait-free ring.  One other
+/// thread reads them: a WaveformPyramid, or Get for the plain (max, min)
+/// pairs.  If the reader falls more than kRingSize summaries behind, new ones
+/// are dropped and counted in Dropped().
 ///
 class SampleAccumulator : public AudioClient
 {
 public:
+	enum
+	{
+		kRingSize = 1 << 14
+	};
+	
 	SampleAccumulator()
    : fSamplesPerPixel(12)
-   , fMinSample(0.f)
-   , fMaxSample(0.f)
+   , fRing(kRingSize)
+   , fDropped(0)
    , fCount(0)
-   , fThePeakBuffer(&fPeakBuffer)
+   , fInput(NULL)
 	{
+      Restart();
 	}
    
    ~SampleAccumulator()
@@ -107,76 +116,97 @@ public:
          return;
 
       fInput->Process(buffer, frames);
-      PeakBuffer* peakBuffer = fThePeakBuffer.load();
+      if (fCount == 0)
+         fSamplesPerSummary = fSamplesPerPixel;
+      
 		for (int i = 0; i < frames; ++i)
 		{
-         if (fCount >= (fSamplesPerPixel - 1))
+         const float x = buffer[i];
+         fMinSample = std::min(fMinSample, x);
+         fMaxSample = std::max(fMaxSample, x);
+         fSumSquares += x * x;
+         
+         if (++fCount >= fSamplesPerSummary)
          {
-            peakBuffer->push_back(std::make_pair(fMaxSample, fMinSample));
-            fMinSample = buffer[i];
-            fMaxSample = buffer[i];
-            fCount = 0;
-         }
-         else
-         {
-            if (buffer[i] > fMaxSample)
-            {
-               fMaxSample = buffer[i];
-            }
-            else if (buffer[i] < fMinSample)
-            {
-               fMinSample = buffer[i];
-            }
-            ++fCount;
+            WaveformSummary summary;
+            summary.fMin = fMinSample;
+            summary.fMax = fMaxSample;
+            summary.fMeanSquare = (float)(fSumSquares / fCount);
+            if (!fRing.Push(summary))
+               fDropped.fetch_add(1, std::memory_order_relaxed);
+            Restart();
          }
       }
    }
    
-   typedef std::pair<float, float> PeakSample;
+   typedef std::pair<float, float> PeakSample;  // max, min
    typedef std::deque<PeakSample> PeakBuffer;
    
+   /// Takes every summary written since the last call.  Allocates, so not
+   /// for the audio thread.
    PeakBuffer Get()
    {
       PeakBuffer samples;
-      if (fThePeakBuffer == &fPeakBuffer)
-      {
-         fThePeakBuffer = &fPeakBuffer2;
-         samples = fPeakBuffer;
-         fPeakBuffer.clear();
-
-      }
-      else
+      WaveformSummary summary;
+      while (fRing.Pop(summary))
       {
-         fThePeakBuffer = &fPeakBuffer;
-         samples = fPeakBuffer2;
-         fPeakBuffer2.clear();
+         samples.push_back(std::make_pair(summary.fMax, summary.fMin));
       }
       return samples;
    }
    
+   /// Reader side: takes up to n summaries, returns how many
+   size_t Read(WaveformSummary* summaries, size_t n)
+   {
+      return fRing.Read(summaries, n);
+   }
+   
    int GetSize() const
    {
-      return fThePeakBuffer.load()->size();
+      return (int)fRing.ReadAvailable();
    }
+   
+   unsigned long Dropped() const { return fDropped.load(std::memory_order_relaxed); }
     
    void SetInput(AudioClient* input)
    {
       fInput = input;
    }
+   
+   void Prepare(int maxFrames)
+   {
+      AudioClient::Prepare(maxFrames);
+      if (fInput)
+         fInput->Prepare(maxFrames);
+   }
 
+   /// Takes effect from the next summary
    void SetSamplesPerPixel(int samplesPerPixel)
    {
-      fSamplesPerPixel = samplesPerPixel;
+      fSamplesPerPixel = std::max(samplesPerPixel, 1);
    }
+   
+   int SamplesPerSummary() const { return fSamplesPerPixel; }
 
 private:
+   void Restart()
+   {
+      fSamplesPerSummary = fSamplesPerPixel;
+      fMinSample = HUGE_VALF;
+      fMaxSample = -HUGE_VALF;
+      fSumSquares = 0.0;
+      fCount = 0;
+   }
    
-   PeakBuffer fPeakBuffer;
-   PeakBuffer fPeakBuffer2;
-   std::atomic<PeakBuffer*> fThePeakBuffer;
-   int fSamplesPerPixel;
+   std::atomic<int> fSamplesPerPixel;
+   RingBuffer<WaveformSummary> fRing;
+   std::atomic<unsigned long> fDropped;
+   
+   // audio thread only
+   int fSamplesPerSummary;
    float fMinSample;
    float fMaxSample;
+   double fSumSquares;
    int fCount;
 
    AudioClient* fInput;
@@ -187,6 +217,11 @@ private:
 /// \brief Base class for oscillators.  Just a basic set of parameters to avoid
 /// code duplication.
 ///
+/// Frequency and gain can be bound to Parameters.  A bound oscillator takes
+/// the parameter's ModulatedValue at the start of every render, so under a
+/// ModMatrix (which renders in control-period sub-blocks) its routes are heard
+/// once per period.
+///
 class Oscillator : public AudioClient
 {
 public:
@@ -198,6 +233,8 @@ public:
    , fGainZ(0)
 	, fT(0)
    , fPhase(0)
+   , fFreqParameter(NULL)
+   , fGainParameter(NULL)
 	{
 	}
 	
@@ -217,8 +254,32 @@ public:
 	}
     
     float Freq() const { return fFreq; }
+   
+   /// NULL unbinds, leaving the last value
+   void SetFreqParameter(Parameter* p) { fFreqParameter = p; }
+   void SetGainParameter(Parameter* p) { fGainParameter = p; }
 	
 protected:
+   /// Takes the bound parameters' values.  Returns true if the frequency
+   /// changed, for oscillators that derive state from it.
+   bool ReadParameters()
+   {
+      if (fGainParameter)
+         fGain = fGainParameter->ModulatedValue();
+      
+      if (fFreqParameter)
+      {
+         // modulation may push it through 0; the oscillators need a period
+         const float freq = std::max(fFreqParameter->ModulatedValue(), 0.01f);
+         if (freq != fFreq)
+         {
+            fFreq = freq;
+            return true;
+         }
+      }
+      return false;
+   }
+   
 	float fFreq;
 	float fGain;
 	float fWidth;
@@ -228,6 +289,9 @@ protected:
    
    float fFreqZ;
    float fGainZ;
+   
+   Parameter* fFreqParameter;
+   Parameter* fGainParameter;
 };
 
 // SinOsc
@@ -246,6 +310,8 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
+		ReadParameters();
+		
 		const float fs = AudioServer::GetInstance()->Fs();
 		const int period = 1.f / fFreq * fs;
 		
@@ -287,11 +353,12 @@ public:
    
 	void Render(float* buffer, int frames)
 	{
+      ReadParameters();
       
 		const float fs = AudioServer::GetInstance()->Fs();
 		const int period = 1.f / fFreqZ * fs;
 		
-      float modBuffer[frames];
+      ScratchBuffer modBuffer(frames);
       fModOsc->Render(modBuffer, frames);
       
 		for (int i = 0; i < frames; ++i)
@@ -317,6 +384,10 @@ public:
       fModOsc->SetFreq(freq);
    }
    
+   /// Binds the modulation index and frequency, like SetGainParameter
+   void SetModIndexParameter(Parameter* p) { fModOsc->SetGainParameter(p); }
+   void SetModFreqParameter(Parameter* p) { fModOsc->SetFreqParameter(p); }
+   
 private:
    SinOsc *fModOsc;
 };
@@ -337,6 +408,8 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
+		ReadParameters();
+		
 		const float fs = AudioServer::GetInstance()->Fs();
 		
 		int period = 1.f / fFreq * fs;
@@ -374,6 +447,8 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
+		ReadParameters();
+		
 		const float fs = AudioServer::GetInstance()->Fs();
 		
 		int period = 1.f / fFreq * fs;
@@ -411,6 +486,8 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
+		ReadParameters();
+		
 		const float fs = AudioServer::GetInstance()->Fs();
 		
 		int period = 1.f / fFreq * fs;
@@ -436,12 +513,17 @@ public:
 ///
 /// Selection of square vs. saw unimplemented
 ///
+/// Below kQualityHigh only the lower half (kQualityMedium) or quarter
+/// (kQualityLow) of the partials are rendered.  Partials that drop out or
+/// come back are faded over one block.
+///
 class AdditiveSinOsc : public Oscillator
 {
 public:
 	AdditiveSinOsc(float freq = 440.f, float gain = 1.f, int order = 1)
 	: Oscillator(freq, gain)
 	, fOrder(order)
+	, fActive(order)
 	{
 		for (int i = 0; i < order; ++i)
 		{
@@ -466,20 +548,45 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
-		float tmp[frames];
+		if (ReadParameters())
+			SetFreq(fFreq);
 		
-		std::vector<SinOsc*>::iterator i;
-		for (i = fSinOscs.begin(); i != fSinOscs.end(); ++i)
+		ScratchBuffer tmp(frames);
+		
+		const int active = ActivePartials(QualityGovernor::GetInstance()->Quality());
+		const int sounding = std::max(active, fActive);
+		const float ramp = 1.f / frames;
+		
+		for (int p = 0; p < sounding; ++p)
 		{
 			memset(tmp, 0.f, frames * sizeof(float));
 			
-			(*i)->Render(tmp, frames);
+			fSinOscs[p]->Render(tmp, frames);
 			
-			for (int j = 0; j < frames; ++j)
+			if (p >= active) // dropped, fade out
 			{
-				buffer[j] += tmp[j];
+				for (int j = 0; j < frames; ++j)
+				{
+					buffer[j] += tmp[j] * (1.f - (j + 1) * ramp);
+				}
+			}
+			else if (p >= fActive) // restored, fade in
+			{
+				for (int j = 0; j < frames; ++j)
+				{
+					buffer[j] += tmp[j] * ((j + 1) * ramp);
+				}
+			}
+			else
+			{
+				for (int j = 0; j < frames; ++j)
+				{
+					buffer[j] += tmp[j];
+				}
 			}
 		}
+		
+		fActive = active;
 	}
 	
 	void SetFreq(float freq)
@@ -495,7 +602,18 @@ public:
 	}
 	
 private:
+	int ActivePartials(int quality) const
+	{
+		const int order = (int)fSinOscs.size();
+		if (quality <= QualityGovernor::kQualityLow)
+			return std::min(std::max(order / 4, 1), order);
+		if (quality < QualityGovernor::kQualityHigh)
+			return std::min(std::max(order / 2, 1), order);
+		return order;
+	}
+	
 	float fOrder;
+	int fActive;  // partials rendered last block
 	std::vector<SinOsc*> fSinOscs;
 };
 
@@ -530,6 +648,10 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{  
+      if (ReadParameters())
+         UpdateStep();
+      
+      fInterpolator.SetQuality(QualityGovernor::GetInstance()->Quality());
       for (int i = 0; i < frames; ++i)
       {
          buffer[i] = fInterpolator.Interpolate(fLookupTable, fReadIndex, fTableSize);
@@ -547,12 +669,17 @@ public:
 		const double fs = AudioServer::GetInstance()->Fs();
 		double period = 1.0 / fFreq * fs;
       std::cout << period << std::endl;
-      fStep = fTableSize / period;
+      UpdateStep();
 	}
    
    void SetInterpolationType(int type) { fInterpolator.SetType(type); }
 	
 private:
+   void UpdateStep()
+   {
+      fStep = fTableSize * fFreq / AudioServer::GetInstance()->Fs();
+   }
+   
 	int fTableSize;
    double fReadIndex;
    double fStep;
@@ -593,7 +720,7 @@ public:
 			}
 			else
 			{
-				float tmp[frames];
+				ScratchBuffer tmp(frames);
 				fB->Process(tmp, frames);
 				for (int i = 0; i < frames; ++i)
 				{
@@ -603,6 +730,15 @@ public:
 		}
 	}
 	
+	void Prepare(int maxFrames)
+	{
+		AudioClient::Prepare(maxFrames);
+		if (fA)
+			fA->Prepare(maxFrames);
+		if (fB)
+			fB->Prepare(maxFrames);
+	}
+	
 	void SetA(AudioClient* a)
 	{
 		fA = a;
@@ -640,7 +776,7 @@ public:
 	
 	void Render(float* buffer, int frames)
 	{
-		float tmp[frames];
+		ScratchBuffer tmp(frames);
 		memset(tmp, 0.f, frames * sizeof(float));
 		
 		std::vector<AudioClient*>::iterator i;
@@ -664,6 +800,17 @@ public:
 		fConst = val;
 	}
 	
+	void Prepare(int maxFrames)
+	{
+		AudioClient::Prepare(maxFrames);
+		
+		std::vector<AudioClient*>::iterator i;
+		for (i = fClients.begin(); i != fClients.end(); ++i)
+		{
+			(*i)->Prepare(maxFrames);
+		}
+	}
+	
 	void AddInput(AudioClient* c)
 	{
 		std::vector<AudioClient*>::iterator i = std::find(fClients.begin(), fClients.end(), c);
@@ -793,6 +940,13 @@ public:
 		fInput = in;
 	}
 	
+	void Prepare(int maxFrames)
+	{
+		AudioClient::Prepare(maxFrames);
+		if (fInput)
+			fInput->Prepare(maxFrames);
+	}
+	
 private:
 	AudioClient* fInput;
     void _updateCoefficient()
@@ -0,0 +1,510 @@
+#include "Spectral.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "MathHelpers.h"
+#include "ScratchArena.h"
+#include "chuck_fft.h"
+
+static inline float WrapPhase(float phase)
+{
+   while (phase > MusKit::PI)
+      phase -= 2 * MusKit::PI;
+   while (phase < -MusKit::PI)
+      phase += 2 * MusKit::PI;
+   return phase;
+}
+
+//------ SpectralFrame ------//
+
+SpectralFrame::SpectralFrame()
+: fData(NULL)
+, fSize(0)
+, fAmplitudeScale(1.f)
+{
+}
+
+SpectralFrame::~SpectralFrame()
+{
+   delete[] fData;
+}
+
+void SpectralFrame::SetSize(int fftSize)
+{
+   if (fftSize != fSize)
+   {
+      delete[] fData;
+      fData = new float[fftSize];
+      fSize = fftSize;
+   }
+   Clear();
+}
+
+float SpectralFrame::Re(int bin) const
+{
+   if (bin == 0)
+      return fData[0];
+   if (bin == fSize / 2)
+      return fData[1];
+   return fData[2 * bin];
+}
+
+float SpectralFrame::Im(int bin) const
+{
+   if (bin == 0 || bin == fSize / 2)
+      return 0.f;
+   return fData[2 * bin + 1];
+}
+
+void SpectralFrame::SetBin(int bin, float re, float im)
+{
+   if (bin == 0)
+   {
+      fData[0] = re;
+   }
+   else if (bin == fSize / 2)
+   {
+      fData[1] = re;
+   }
+   else
+   {
+      fData[2 * bin] = re;
+      fData[2 * bin + 1] = im;
+   }
+}
+
+float SpectralFrame::Magnitude(int bin) const
+{
+   const float re = Re(bin);
+   const float im = Im(bin);
+   return sqrtf(re * re + im * im);
+}
+
+float SpectralFrame::Phase(int bin) const
+{
+   return atan2f(Im(bin), Re(bin));
+}
+
+void SpectralFrame::SetPolar(int bin, float magnitude, float phase)
+{
+   SetBin(bin, magnitude * cosf(phase), magnitude * sinf(phase));
+}
+
+void SpectralFrame::Clear()
+{
+   if (fData)
+      memset(fData, 0, fSize * sizeof(float));
+}
+
+void SpectralFrame::CopyFrom(const SpectralFrame& other)
+{
+   assert(other.fSize == fSize);
+   memcpy(fData, other.fData, fSize * sizeof(float));
+   fAmplitudeScale = other.fAmplitudeScale;
+}
+
+//------ STFT ------//
+
+STFT::STFT(AudioClient* input, int fftSize, int hop, int windowType)
+: fInput(input)
+, fSidechain(NULL)
+, fFFTSize(0)
+, fHop(0)
+, fWindowType(windowType)
+, fRover(0)
+, fNormalize(1.f)
+, fWindow(NULL)
+, fInFifo(NULL)
+, fSidechainFifo(NULL)
+, fOutFifo(NULL)
+, fOutAccum(NULL)
+{
+   Configure(fftSize, hop, windowType);
+}
+
+STFT::~STFT()
+{
+   Free();
+}
+
+void STFT::Free()
+{
+   delete[] fWindow;
+   delete[] fInFifo;
+   delete[] fSidechainFifo;
+   delete[] fOutFifo;
+   delete[] fOutAccum;
+   fWindow = fInFifo = fSidechainFifo = fOutFifo = fOutAccum = NULL;
+}
+
+void STFT::Configure(int fftSize, int hop, int windowType)
+{
+   assert(fftSize > 0 && (fftSize & (fftSize - 1)) == 0);
+   assert(hop > 0 && fftSize % hop == 0);
+
+   Free();
+
+   fFFTSize = fftSize;
+   fHop = hop;
+   fWindowType = windowType;
+   fRover = fftSize - hop;
+
+   fWindow = new float[fftSize];
+   fInFifo = new float[fftSize];
+   fSidechainFifo = new float[fftSize];
+   fOutFifo = new float[hop];
+   fOutAccum = new float[fftSize];
+   memset(fInFifo, 0, fftSize * sizeof(float));
+   memset(fSidechainFifo, 0, fftSize * sizeof(float));
+   memset(fOutFifo, 0, hop * sizeof(float));
+   memset(fOutAccum, 0, fftSize * sizeof(float));
+
+   const WindowTable* table = WindowTableCache::GetInstance()->getTable(windowType, fftSize);
+   memcpy(fWindow, table->getData(), fftSize * sizeof(float));
+   float windowSum = 0.f;
+   for (int i = 0; i < fftSize; ++i)
+   {
+      windowSum += fWindow[i];
+   }
+
+   // the same window is used for analysis and synthesis, so the overlapped
+   // sum of squared windows is what has to be normalized away
+   double overlapSum = 0.0;
+   for (int i = 0; i < fftSize; ++i)
+   {
+      overlapSum += fWindow[i] * fWindow[i];
+   }
+   overlapSum /= hop;
+   fNormalize = overlapSum > 0.0 ? (float)(1.0 / overlapSum) : 1.f;
+
+   fFrame.SetSize(fftSize);
+   fSidechainFrame.SetSize(fftSize);
+   const float scale = windowSum > 0.f ? 2.f * fftSize / windowSum : 1.f;
+   fFrame.SetAmplitudeScale(scale);
+   fSidechainFrame.SetAmplitudeScale(scale);
+
+   const float fs = AudioServer::GetInstance()->Fs();
+   std::vector<SpectralProcessor*>::iterator i;
+   for (i = fProcessors.begin(); i != fProcessors.end(); ++i)
+   {
+      (*i)->Prepare(fFFTSize, fHop, fs);
+   }
+}
+
+void STFT::AddProcessor(SpectralProcessor* p)
+{
+   std::vector<SpectralProcessor*>::iterator i = std::find(fProcessors.begin(), fProcessors.end(), p);
+   if (i == fProcessors.end())
+   {
+      p->Prepare(fFFTSize, fHop, AudioServer::GetInstance()->Fs());
+      fProcessors.push_back(p);
+   }
+}
+
+void STFT::RemoveProcessor(SpectralProcessor* p)
+{
+   std::vector<SpectralProcessor*>::iterator i = std::find(fProcessors.begin(), fProcessors.end(), p);
+   if (i != fProcessors.end())
+   {
+      fProcessors.erase(i);
+   }
+}
+
+void STFT::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+   if (fSidechain)
+      fSidechain->Prepare(maxFrames);
+}
+
+void STFT::Render(float* buffer, int frames)
+{
+   if (!fInput)
+      return;
+
+   fInput->Process(buffer, frames);
+
+   ScratchBuffer sidechain(fSidechain ? frames : 0);
+   if (fSidechain)
+   {
+      fSidechain->Process(sidechain, frames);
+   }
+
+   // fifo positions below start hold samples already consumed by earlier hops
+   const int start = fFFTSize - fHop;
+   int done = 0;
+   while (done < frames)
+   {
+      const int n = std::min(frames - done, fFFTSize - fRover);
+
+      memcpy(fInFifo + fRover, buffer + done, n * sizeof(float));
+      if (fSidechain)
+         memcpy(fSidechainFifo + fRover, sidechain + done, n * sizeof(float));
+      memcpy(buffer + done, fOutFifo + fRover - start, n * sizeof(float));
+
+      fRover += n;
+      done += n;
+
+      if (fRover == fFFTSize)
+      {
+         ProcessHop();
+         fRover = start;
+      }
+   }
+}
+
+void STFT::Analyze(const float* fifo, SpectralFrame& frame)
+{
+   float* data = frame.Data();
+   for (int i = 0; i < fFFTSize; ++i)
+   {
+      data[i] = fifo[i] * fWindow[i];
+   }
+   rfft(data, fFFTSize / 2, FFT_FORWARD);
+}
+
+void STFT::ProcessHop()
+{
+   Analyze(fInFifo, fFrame);
+
+   const SpectralFrame* sidechain = NULL;
+   if (fSidechain)
+   {
+      Analyze(fSidechainFifo, fSidechainFrame);
+      sidechain = &fSidechainFrame;
+   }
+
+   std::vector<SpectralProcessor*>::iterator p;
+   for (p = fProcessors.begin(); p != fProcessors.end(); ++p)
+   {
+      (*p)->ProcessFrame(fFrame, sidechain);
+   }
+
+   float* data = fFrame.Data();
+   rfft(data, fFFTSize / 2, FFT_INVERSE);
+
+   const float norm = fNormalize;
+   for (int i = 0; i < fFFTSize; ++i)
+   {
+      fOutAccum[i] += data[i] * fWindow[i] * norm;
+   }
+
+   const int remain = fFFTSize - fHop;
+   memcpy(fOutFifo, fOutAccum, fHop * sizeof(float));
+   memmove(fOutAccum, fOutAccum + fHop, remain * sizeof(float));
+   memset(fOutAccum + remain, 0, fHop * sizeof(float));
+   memmove(fInFifo, fInFifo + fHop, remain * sizeof(float));
+   if (fSidechain)
+      memmove(fSidechainFifo, fSidechainFifo + fHop, remain * sizeof(float));
+}
+
+//------ SpectralGate ------//
+
+void SpectralGate::ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain)
+{
+   // compare squared magnitudes to avoid a sqrt per bin
+   const float threshold = fThreshold / frame.AmplitudeScale();
+   const float threshold2 = threshold * threshold;
+   const int numBins = frame.NumBins();
+   for (int bin = 0; bin < numBins; ++bin)
+   {
+      const float re = frame.Re(bin);
+      const float im = frame.Im(bin);
+      if (re * re + im * im < threshold2)
+      {
+         frame.SetBin(bin, re * fFloor, im * fFloor);
+      }
+   }
+}
+
+//------ SpectralFreeze ------//
+
+SpectralFreeze::SpectralFreeze()
+: fNumBins(0)
+, fFrozen(false)
+, fCaptured(false)
+, fMagnitude(NULL)
+, fPhase(NULL)
+, fLastPhase(NULL)
+, fPhaseAdvance(NULL)
+{
+}
+
+SpectralFreeze::~SpectralFreeze()
+{
+   delete[] fMagnitude;
+   delete[] fPhase;
+   delete[] fLastPhase;
+   delete[] fPhaseAdvance;
+}
+
+void SpectralFreeze::Prepare(int fftSize, int hop, float fs)
+{
+   delete[] fMagnitude;
+   delete[] fPhase;
+   delete[] fLastPhase;
+   delete[] fPhaseAdvance;
+
+   fNumBins = fftSize / 2 + 1;
+   fMagnitude = new float[fNumBins];
+   fPhase = new float[fNumBins];
+   fLastPhase = new float[fNumBins];
+   fPhaseAdvance = new float[fNumBins];
+   memset(fLastPhase, 0, fNumBins * sizeof(float));
+
+   memset(fPhaseAdvance, 0, fNumBins * sizeof(float));
+   fExpected = 2 * MusKit::PI * hop / (float)fftSize;
+   fCaptured = false;
+}
+
+void SpectralFreeze::ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain)
+{
+   if (!fFrozen)
+   {
+      // track each bin's phase advance so it is known at the moment we freeze
+      for (int bin = 0; bin < fNumBins; ++bin)
+      {
+         const float phase = frame.Phase(bin);
+         const float expected = bin * fExpected;
+         fPhaseAdvance[bin] = WrapPhase(phase - fLastPhase[bin] - expected) + expected;
+         fLastPhase[bin] = phase;
+      }
+      fCaptured = false;
+      return;
+   }
+
+   if (!fCaptured)
+   {
+      for (int bin = 0; bin < fNumBins; ++bin)
+      {
+         fMagnitude[bin] = frame.Magnitude(bin);
+         fPhase[bin] = fLastPhase[bin];
+      }
+      fCaptured = true;
+   }
+
+   for (int bin = 0; bin < fNumBins; ++bin)
+   {
+      fPhase[bin] = WrapPhase(fPhase[bin] + fPhaseAdvance[bin]);
+      frame.SetPolar(bin, fMagnitude[bin], fPhase[bin]);
+   }
+}
+
+//------ CrossSynthesis ------//
+
+void CrossSynthesis::ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain)
+{
+   if (!sidechain)
+      return;
+
+   const int numBins = frame.NumBins();
+   for (int bin = 0; bin < numBins; ++bin)
+   {
+      const float carrier = frame.Magnitude(bin);
+      const float modulator = sidechain->Magnitude(bin);
+      const float target = carrier + fAmount * (modulator - carrier);
+      const float gain = carrier > 1e-12f ? target / carrier : 0.f;
+      frame.SetBin(bin, frame.Re(bin) * gain, frame.Im(bin) * gain);
+   }
+}
+
+//------ SpectralPitchShift ------//
+
+SpectralPitchShift::SpectralPitchShift(float ratio)
+: fRatio(ratio)
+, fNumBins(0)
+, fExpected(0.f)
+, fLastPhase(NULL)
+, fSumPhase(NULL)
+, fAnaMagnitude(NULL)
+, fAnaFreq(NULL)
+, fSynMagnitude(NULL)
+, fSynFreq(NULL)
+{
+}
+
+SpectralPitchShift::~SpectralPitchShift()
+{
+   Free();
+}
+
+void SpectralPitchShift::Free()
+{
+   delete[] fLastPhase;
+   delete[] fSumPhase;
+   delete[] fAnaMagnitude;
+   delete[] fAnaFreq;
+   delete[] fSynMagnitude;
+   delete[] fSynFreq;
+   fLastPhase = fSumPhase = fAnaMagnitude = fAnaFreq = fSynMagnitude = fSynFreq = NULL;
+}
+
+void SpectralPitchShift::Prepare(int fftSize, int hop, float fs)
+{
+   Free();
+
+   fNumBins = fftSize / 2 + 1;
+   fExpected = 2 * MusKit::PI * hop / (float)fftSize;
+   fLastPhase = new float[fNumBins];
+   fSumPhase = new float[fNumBins];
+   fAnaMagnitude = new float[fNumBins];
+   fAnaFreq = new float[fNumBins];
+   fSynMagnitude = new float[fNumBins];
+   fSynFreq = new float[fNumBins];
+   memset(fLastPhase, 0, fNumBins * sizeof(float));
+   memset(fSumPhase, 0, fNumBins * sizeof(float));
+}
+
+void SpectralPitchShift::ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain)
+{
+   if (fRatio == 1.f)
+   {
+      // pass through, but keep the phases current so that moving the ratio
+      // away from 1 carries on from this frame: unshifted, the synthesis
+      // phase is the analysis phase
+      for (int bin = 0; bin < fNumBins; ++bin)
+      {
+         const float phase = frame.Phase(bin);
+         fLastPhase[bin] = phase;
+         fSumPhase[bin] = phase;
+      }
+      return;
+   }
+
+   // analysis: true frequency of each bin, in units of bins
+   const float binsPerRadian = 1.f / fExpected;
+   for (int bin = 0; bin < fNumBins; ++bin)
+   {
+      const float phase = frame.Phase(bin);
+      const float delta = WrapPhase(phase - fLastPhase[bin] - bin * fExpected);
+      fLastPhase[bin] = phase;
+      fAnaMagnitude[bin] = frame.Magnitude(bin);
+      fAnaFreq[bin] = bin + delta * binsPerRadian;
+   }
+
+   // shift
+   memset(fSynMagnitude, 0, fNumBins * sizeof(float));
+   memset(fSynFreq, 0, fNumBins * sizeof(float));
+   for (int bin = 0; bin < fNumBins; ++bin)
+   {
+      const int target = (int)(bin * fRatio + 0.5f);
+      if (target < fNumBins)
+      {
+         fSynMagnitude[target] += fAnaMagnitude[bin];
+         fSynFreq[target] = fAnaFreq[bin] * fRatio;
+      }
+   }
+
+   // synthesis: accumulate phase at the shifted frequencies
+   for (int bin = 0; bin < fNumBins; ++bin)
+   {
+      fSumPhase[bin] = WrapPhase(fSumPhase[bin] + fSynFreq[bin] * fExpected);
+      frame.SetPolar(bin, fSynMagnitude[bin], fSumPhase[bin]);
+   }
+}
@@ -0,0 +1,239 @@
+#ifndef h_Spectral
+#define h_Spectral
+
+#include <vector>
+
+#include "AudioClient.h"
+#include "WindowFunction.h"
+
+// SpectralFrame
+// ----------------
+/// \brief One frame of STFT data, laid out the way chuck_fft's rfft leaves it:
+/// data[0] is the DC bin, data[1] is the (real) Nyquist bin and bins 1..N/2-1
+/// follow as interleaved re/im pairs.
+///
+/// Frames are allocated once by STFT::Configure and handed to processors by
+/// reference, so processors must never hold on to a frame between calls.
+class SpectralFrame
+{
+public:
+   SpectralFrame();
+   ~SpectralFrame();
+
+   // allocates storage, not safe to call from the audio thread
+   void SetSize(int fftSize);
+
+   int Size() const { return fSize; }
+   int NumBins() const { return fSize / 2 + 1; }
+
+   float* Data() { return fData; }
+   const float* Data() const { return fData; }
+
+   float Re(int bin) const;
+   float Im(int bin) const;
+   void SetBin(int bin, float re, float im);
+
+   float Magnitude(int bin) const;
+   float Phase(int bin) const;
+   void SetPolar(int bin, float magnitude, float phase);
+
+   /// Multiply a bin magnitude by this to get the amplitude of the sinusoid
+   /// which produced it (accounts for fft scaling and window gain)
+   float AmplitudeScale() const { return fAmplitudeScale; }
+   void SetAmplitudeScale(float scale) { fAmplitudeScale = scale; }
+
+   void Clear();
+   void CopyFrom(const SpectralFrame& other);
+
+private:
+   SpectralFrame(const SpectralFrame&);
+   SpectralFrame& operator=(const SpectralFrame&);
+
+   float* fData;
+   int fSize;
+   float fAmplitudeScale;
+};
+
+// SpectralProcessor
+// ----------------
+/// \brief Interface for anything that modifies STFT frames in place.
+///
+/// Prepare is called from STFT::Configure (or AddProcessor) and is the only
+/// place a processor may allocate.  ProcessFrame runs on the audio thread once
+/// per hop.  sidechain is the matching frame of the STFT's sidechain input, or
+/// NULL when no sidechain is connected.
+class SpectralProcessor
+{
+public:
+   virtual ~SpectralProcessor() {}
+
+   virtual void Prepare(int fftSize, int hop, float fs) {}
+
+   virtual void ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain) = 0;
+};
+
+// STFT
+// ----------------
+/// \brief Streaming overlap-add analysis/resynthesis.
+///
+/// Input is windowed with a table from WindowTableCache, transformed, passed through
+/// each registered SpectralProcessor in order, inverse transformed and
+/// overlap-added with the same window.  Output is delayed by Latency() samples.
+///
+/// fftSize must be a power of 2 and hop must divide fftSize.  Processors are
+/// not owned by the STFT.
+class STFT : public AudioClient
+{
+public:
+   STFT(AudioClient* input = NULL, int fftSize = 2048, int hop = 512,
+        int windowType = WindowFunction::kHann);
+   ~STFT();
+
+   // allocates, not safe to call from the audio thread
+   void Configure(int fftSize, int hop, int windowType);
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+   void SetSidechain(AudioClient* sidechain) { fSidechain = sidechain; }
+
+   void AddProcessor(SpectralProcessor* p);
+   void RemoveProcessor(SpectralProcessor* p);
+
+   int FFTSize() const { return fFFTSize; }
+   int Hop() const { return fHop; }
+   int Latency() const { return fFFTSize; }
+
+private:
+   void Free();
+   void ProcessHop();
+   void Analyze(const float* fifo, SpectralFrame& frame);
+
+   AudioClient* fInput;
+   AudioClient* fSidechain;
+   std::vector<SpectralProcessor*> fProcessors;
+
+   int fFFTSize;
+   int fHop;
+   int fWindowType;
+   int fRover;
+   float fNormalize;
+
+   float* fWindow;
+   float* fInFifo;
+   float* fSidechainFifo;
+   float* fOutFifo;
+   float* fOutAccum;
+
+   SpectralFrame fFrame;
+   SpectralFrame fSidechainFrame;
+};
+
+// SpectralGate
+// ----------------
+/// \brief Attenuates bins whose amplitude falls below a threshold
+///
+class SpectralGate : public SpectralProcessor
+{
+public:
+   SpectralGate(float threshold = 0.001f, float floor = 0.f)
+   : fThreshold(threshold)
+   , fFloor(floor)
+   {
+   }
+
+   void ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain);
+
+   /// threshold is a linear sinusoid amplitude (1.0 == full scale)
+   void SetThreshold(float threshold) { fThreshold = threshold; }
+
+   /// gain applied to gated bins
+   void SetFloor(float floor) { fFloor = floor; }
+
+private:
+   float fThreshold;
+   float fFloor;
+};
+
+// SpectralFreeze
+// ----------------
+/// \brief Captures the magnitudes of a frame and sustains them indefinitely,
+/// advancing each bin's phase at the rate measured when the freeze started.
+///
+class SpectralFreeze : public SpectralProcessor
+{
+public:
+   SpectralFreeze();
+   ~SpectralFreeze();
+
+   void Prepare(int fftSize, int hop, float fs);
+   void ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain);
+
+   void SetFrozen(bool frozen) { fFrozen = frozen; }
+   bool Frozen() const { return fFrozen; }
+
+private:
+   int fNumBins;
+   float fExpected;
+   bool fFrozen;
+   bool fCaptured;
+   float* fMagnitude;
+   float* fPhase;
+   float* fLastPhase;
+   float* fPhaseAdvance;
+};
+
+// CrossSynthesis
+// ----------------
+/// \brief Imposes the spectral envelope of the sidechain onto the input.
+///
+/// Each bin keeps the input's phase and takes a magnitude interpolated between
+/// the input and the sidechain by the amount parameter.
+class CrossSynthesis : public SpectralProcessor
+{
+public:
+   CrossSynthesis(float amount = 1.f)
+   : fAmount(amount)
+   {
+   }
+
+   void ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain);
+
+   void SetAmount(float amount) { fAmount = amount; }
+
+private:
+   float fAmount;
+};
+
+// SpectralPitchShift
+// ----------------
+/// \brief Phase vocoder pitch shifter.  Bins are moved by the shift ratio and
+/// resynthesized from their measured true frequencies.
+///
+class SpectralPitchShift : public SpectralProcessor
+{
+public:
+   SpectralPitchShift(float ratio = 1.f);
+   ~SpectralPitchShift();
+
+   void Prepare(int fftSize, int hop, float fs);
+   void ProcessFrame(SpectralFrame& frame, const SpectralFrame* sidechain);
+
+   void SetRatio(float ratio) { fRatio = ratio; }
+
+private:
+   void Free();
+
+   float fRatio;
+   int fNumBins;
+   float fExpected;
+   float* fLastPhase;
+   float* fSumPhase;
+   float* fAnaMagnitude;
+   float* fAnaFreq;
+   float* fSynMagnitude;
+   float* fSynFreq;
+};
+
+#endif
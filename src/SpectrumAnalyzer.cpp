@@ -0,0 +1,267 @@
+#include "SpectrumAnalyzer.h"
+
+#include <cmath>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+
+#include "AudioServer.h"
+#include "chuck_fft.h"
+
+// lowest level reported, in dB
+static const float kFloor = -200.f;
+
+SpectrumAnalyzer::SpectrumAnalyzer(AudioClient* input, int fftSize, int overlap, int windowType)
+: fInput(input)
+, fRing(kRingSize)
+, fDropped(0)
+, fFFTSize(0)
+, fHop(0)
+, fWindowType(windowType)
+, fNumBands(0)
+, fMinHz(20.f)
+, fMaxHz(20000.f)
+, fFs(44100.f)
+, fAveraging(0.2f)
+, fHoldSeconds(1.f)
+, fDecay(20.f)
+, fFifoFill(0)
+, fRunning(false)
+{
+   Configure(fftSize, overlap, windowType);
+}
+
+SpectrumAnalyzer::~SpectrumAnalyzer()
+{
+   Stop();
+}
+
+void SpectrumAnalyzer::Prepare(int maxFrames)
+{
+   AudioClient::Prepare(maxFrames);
+   if (fInput)
+      fInput->Prepare(maxFrames);
+
+   if (AudioServer::GetInstance()->Fs() != fFs)
+   {
+      Stop();
+      LayOutBands();
+      Start();
+   }
+}
+
+void SpectrumAnalyzer::Render(float* buffer, int frames)
+{
+   if (fInput)
+      fInput->Process(buffer, frames);
+
+   const size_t written = fRing.Write(buffer, frames);
+   if (written < (size_t)frames)
+      fDropped.fetch_add(frames - written, std::memory_order_relaxed);
+}
+
+void SpectrumAnalyzer::Configure(int fftSize, int overlap, int windowType)
+{
+   Stop();
+
+   fFFTSize = fftSize;
+   fHop = std::max(1, fftSize / std::max(overlap, 1));
+   fWindowType = windowType;
+
+   const WindowTable* table = WindowTableCache::GetInstance()->getTable(windowType, fftSize);
+   fWindow.assign(table->getData(), table->getData() + fftSize);
+   float windowSum = 0.f;
+   for (int i = 0; i < fftSize; ++i)
+   {
+      windowSum += fWindow[i];
+   }
+
+   fFrame.SetSize(fftSize);
+   fFrame.SetAmplitudeScale(windowSum > 0.f ? 2.f * fftSize / windowSum : 1.f);
+
+   // rfft sets up its constants on first use; do that here, not on two
+   // threads at once
+   fFrame.Clear();
+   rfft(fFrame.Data(), fftSize / 2, FFT_FORWARD);
+
+   fFifo.assign(fftSize, 0.f);
+   fFifoFill = 0;
+
+   LayOutBands();
+   Start();
+}
+
+void SpectrumAnalyzer::SetBands(int numBands, float minHz, float maxHz)
+{
+   Stop();
+   fNumBands = std::max(numBands, 0);
+   fMinHz = std::max(minHz, 1.f);
+   fMaxHz = std::max(maxHz, fMinHz * 1.01f);
+   LayOutBands();
+   Start();
+}
+
+void SpectrumAnalyzer::SetPeakHold(float holdSeconds, float decayDbPerSecond)
+{
+   fHoldSeconds.store(holdSeconds);
+   fDecay.store(decayDbPerSecond);
+}
+
+void SpectrumAnalyzer::LayOutBands()
+{
+   fFs = AudioServer::GetInstance()->Fs();
+   const float binsPerHz = fFFTSize / fFs;
+
+   fBands.clear();
+   if (fNumBands == 0)
+   {
+      for (int bin = 0; bin <= fFFTSize / 2; ++bin)
+      {
+         Band band;
+         band.fLow = band.fHigh = (float)bin;
+         band.fCentre = bin / binsPerHz;
+         fBands.push_back(band);
+      }
+   }
+   else
+   {
+      const float maxHz = std::min(fMaxHz, fFs / 2.f);
+      const float ratio = powf(maxHz / fMinHz, 1.f / fNumBands);
+      float low = fMinHz;
+      for (int b = 0; b < fNumBands; ++b)
+      {
+         const float high = low * ratio;
+         Band band;
+         band.fLow = low * binsPerHz;
+         band.fHigh = high * binsPerHz;
+         band.fCentre = sqrtf(low * high);
+         fBands.push_back(band);
+         low = high;
+      }
+   }
+
+   const size_t n = fBands.size();
+   fPower.assign(n, 0.f);
+   fPeak.assign(n, kFloor);
+   fPeakAge.assign(n, 0.f);
+
+   std::lock_guard<std::mutex> lock(fDisplayLock);
+   fDisplayLevels.assign(n, kFloor);
+   fDisplayPeaks.assign(n, kFloor);
+}
+
+int SpectrumAnalyzer::NumBands() const
+{
+   return (int)fBands.size();
+}
+
+float SpectrumAnalyzer::BandFrequency(int band) const
+{
+   return band >= 0 && band < (int)fBands.size() ? fBands[band].fCentre : 0.f;
+}
+
+int SpectrumAnalyzer::Read(float* levels, float* peaks, int n) const
+{
+   std::lock_guard<std::mutex> lock(fDisplayLock);
+   const int count = std::min(n, (int)fDisplayLevels.size());
+   if (levels)
+      memcpy(levels, &fDisplayLevels[0], count * sizeof(float));
+   if (peaks)
+      memcpy(peaks, &fDisplayPeaks[0], count * sizeof(float));
+   return (int)fDisplayLevels.size();
+}
+
+void SpectrumAnalyzer::Start()
+{
+   if (!fRunning.exchange(true))
+      fThread = std::thread(&SpectrumAnalyzer::Run, this);
+}
+
+void SpectrumAnalyzer::Stop()
+{
+   if (fRunning.exchange(false))
+      fThread.join();
+}
+
+void SpectrumAnalyzer::Run()
+{
+   while (fRunning.load())
+   {
+      while (fRing.ReadAvailable() > 0)
+      {
+         fFifoFill += (int)fRing.Read(&fFifo[fFifoFill], fFFTSize - fFifoFill);
+         if (fFifoFill == fFFTSize)
+         {
+            Analyze();
+            memmove(&fFifo[0], &fFifo[fHop], (fFFTSize - fHop) * sizeof(float));
+            fFifoFill -= fHop;
+         }
+      }
+
+      std::this_thread::sleep_for(std::chrono::milliseconds(kPollMilliseconds));
+   }
+}
+
+void SpectrumAnalyzer::Analyze()
+{
+   float* data = fFrame.Data();
+   for (int i = 0; i < fFFTSize; ++i)
+   {
+      data[i] = fFifo[i] * fWindow[i];
+   }
+   rfft(data, fFFTSize / 2, FFT_FORWARD);
+
+   const float scale = fFrame.AmplitudeScale();
+   const int lastBin = fFFTSize / 2;
+   const float hopSeconds = fHop / fFs;
+   const float averaging = fAveraging.load(std::memory_order_relaxed);
+   const float smoothing = averaging > 0.f ? 1.f - expf(-hopSeconds / averaging) : 1.f;
+   const float hold = fHoldSeconds.load(std::memory_order_relaxed);
+   const float fall = fDecay.load(std::memory_order_relaxed) * hopSeconds;
+
+   for (size_t b = 0; b < fBands.size(); ++b)
+   {
+      const Band& band = fBands[b];
+
+      // loudest bin in the band; a band narrower than a bin interpolates
+      float amplitude = 0.f;
+      const int first = (int)ceilf(band.fLow);
+      const int last = std::min((int)floorf(band.fHigh), lastBin);
+      if (first <= last)
+      {
+         for (int bin = first; bin <= last; ++bin)
+         {
+            amplitude = std::max(amplitude, fFrame.Magnitude(bin));
+         }
+      }
+      else
+      {
+         const float centre = 0.5f * (band.fLow + band.fHigh);
+         const int bin = std::min((int)centre, lastBin - 1);
+         const float t = centre - bin;
+         amplitude = (1.f - t) * fFrame.Magnitude(bin) + t * fFrame.Magnitude(bin + 1);
+      }
+      amplitude *= scale;
+
+      fPower[b] += smoothing * (amplitude * amplitude - fPower[b]);
+      const float level = fPower[b] > 0.f ? std::max(10.f * log10f(fPower[b]), kFloor) : kFloor;
+
+      fPeakAge[b] += hopSeconds;
+      if (level >= fPeak[b])
+      {
+         fPeak[b] = level;
+         fPeakAge[b] = 0.f;
+      }
+      else if (fPeakAge[b] > hold)
+      {
+         fPeak[b] = std::max(fPeak[b] - fall, level);
+      }
+   }
+
+   std::lock_guard<std::mutex> lock(fDisplayLock);
+   for (size_t b = 0; b < fBands.size(); ++b)
+   {
+      fDisplayLevels[b] = fPower[b] > 0.f ? std::max(10.f * log10f(fPower[b]), kFloor) : kFloor;
+      fDisplayPeaks[b] = fPeak[b];
+   }
+}
@@ -0,0 +1,125 @@
+#ifndef h_SpectrumAnalyzer
+#define h_SpectrumAnalyzer
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "AudioClient.h"
+#include "RingBuffer.h"
+#include "Spectral.h"
+#include "WindowFunction.h"
+
+// SpectrumAnalyzer
+// ----------------
+/// \brief Spectrum display tap: passes its input through and analyzes it on
+/// a background thread.
+///
+/// The audio thread only copies each block into a wait-free ring.  The
+/// analyzer thread drains it, takes a windowed FFT every fftSize / overlap
+/// samples and reduces it to display bands: the FFT bins themselves, or
+/// numBands log-spaced bands between two frequencies (SetBands).  Band
+/// levels are averaged over SetAveraging seconds, and a peak-hold trace
+/// holds each band's highest level for a while and then falls (SetPeakHold).
+///
+/// Read hands the UI a copy of the latest levels and peaks in dBFS, scaled
+/// so that a full-scale sinusoid reads 0 dB.  If the analyzer thread falls
+/// more than kRingSize samples behind, audio is dropped rather than the
+/// callback blocking.
+///
+/// Configure and SetBands reallocate; call them from the UI thread, not the
+/// audio thread.
+class SpectrumAnalyzer : public AudioClient
+{
+public:
+   enum
+   {
+      kRingSize = 1 << 16,
+      kPollMilliseconds = 10
+   };
+
+   SpectrumAnalyzer(AudioClient* input = NULL, int fftSize = 4096, int overlap = 4,
+                    int windowType = WindowFunction::kHann);
+   ~SpectrumAnalyzer();
+
+   void Render(float* buffer, int frames);
+   void Prepare(int maxFrames);
+
+   void SetInput(AudioClient* input) { fInput = input; }
+
+   /// fftSize must be a power of 2; overlap is FFTs per fftSize samples
+   void Configure(int fftSize, int overlap, int windowType);
+
+   /// numBands log-spaced bands from minHz to maxHz, or 0 for raw FFT bins
+   void SetBands(int numBands, float minHz = 20.f, float maxHz = 20000.f);
+
+   /// Time constant of the level averaging, 0 for none
+   void SetAveraging(float seconds) { fAveraging.store(seconds); }
+
+   /// Peaks hold for holdSeconds, then fall at decayDbPerSecond
+   void SetPeakHold(float holdSeconds, float decayDbPerSecond);
+
+   int NumBands() const;
+
+   /// Centre frequency of a band, in Hz
+   float BandFrequency(int band) const;
+
+   /// Copies up to n levels and peaks (either may be NULL), in dBFS.
+   /// Returns the number of bands.
+   int Read(float* levels, float* peaks, int n) const;
+
+   /// Samples dropped because the analyzer fell behind
+   unsigned long Dropped() const { return fDropped.load(std::memory_order_relaxed); }
+
+private:
+   struct Band
+   {
+      float fLow;   // in (fractional) FFT bins
+      float fHigh;
+      float fCentre;  // Hz
+   };
+
+   void Start();
+   void Stop();
+   void Run();
+   void Analyze();
+   void LayOutBands();
+
+   AudioClient* fInput;
+   RingBuffer<float> fRing;
+   std::atomic<unsigned long> fDropped;
+
+   // configuration, changed only with the thread stopped
+   int fFFTSize;
+   int fHop;
+   int fWindowType;
+   int fNumBands;
+   float fMinHz;
+   float fMaxHz;
+   float fFs;
+   std::vector<float> fWindow;
+   std::vector<Band> fBands;
+
+   std::atomic<float> fAveraging;
+   std::atomic<float> fHoldSeconds;
+   std::atomic<float> fDecay;
+
+   // analyzer thread
+   std::vector<float> fFifo;
+   int fFifoFill;
+   SpectralFrame fFrame;
+   std::vector<float> fPower;     // averaged, linear
+   std::vector<float> fPeak;      // dB
+   std::vector<float> fPeakAge;   // seconds since the peak was set
+
+   // published for Read
+   mutable std::mutex fDisplayLock;
+   std::vector<float> fDisplayLevels;
+   std::vector<float> fDisplayPeaks;
+
+   std::atomic<bool> fRunning;
+   std::thread fThread;
+};
+
+#endif
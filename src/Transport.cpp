@@ -0,0 +1,70 @@
+#include "Transport.h"
+
+Transport::Transport()
+: fSequence(0)
+, fPlayRequest(kRequestNone)
+, fTempoRequest(-1.0)
+, fLocateRequest(-1.0)
+, fSignatureRequest(0)
+{
+}
+
+void Transport::Locate(double beat)
+{
+   fLocateRequest.store(beat < 0.0 ? 0.0 : beat);
+}
+
+void Transport::SetTimeSignature(int beatsPerBar, int beatUnit)
+{
+   if (beatsPerBar > 0 && beatsPerBar < 256 && beatUnit > 0 && beatUnit < 256)
+      fSignatureRequest.store((beatsPerBar << 8) | beatUnit);
+}
+
+TransportState Transport::State() const
+{
+   TransportState state;
+   unsigned before, after;
+   do
+   {
+      before = fSequence.load(std::memory_order_acquire);
+      state = fPublished;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = fSequence.load(std::memory_order_relaxed);
+   }
+   while ((before & 1) || before != after);
+   return state;
+}
+
+void Transport::BeginBlock(SampleTime time, int frames, float fs)
+{
+   const int play = fPlayRequest.exchange(kRequestNone);
+   if (play != kRequestNone)
+      fState.fPlaying = (play == kRequestPlay);
+
+   const double tempo = fTempoRequest.exchange(-1.0);
+   if (tempo > 0.0)
+      fState.fTempo = tempo;
+
+   const double beat = fLocateRequest.exchange(-1.0);
+   if (beat >= 0.0)
+      fState.fBeat = beat;
+
+   const int signature = fSignatureRequest.exchange(0);
+   if (signature != 0)
+   {
+      fState.fBeatsPerBar = signature >> 8;
+      fState.fBeatUnit = signature & 0xFF;
+   }
+
+   fState.fTime = time;
+   fState.fFs = fs;
+
+   // odd sequence while writing, so readers know to retry
+   const unsigned sequence = fSequence.load(std::memory_order_relaxed);
+   fSequence.store(sequence + 1, std::memory_order_relaxed);
+   std::atomic_thread_fence(std::memory_order_release);
+   fPublished = fState;
+   fSequence.store(sequence + 2, std::memory_order_release);
+
+   fState.fBeat += frames * fState.BeatsPerSample();
+}
@@ -0,0 +1,94 @@
+#ifndef h_Transport
+#define h_Transport
+
+#include <atomic>
+
+#include "AudioClient.h"
+
+// TransportState
+// ----------------
+/// \brief Where the transport was at the start of a block.
+///
+/// Positions are in beats (quarter notes unless the time signature says
+/// otherwise) from the top of the song; bars count from 0.
+struct TransportState
+{
+   TransportState()
+   : fTime(0)
+   , fFs(44100.f)
+   , fPlaying(false)
+   , fTempo(120.0)
+   , fBeat(0.0)
+   , fBeatsPerBar(4)
+   , fBeatUnit(4)
+   {}
+
+   /// beats per sample while playing, 0 while stopped
+   double BeatsPerSample() const { return fPlaying ? fTempo / (60.0 * fFs) : 0.0; }
+
+   /// beat position offset samples into the block
+   double BeatAt(int offset) const { return fBeat + offset * BeatsPerSample(); }
+
+   int Bar() const { return (int)(fBeat / fBeatsPerBar); }
+   double BeatInBar() const { return fBeat - Bar() * (double)fBeatsPerBar; }
+
+   SampleTime fTime;  ///< AudioServer time of the block start
+   float fFs;
+   bool fPlaying;
+   double fTempo;     ///< beats per minute
+   double fBeat;
+   int fBeatsPerBar;
+   int fBeatUnit;
+};
+
+// Transport
+// ----------------
+/// \brief Tempo, song position and play state, advanced by the AudioServer
+/// once per block and published as a TransportState snapshot.
+///
+/// Any thread may call Play, Stop, Locate, SetTempo and SetTimeSignature.
+/// They only post a request; the audio thread applies it at the start of the
+/// next block, so a change lands on a block boundary and all clients see the
+/// same state for the whole block.
+///
+/// The snapshot is published through a sequence counter, so State() never
+/// blocks: on the audio thread it returns at once, and on other threads it
+/// retries in the rare case that it overlaps the publish.
+class Transport
+{
+public:
+   Transport();
+
+   void Play() { fPlayRequest.store(kRequestPlay); }
+   void Stop() { fPlayRequest.store(kRequestStop); }
+   void Locate(double beat);
+   void SetTempo(double bpm) { fTempoRequest.store(bpm); }
+   void SetTimeSignature(int beatsPerBar, int beatUnit);
+
+   /// The state at the start of the current (or last) block
+   TransportState State() const;
+
+   /// Audio thread: applies requests and publishes the state for the block
+   /// starting at time, then advances past it
+   void BeginBlock(SampleTime time, int frames, float fs);
+
+private:
+   enum
+   {
+      kRequestNone = 0,
+      kRequestPlay,
+      kRequestStop
+   };
+
+   TransportState fState;        // audio thread's working copy
+
+   TransportState fPublished;    // guarded by fSequence
+   std::atomic<unsigned> fSequence;
+
+   std::atomic<int> fPlayRequest;
+   std::atomic<double> fTempoRequest;  // < 0 for none
+   std::atomic<double> fLocateRequest; // < 0 for none
+   std::atomic<int> fSignatureRequest; // beatsPerBar << 8 | beatUnit, 0 for none
+};
+
+#endif
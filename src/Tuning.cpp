@@ -0,0 +1,384 @@
+#include "Tuning.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "AudioServer.h"
+
+Tuning* Tuning::sInstance = NULL;
+
+namespace
+{
+   const int kExp2Bits = 10;
+   const int kExp2Size = 1 << kExp2Bits;
+
+   /// 2^x via a table of 2^(i / kExp2Size) over one octave, interpolated
+   /// (error well under 0.01 cent)
+   float Exp2(float x)
+   {
+      struct Table
+      {
+         Table()
+         {
+            for (int i = 0; i <= kExp2Size; ++i)
+               fData[i] = (float)pow(2.0, (double)i / kExp2Size);
+         }
+         float fData[kExp2Size + 1];
+      };
+      static Table sTable;
+
+      const float octave = floorf(x);
+      const float position = (x - octave) * kExp2Size;
+      const int index = std::min((int)position, kExp2Size - 1);
+      const float frac = position - index;
+      const float* t = sTable.fData;
+      return ldexpf(t[index] + frac * (t[index + 1] - t[index]), (int)octave);
+   }
+
+   /// Next line that isn't a Scala comment, without line ending
+   bool ReadLine(std::istream& in, std::string& line)
+   {
+      while (std::getline(in, line))
+      {
+         if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+         if (line.empty() || line[0] != '!')
+            return true;
+      }
+      return false;
+   }
+
+   /// First whitespace-delimited word of the next non-comment line
+   bool ReadToken(std::istream& in, std::string& token)
+   {
+      std::string line;
+      while (ReadLine(in, line))
+      {
+         std::istringstream words(line);
+         if (words >> token)
+            return true;
+      }
+      return false;
+   }
+
+   bool ReadInt(std::istream& in, int& value)
+   {
+      std::string token;
+      if (!ReadToken(in, token))
+         return false;
+      char* end;
+      value = (int)strtol(token.c_str(), &end, 10);
+      return end != token.c_str();
+   }
+
+   /// A Scala pitch: cents if it has a '.', otherwise a ratio n/d or n
+   bool ParsePitch(const std::string& token, double& cents)
+   {
+      char* end;
+      if (token.find('.') != std::string::npos)
+      {
+         cents = strtod(token.c_str(), &end);
+         return end != token.c_str();
+      }
+
+      const double numerator = strtod(token.c_str(), &end);
+      double denominator = 1.0;
+      if (*end == '/')
+         denominator = strtod(end + 1, &end);
+      if (numerator <= 0.0 || denominator <= 0.0)
+         return false;
+
+      cents = 1200.0 * log2(numerator / denominator);
+      return true;
+   }
+
+   double EqualTempered(int note)
+   {
+      return 440.0 * pow(2.0, (note - 69) / 12.0);
+   }
+}
+
+Tuning::Mapping::Mapping()
+: fSize(0)
+, fFirstNote(0)
+, fLastNote(kNumNotes - 1)
+, fMiddleNote(60)
+, fReferenceNote(60)
+, fReferenceFrequency(EqualTempered(60))
+, fOctaveDegree(0)
+{
+}
+
+Tuning::Tuning()
+: fCurrent(0)
+, fDivisions(12)
+, fEqualReference(440.0)
+, fEqualReferenceNote(69)
+, fBendRange(2.f)
+{
+   memset(fTables, 0, sizeof(fTables));
+   for (int n = 0; n < kNumNotes; ++n)
+      fDetune[n] = 0.f;
+   for (int c = 0; c < kNumChannels; ++c)
+      fBend[c].store(0.f, std::memory_order_relaxed);
+
+   Rebuild();
+}
+
+void Tuning::SetEqualTemperament(int notesPerOctave, float referenceFrequency, int referenceNote)
+{
+   fScale.clear();
+   fMapping = Mapping();
+   fDivisions = std::max(notesPerOctave, 1);
+   fEqualReference = referenceFrequency;
+   fEqualReferenceNote = referenceNote;
+   Rebuild();
+}
+
+bool Tuning::LoadScale(const std::string& path)
+{
+   std::ifstream file(path.c_str());
+   if (!file)
+      return false;
+   return SetScale(file);
+}
+
+bool Tuning::SetScale(std::istream& scl)
+{
+   std::string description;
+   if (!ReadLine(scl, description))
+      return false;
+
+   int count;
+   if (!ReadInt(scl, count) || count < 0 || count > 1024)
+      return false;
+
+   std::vector<double> scale;
+   for (int i = 0; i < count; ++i)
+   {
+      std::string token;
+      double cents;
+      if (!ReadToken(scl, token) || !ParsePitch(token, cents))
+         return false;
+      scale.push_back(cents);
+   }
+
+   // a scale of no notes is just the octave
+   if (scale.empty())
+      scale.push_back(1200.0);
+
+   fScale.swap(scale);
+   Rebuild();
+   return true;
+}
+
+bool Tuning::LoadKeyboardMapping(const std::string& path)
+{
+   std::ifstream file(path.c_str());
+   if (!file)
+      return false;
+   return SetKeyboardMapping(file);
+}
+
+bool Tuning::SetKeyboardMapping(std::istream& kbm)
+{
+   Mapping mapping;
+
+   std::string frequency;
+   if (!ReadInt(kbm, mapping.fSize) ||
+       !ReadInt(kbm, mapping.fFirstNote) ||
+       !ReadInt(kbm, mapping.fLastNote) ||
+       !ReadInt(kbm, mapping.fMiddleNote) ||
+       !ReadInt(kbm, mapping.fReferenceNote) ||
+       !ReadToken(kbm, frequency) ||
+       !ReadInt(kbm, mapping.fOctaveDegree))
+   {
+      return false;
+   }
+
+   mapping.fReferenceFrequency = strtod(frequency.c_str(), NULL);
+   if (mapping.fSize < 0 || mapping.fReferenceFrequency <= 0.0)
+      return false;
+
+   for (int i = 0; i < mapping.fSize; ++i)
+   {
+      // trailing entries may be left out, and are unmapped
+      std::string token;
+      if (!ReadToken(kbm, token) || token[0] == 'x' || token[0] == 'X')
+         mapping.fKeys.push_back(-1);
+      else
+         mapping.fKeys.push_back(atoi(token.c_str()));
+   }
+
+   fMapping = mapping;
+   Rebuild();
+   return true;
+}
+
+void Tuning::SetDetune(int note, float cents)
+{
+   if (note >= 0 && note < kNumNotes)
+   {
+      fDetune[note] = cents;
+      Rebuild();
+   }
+}
+
+void Tuning::ClearDetune()
+{
+   for (int n = 0; n < kNumNotes; ++n)
+      fDetune[n] = 0.f;
+   Rebuild();
+}
+
+void Tuning::SetPitchBend(int channel, float semitones)
+{
+   if (channel >= 0 && channel < kNumChannels)
+      fBend[channel].store(semitones, std::memory_order_relaxed);
+}
+
+float Tuning::PitchBend(int channel) const
+{
+   if (channel >= 0 && channel < kNumChannels)
+      return fBend[channel].load(std::memory_order_relaxed);
+   return 0.f;
+}
+
+float Tuning::Frequency(int note) const
+{
+   note = std::min(std::max(note, 0), kNumNotes - 1);
+   return Current().fFrequency[note];
+}
+
+float Tuning::Frequency(float note) const
+{
+   const Table& table = Current();
+
+   note = std::min(std::max(note, 0.f), (float)(kNumNotes - 1));
+   const int index = std::min((int)note, kNumNotes - 2);
+   const float frac = note - index;
+   if (frac == 0.f)
+      return table.fFrequency[index];
+
+   const float pitch = table.fPitch[index] + frac * (table.fPitch[index + 1] - table.fPitch[index]);
+   return Exp2(pitch);
+}
+
+float Tuning::Increment(int note) const
+{
+   note = std::min(std::max(note, 0), kNumNotes - 1);
+   const Table& table = Current();
+   const float fs = AudioServer::GetInstance()->Fs();
+   if (fs == table.fFs)
+      return table.fIncrement[note];
+   return table.fFrequency[note] / fs;
+}
+
+float Tuning::Increment(float note) const
+{
+   return Frequency(note) / AudioServer::GetInstance()->Fs();
+}
+
+float Tuning::Pitch(int note) const
+{
+   note = std::min(std::max(note, 0), kNumNotes - 1);
+   return Current().fPitch[note];
+}
+
+double Tuning::DegreeCents(int degree) const
+{
+   const int size = (int)fScale.size();
+   const double period = fScale[size - 1];
+
+   // floor division, so degrees below 0 land in earlier periods
+   int periods = degree / size;
+   int step = degree % size;
+   if (step < 0)
+   {
+      step += size;
+      --periods;
+   }
+
+   return periods * period + (step == 0 ? 0.0 : fScale[step - 1]);
+}
+
+bool Tuning::NoteDegree(int note, int& degree) const
+{
+   if (note < fMapping.fFirstNote || note > fMapping.fLastNote)
+      return false;
+   return MapKey(note, degree);
+}
+
+bool Tuning::MapKey(int note, int& degree) const
+{
+   const int offset = note - fMapping.fMiddleNote;
+   if (fMapping.fSize == 0)
+   {
+      degree = offset;
+      return true;
+   }
+
+   int repeats = offset / fMapping.fSize;
+   int key = offset % fMapping.fSize;
+   if (key < 0)
+   {
+      key += fMapping.fSize;
+      --repeats;
+   }
+
+   if (fMapping.fKeys[key] < 0)
+      return false;
+
+   const int octaveDegree = fMapping.fOctaveDegree > 0 ? fMapping.fOctaveDegree : (int)fScale.size();
+   degree = repeats * octaveDegree + fMapping.fKeys[key];
+   return true;
+}
+
+void Tuning::Rebuild()
+{
+   const int next = 1 - fCurrent.load(std::memory_order_relaxed);
+   Table& table = fTables[next];
+
+   // cents of the reference note's degree, so that it sounds at the
+   // reference frequency (an unmapped reference counts as degree 0)
+   double referenceCents = 0.0;
+   if (!fScale.empty())
+   {
+      int degree = 0;
+      MapKey(fMapping.fReferenceNote, degree);
+      referenceCents = DegreeCents(degree);
+   }
+
+   for (int n = 0; n < kNumNotes; ++n)
+   {
+      double frequency;
+      int degree;
+      if (fScale.empty())
+      {
+         frequency = fEqualReference * pow(2.0, (double)(n - fEqualReferenceNote) / fDivisions);
+      }
+      else if (NoteDegree(n, degree))
+      {
+         frequency = fMapping.fReferenceFrequency * pow(2.0, (DegreeCents(degree) - referenceCents) / 1200.0);
+      }
+      else
+      {
+         frequency = EqualTempered(n);
+      }
+
+      frequency *= pow(2.0, fDetune[n] / 1200.0);
+
+      table.fFrequency[n] = (float)frequency;
+      table.fPitch[n] = (float)log2(frequency);
+   }
+
+   table.fFs = AudioServer::GetInstance()->Fs();
+   for (int n = 0; n < kNumNotes; ++n)
+      table.fIncrement[n] = table.fFrequency[n] / table.fFs;
+
+   fCurrent.store(next, std::memory_order_release);
+}
@@ -0,0 +1,155 @@
+#ifndef h_Tuning
+#define h_Tuning
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <istream>
+
+// Tuning
+// ----------------
+/// \brief Note number to frequency conversion by table lookup, for equal
+/// temperaments and Scala scales.
+///
+/// The tuning keeps, for each of the 128 MIDI notes, its frequency, its pitch
+/// in octaves (log2 of the frequency) and its phase increment in cycles per
+/// sample at the server's sample rate, so a voice's note on is a table read
+/// rather than a powf.  Fractional notes, per-note detune and per-channel
+/// (MPE) pitch bend interpolate between neighbouring notes' pitches, so bends
+/// follow the scale, and convert back to frequency through a small exp2
+/// table.
+///
+/// The default is 12-tone equal temperament with A4 (note 69) at 440Hz.
+/// LoadScale/LoadKeyboardMapping read Scala .scl/.kbm files; both have
+/// SetScale/SetKeyboardMapping versions that read from a stream.
+///
+/// Retuning builds a fresh set of tables and then swaps it in, so the audio
+/// thread may read while another thread retunes.  Retune from one thread at a
+/// time, and not more often than once per audio block.
+class Tuning
+{
+public:
+   enum
+   {
+      kNumNotes = 128,
+      kNumChannels = 16
+   };
+
+   static Tuning* GetInstance()
+   {
+      if (!sInstance)
+      {
+         sInstance = new Tuning;
+      }
+      return sInstance;
+   }
+
+   Tuning();
+
+   /// notesPerOctave equal divisions of the octave, with referenceNote at
+   /// referenceFrequency.  Clears any Scala scale and mapping.
+   void SetEqualTemperament(int notesPerOctave = 12, float referenceFrequency = 440.f, int referenceNote = 69);
+
+   /// Reads a Scala scale (.scl).  Returns false, leaving the tuning as it
+   /// was, if the file can't be read or parsed.
+   bool LoadScale(const std::string& path);
+   bool SetScale(std::istream& scl);
+
+   /// Reads a Scala keyboard mapping (.kbm).  Without one, a scale is mapped
+   /// linearly with degree 0 on middle C (note 60) at 261.63Hz.  Keys the
+   /// mapping leaves unmapped keep their 12-TET pitch.
+   bool LoadKeyboardMapping(const std::string& path);
+   bool SetKeyboardMapping(std::istream& kbm);
+
+   /// Offsets one note by cents, on top of the scale
+   void SetDetune(int note, float cents);
+   void ClearDetune();
+
+   /// Per-channel bend in semitones (of the scale, i.e. note numbers), for
+   /// MPE, where each sounding note has its own channel.  The MidiServer
+   /// sets it from every pitch bend message it dispatches (see
+   /// HandlePitchBend); voices that know their note's channel (FMSynth's,
+   /// SamplerVoice) look it up with the channel versions of Frequency and
+   /// Increment every block.  Karplus and the PolyBank kernels don't bend.
+   void SetPitchBend(int channel, float semitones);
+   float PitchBend(int channel) const;
+
+   /// Bend at full deflection, in semitones (2 by default; MPE controllers
+   /// usually send 48)
+   void SetPitchBendRange(float semitones) { fBendRange.store(semitones, std::memory_order_relaxed); }
+   float PitchBendRange() const { return fBendRange.load(std::memory_order_relaxed); }
+
+   /// Sets channel's bend from a pitch bend message value (-8192 to 8191)
+   void HandlePitchBend(int channel, int value) { SetPitchBend(channel, value * PitchBendRange() / 8192.f); }
+
+   float Frequency(int note) const;
+   float Frequency(float note) const;
+   float Frequency(int note, int channel) const { return Frequency(note + PitchBend(channel)); }
+
+   /// Cycles per sample at the server's sample rate
+   float Increment(int note) const;
+   float Increment(float note) const;
+   float Increment(int note, int channel) const { return Increment(note + PitchBend(channel)); }
+
+   /// Pitch in octaves, log2 of the frequency
+   float Pitch(int note) const;
+
+   /// Rebuilds the increment table after the sample rate changes (lookups are
+   /// still right before this, only slower)
+   void Refresh() { Rebuild(); }
+
+private:
+   struct Table
+   {
+      float fFrequency[kNumNotes];
+      float fPitch[kNumNotes];
+      float fIncrement[kNumNotes];
+      float fFs;
+   };
+
+   struct Mapping
+   {
+      Mapping();
+
+      int fSize;              // 0 for linear
+      int fFirstNote;
+      int fLastNote;
+      int fMiddleNote;        // where degree 0 is
+      int fReferenceNote;
+      double fReferenceFrequency;
+      int fOctaveDegree;      // degree spanning one repetition of the map
+      std::vector<int> fKeys; // degree per key, -1 unmapped
+   };
+
+   const Table& Current() const { return fTables[fCurrent.load(std::memory_order_acquire)]; }
+
+   /// Cents of scale degree, counted from degree 0, across periods
+   double DegreeCents(int degree) const;
+
+   /// Degree of note, false if unmapped or outside the mapped range
+   bool NoteDegree(int note, int& degree) const;
+
+   /// As NoteDegree, ignoring the mapped range
+   bool MapKey(int note, int& degree) const;
+
+   void Rebuild();
+
+   static Tuning* sInstance;
+
+   Table fTables[2];
+   std::atomic<int> fCurrent;
+
+   // scale: cents of degrees 1..n, the last being the period; empty for
+   // equal temperament
+   std::vector<double> fScale;
+   int fDivisions;
+   double fEqualReference;
+   int fEqualReferenceNote;
+   Mapping fMapping;
+
+   float fDetune[kNumNotes];
+   std::atomic<float> fBend[kNumChannels];
+   std::atomic<float> fBendRange;
+};
+
+#endif
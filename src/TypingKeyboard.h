@@ -1,6 +1,8 @@
 #ifndef h_TypingKeyboard
 #define h_TypingKeyboard
 
+#include "Tuning.h"
+
 /// \brief TypingKeyboard converts ascii characters to midi notes or frequency
 class TypingKeyboard
 {
@@ -146,11 +148,10 @@ public:
 	
 	float KeyToFrequency(char ascii)
 	{
-		const float c0 = 8.1757989156;
 		const int midiNote = KeyToMidiNote(ascii);
 		float f = 0;
 		if (midiNote != -1)
-			f = powf(2, midiNote/12.f)*c0;
+			f = Tuning::GetInstance()->Frequency(midiNote);
 		return f; 
 	}
 	
@@ -2,15 +2,20 @@
 #define h_Voices
 
 #include "Poly.h"
+#include "AlignedMemory.h"
 #include "MathHelpers.h"
 #include "AudioServer.h"
 #include "Interpolators.h"
+#include "Tuning.h"
 #include <cmath>
 #include <cassert>
+#include <algorithm>
 // Karplus
 // ----------------
 /// \brief Karplus-Strong string model
 ///
+/// The string rings for 100 periods; releasing the key fades it out with
+/// the voice envelope.
 class Karplus : public Voice
 {
 public:
@@ -25,6 +30,8 @@ public:
       memset(fBuffer, 0.f, fMaxSize * sizeof(float));
       fR = 0;
       fW = fBufferSize;
+      
+      fEnvelope.SetADSR(0.f, 0.f, 1.f, 0.2f);
    }
    
    ~Karplus()
@@ -46,6 +53,8 @@ public:
          
          ++fTotalRendered;
       }
+      
+      ApplyEnvelope(buffer, frames);
    }
 
    void NoteOn(int note, int velocity)
@@ -57,9 +66,7 @@ public:
    {
       Voice::NoteOn(note, velocity);
       
-      const float c0 = 8.1757989156;
-      float f = 0;
-      f = powf(2, note/12.f)*c0;
+      const float f = Tuning::GetInstance()->Frequency(note);
       
       fTotalRendered = 0;
       
@@ -76,13 +83,6 @@ public:
         this->Excite(buffer, bufferSize);
    }
    
-   void NoteOff()
-   {
-      Voice::NoteOff();
-      
-      fFeedback = 0.5;
-   }
-   
    void SetTime(float time)
    {
       const float fs = AudioServer::GetInstance()->Fs();
@@ -163,5 +163,118 @@ private:
    float fFeedback;
    float fGain;
 };
-   
+
+// KarplusKernel
+// ----------------
+/// \brief Karplus-Strong strings for a PolyBank: the same model as Karplus,
+/// with every voice's delay line and settings held in arrays.
+///
+/// Each lane reads and writes its own delay line, so the memory accesses in
+/// the lane loop are gathers and scatters; the filter and gain arithmetic
+/// around them vectorizes.
+class KarplusKernel
+{
+public:
+   enum
+   {
+      kLanes = 8,
+      kMaxVoices = 64,
+      kLineSize = 8192 // power of two, long enough for note 0 at 44.1kHz
+   };
+
+   KarplusKernel()
+   {
+      fLines = (float*)MusKit::AlignedAlloc(kMaxVoices * kLineSize * sizeof(float));
+      memset(fLines, 0, kMaxVoices * kLineSize * sizeof(float));
+      for (int v = 0; v < kMaxVoices; ++v)
+      {
+         fRead[v] = 0;
+         fLength[v] = 2;
+         fRemaining[v] = 0;
+         fFeedback[v] = 0.f;
+         fVelocity[v] = 0.f;
+      }
+   }
+
+   ~KarplusKernel()
+   {
+      MusKit::AlignedFree(fLines);
+   }
+
+   void Start(int v, int note, int velocity)
+   {
+      const float f = Tuning::GetInstance()->Frequency(note);
+
+      int length = AudioServer::GetInstance()->Fs() / f;
+      length = std::min(std::max(length, 2), (int)kLineSize - 1);
+
+      fLength[v] = length;
+      fRemaining[v] = length * 100;
+      fFeedback[v] = 0.99f;
+      fVelocity[v] = velocity / 127.f;
+
+      float* line = fLines + v * kLineSize;
+      for (int i = 0; i < length; ++i)
+      {
+         float R1 = (float) rand() / (float) RAND_MAX;
+         float R2 = (float) rand() / (float) RAND_MAX;
+
+         line[(fRead[v] + i) & (kLineSize - 1)] = tanh((float) sqrt( -2.0f * log( R1 )) * cos( 2.0f * MusKit::PI * R2 ));
+      }
+   }
+
+   bool Done(int v) const
+   {
+      return fRemaining[v] <= 0;
+   }
+
+   void Render(float* out, int frames, int first, float* gain, const float* gainStep)
+   {
+      const unsigned mask = kLineSize - 1;
+      float* lines = fLines + first * kLineSize;
+      unsigned* read = fRead + first;
+      const int* length = fLength + first;
+      const float* feedback = fFeedback + first;
+
+      float g[kLanes];
+      float step[kLanes];
+      for (int lane = 0; lane < kLanes; ++lane)
+      {
+         g[lane] = gain[lane] * fVelocity[first + lane];
+         step[lane] = gainStep[lane] * fVelocity[first + lane];
+      }
+
+      for (int i = 0; i < frames; ++i)
+      {
+         float sum = 0.f;
+         for (int lane = 0; lane < kLanes; ++lane)
+         {
+            float* line = lines + lane * kLineSize;
+            const unsigned r = read[lane] & mask;
+            const unsigned w = (read[lane] + length[lane]) & mask;
+            const float y = line[r];
+            line[w] = (y * feedback[lane] + line[(w - 1) & mask]) * 0.5f;
+            sum += y * g[lane];
+            g[lane] += step[lane];
+            ++read[lane];
+         }
+         out[i] += sum;
+      }
+
+      for (int lane = 0; lane < kLanes; ++lane)
+      {
+         gain[lane] += gainStep[lane] * frames;
+         fRemaining[first + lane] = std::max(fRemaining[first + lane] - frames, 0);
+      }
+   }
+
+private:
+   float* fLines;
+   unsigned fRead[kMaxVoices];
+   int fLength[kMaxVoices];
+   int fRemaining[kMaxVoices];
+   float fFeedback[kMaxVoices];
+   float fVelocity[kMaxVoices];
+};
+
 #endif
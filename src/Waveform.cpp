@@ -0,0 +1,135 @@
+#include "Waveform.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include "SignalGenerators.h"
+
+WaveformPyramid::WaveformPyramid(SampleAccumulator* source, int maxPerLevel)
+: fSource(source)
+, fMaxPerLevel(std::max(maxPerLevel, (int)kFanout))
+, fBaseSamples(source->SamplesPerSummary())
+, fLength(0)
+, fRunning(false)
+{
+}
+
+WaveformPyramid::~WaveformPyramid()
+{
+   Stop();
+}
+
+void WaveformPyramid::Start()
+{
+   if (!fRunning.exchange(true))
+      fThread = std::thread(&WaveformPyramid::Run, this);
+}
+
+void WaveformPyramid::Stop()
+{
+   if (fRunning.exchange(false))
+      fThread.join();
+}
+
+void WaveformPyramid::Run()
+{
+   while (fRunning.load())
+   {
+      Update();
+      std::this_thread::sleep_for(std::chrono::milliseconds(kPollMilliseconds));
+   }
+}
+
+void WaveformPyramid::Update()
+{
+   WaveformSummary summaries[256];
+   size_t n;
+   while ((n = fSource->Read(summaries, 256)) > 0)
+   {
+      std::lock_guard<std::mutex> lock(fLock);
+      for (size_t i = 0; i < n; ++i)
+      {
+         Append(0, summaries[i]);
+      }
+      fLength.store(fLevels[0].fEnd * fBaseSamples, std::memory_order_relaxed);
+   }
+}
+
+void WaveformPyramid::Append(int level, const WaveformSummary& summary)
+{
+   Level& l = fLevels[level];
+   l.fSummaries.push_back(summary);
+   ++l.fEnd;
+   if ((int)l.fSummaries.size() > fMaxPerLevel)
+      l.fSummaries.pop_front();
+
+   // every kFanout summaries make one on the level above
+   if (level + 1 < kNumLevels && l.fEnd % kFanout == 0)
+   {
+      WaveformSummary merged = l.fSummaries[l.fSummaries.size() - kFanout];
+      for (int i = (int)l.fSummaries.size() - kFanout + 1; i < (int)l.fSummaries.size(); ++i)
+      {
+         const WaveformSummary& s = l.fSummaries[i];
+         merged.fMin = std::min(merged.fMin, s.fMin);
+         merged.fMax = std::max(merged.fMax, s.fMax);
+         merged.fMeanSquare += s.fMeanSquare;
+      }
+      merged.fMeanSquare /= kFanout;
+      Append(level + 1, merged);
+   }
+}
+
+SampleTime WaveformPyramid::Oldest() const
+{
+   std::lock_guard<std::mutex> lock(fLock);
+   return fLevels[0].Begin() * fBaseSamples;
+}
+
+void WaveformPyramid::Read(SampleTime start, double samplesPerPixel, int pixels, WaveformSummary* out)
+{
+   std::lock_guard<std::mutex> lock(fLock);
+
+   // coarsest level with summaries no wider than a pixel
+   int level = 0;
+   double resolution = fBaseSamples;
+   while (level + 1 < kNumLevels && resolution * kFanout <= samplesPerPixel)
+   {
+      ++level;
+      resolution *= kFanout;
+   }
+
+   // fall back to coarser levels where the finer ones have dropped history
+   for (int p = 0; p < pixels; ++p)
+   {
+      const double s0 = start + p * samplesPerPixel;
+      const double s1 = s0 + samplesPerPixel;
+
+      out[p] = WaveformSummary();
+
+      int l = level;
+      double r = resolution;
+      while (l + 1 < kNumLevels && s0 < fLevels[l].Begin() * r && fLevels[l + 1].fEnd > 0)
+      {
+         ++l;
+         r *= kFanout;
+      }
+
+      const Level& summaries = fLevels[l];
+      const SampleTime first = std::max((SampleTime)floor(s0 / r), summaries.Begin());
+      const SampleTime last = std::min(std::max((SampleTime)ceil(s1 / r), first + 1), summaries.fEnd);
+      if (first >= last)
+         continue;
+
+      const size_t offset = (size_t)(first - summaries.Begin());
+      WaveformSummary merged = summaries.fSummaries[offset];
+      for (SampleTime i = first + 1; i < last; ++i)
+      {
+         const WaveformSummary& s = summaries.fSummaries[offset + (size_t)(i - first)];
+         merged.fMin = std::min(merged.fMin, s.fMin);
+         merged.fMax = std::max(merged.fMax, s.fMax);
+         merged.fMeanSquare += s.fMeanSquare;
+      }
+      merged.fMeanSquare /= (float)(last - first);
+      out[p] = merged;
+   }
+}
@@ -0,0 +1,102 @@
+#ifndef h_Waveform
+#define h_Waveform
+
+#include <atomic>
+#include <cmath>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "AudioClient.h"
+
+class SampleAccumulator;
+
+// WaveformSummary
+// ----------------
+/// \brief Min, max and mean square of a run of samples.  Plain data (it
+/// goes through a RingBuffer); WaveformSummary() is all zeros.
+struct WaveformSummary
+{
+   float Rms() const { return sqrtf(fMeanSquare); }
+
+   float fMin;
+   float fMax;
+   float fMeanSquare;
+};
+
+// WaveformPyramid
+// ----------------
+/// \brief Multi-resolution history of a SampleAccumulator's summaries, for
+/// drawing waveforms at any zoom.
+///
+/// Level 0 holds the accumulator's summaries as they are; each level above
+/// merges kFanout summaries of the one below.  A background thread drains
+/// the accumulator and extends every level, so Read never rescans audio: it
+/// picks the coarsest level that is still finer than a pixel and merges at
+/// most kFanout summaries per pixel.
+///
+/// Each level keeps its newest maxPerLevel summaries, so fine levels cover
+/// the recent past and coarse ones go back hours.  With 16 samples per
+/// summary and the defaults, level 0 holds about 6 minutes at 44.1kHz and
+/// level 3 over 6 hours.
+///
+/// The pyramid must be the accumulator's only reader (don't also call
+/// SampleAccumulator::Get), and the accumulator's samples per summary
+/// shouldn't change while it runs.
+class WaveformPyramid
+{
+public:
+   enum
+   {
+      kFanout = 4,
+      kNumLevels = 12,
+      kDefaultMaxPerLevel = 1 << 20,
+      kPollMilliseconds = 20
+   };
+
+   WaveformPyramid(SampleAccumulator* source, int maxPerLevel = kDefaultMaxPerLevel);
+   ~WaveformPyramid();
+
+   void Start();
+   void Stop();
+
+   /// Fills pixels summaries of samplesPerPixel samples each, the first
+   /// starting start samples after the accumulator started.  Pixels with no
+   /// history left (or none yet) are zero.
+   void Read(SampleTime start, double samplesPerPixel, int pixels, WaveformSummary* out);
+
+   /// Samples summarized so far
+   SampleTime Length() const { return fLength.load(std::memory_order_relaxed); }
+
+   /// Earliest sample still held at full resolution
+   SampleTime Oldest() const;
+
+   /// Drains the accumulator now (the background thread does this anyway)
+   void Update();
+
+private:
+   struct Level
+   {
+      Level() : fEnd(0) {}
+
+      std::deque<WaveformSummary> fSummaries;
+      SampleTime fEnd;  // index after the last summary ever added
+      SampleTime Begin() const { return fEnd - (SampleTime)fSummaries.size(); }
+   };
+
+   void Append(int level, const WaveformSummary& summary);
+   void Run();
+
+   SampleAccumulator* fSource;
+   const int fMaxPerLevel;
+   int fBaseSamples;  // samples per level 0 summary
+
+   mutable std::mutex fLock;  // guards fLevels
+   Level fLevels[kNumLevels];
+   std::atomic<SampleTime> fLength;
+
+   std::atomic<bool> fRunning;
+   std::thread fThread;
+};
+
+#endif
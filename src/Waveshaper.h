@@ -42,6 +42,8 @@ public:
    
    virtual void Render(float* buffer, int frames)
    {
+      fInterpolator.SetQuality(QualityGovernor::GetInstance()->Quality());
+      
       float input = 0.f;
       double index = 0.f;
       for (int i = 0; i < frames; ++i)
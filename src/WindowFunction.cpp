@@ -1,11 +1,143 @@
-
 #include "WindowFunction.h"
 #include <cmath>
+#include <cstring>
+#include <algorithm>
 #include "MathHelpers.h"
+#include "AlignedMemory.h"
 
 const float    float_E   = 2.71828182845904523536f; 
 
-float** gWindowTables = 0;
+// zeroth order modified bessel function of the first kind, for Kaiser windows
+static double _besselI0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	const double halfX = x / 2.0;
+	for (int k = 1; k < 50; k++) {
+		term *= halfX / k;
+		sum += term * term;
+		if (term * term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+//------ WindowTable ------//
+
+WindowTable::WindowTable(unsigned int type, unsigned int size, float parameter)
+: _data(NULL)
+, _size(size)
+, _type(type)
+, _parameter(parameter)
+{
+	_data = (float*)MusKit::AlignedAlloc((size + 2) * sizeof(float));
+	_generate();
+}
+
+WindowTable::~WindowTable()
+{
+	MusKit::AlignedFree(_data);
+}
+
+void WindowTable::fill(float* dst, int n, double startIndex, double increment) const
+{
+	const float* table = _data;
+
+	// straight copy when the read lines up with the table
+	if (increment == 1.0 && startIndex >= 0 && startIndex + n <= _size
+		&& startIndex == (double)(long)startIndex) {
+		memcpy(dst, table + (long)startIndex, n * sizeof(float));
+		return;
+	}
+
+	// each index is computed from i rather than accumulated, so there is no
+	// loop carried dependency and the compiler is free to vectorize
+	const double last = (double)_size;
+	for (int i = 0; i < n; i++) {
+		double index = std::min(std::max(startIndex + i * increment, 0.0), last);
+		int j = (int)index;
+		float frac = (float)(index - j);
+		dst[i] = table[j] + frac * (table[j + 1] - table[j]);
+	}
+}
+
+//------ WindowTableCache ------//
+
+WindowTableCache* WindowTableCache::GetInstance()
+{
+	// function statics are initialized exactly once, even with concurrent callers
+	static WindowTableCache* sInstance = new WindowTableCache;
+	return sInstance;
+}
+
+WindowTableCache::~WindowTableCache()
+{
+	for (EntryMap::iterator i = _entries.begin(); i != _entries.end(); ++i) {
+		delete (*i).second->table;
+		delete (*i).second;
+	}
+}
+
+bool WindowTableCache::Key::operator<(const Key& other) const
+{
+	if (type != other.type)
+		return type < other.type;
+	if (size != other.size)
+		return size < other.size;
+	return parameter < other.parameter;
+}
+
+float WindowTableCache::getDefaultParameter(unsigned int type)
+{
+	switch (type)
+	{
+	case WindowFunction::kGaussian:
+		return 0.4f;
+	case WindowFunction::kKaiser:
+		return 8.6f;
+	case WindowFunction::kTukey:
+		return 0.5f;
+	default:
+		return 0.f;
+	}
+}
+
+const WindowTable* WindowTableCache::getTable(unsigned int type, unsigned int size)
+{
+	return getTable(type, size, getDefaultParameter(type));
+}
+
+const WindowTable* WindowTableCache::getTable(unsigned int type, unsigned int size, float parameter)
+{
+	Key key;
+	key.type = type;
+	key.size = size;
+	// only parametric windows are distinguished by their parameter
+	key.parameter = (type == WindowFunction::kGaussian || type == WindowFunction::kKaiser
+					 || type == WindowFunction::kTukey) ? parameter : 0.f;
+
+	Entry* entry = NULL;
+	{
+		std::lock_guard<std::mutex> guard(_lock);
+		EntryMap::iterator i = _entries.find(key);
+		if (i == _entries.end()) {
+			entry = new Entry;
+			_entries.insert(std::make_pair(key, entry));
+		}
+		else {
+			entry = (*i).second;
+		}
+	}
+
+	// build outside the map lock so lookups of other tables aren't blocked
+	std::call_once(entry->built, [entry, &key]() {
+		entry->table = new WindowTable(key.type, key.size, key.parameter);
+	});
+
+	return entry->table;
+}
+
+//------ WindowFunction ------//
 
 WindowFunction::WindowFunction(unsigned int size)
 {
@@ -13,13 +145,10 @@ WindowFunction::WindowFunction(unsigned int size)
 	_index = 0;
 	_length = 0;
 	_inc = 0;
-	_windowType = kRectangle;	
+	_windowType = kRectangle;
+	_parameter = 0.f;
+	_table = WindowTableCache::GetInstance()->getTable(_windowType, _windowSize);
 	setWindowLength(4096);  
-	
-	if (!gWindowTables) {
-		_generateWindowTables();
-		//gWindowTables = gWindowTables;
-	}
 }
 
 WindowFunction::~WindowFunction()
@@ -35,7 +164,7 @@ bool WindowFunction::samplesRemain() const
 // maintain the flag, and we can set it via ref param
 bool WindowFunction::getNextSample(float& outSample)
 {
-	outSample = gWindowTables[_windowType][(unsigned int)_index];
+	outSample = _table->getData()[(unsigned int)_index];
 	_index += _inc;
 	
 	bool result = false;
@@ -47,6 +176,34 @@ bool WindowFunction::getNextSample(float& outSample)
 	return result; 
 }
 
+bool WindowFunction::getNextBlock(float* dst, int n)
+{
+	bool result = false;
+	int done = 0;
+	while (done < n) {
+		// samples left before the index passes the end of the table
+		int remain = (int)ceil((_windowSize - _index) / _inc);
+		if (remain < 1)
+			remain = 1;
+		int count = std::min(n - done, remain);
+
+		_table->fill(dst + done, count, _index, _inc);
+		_index += count * _inc;
+		done += count;
+
+		if (_index >= _windowSize) {
+			result = true;
+			_index = 0;
+		}
+	}
+	return result;
+}
+
+void WindowFunction::fill(float* dst, int n, double startIndex, double increment) const
+{
+	_table->fill(dst, n, startIndex, increment);
+}
+
 //void WindowFunction::getNextSample(float& outSample)
 //{	
 //	outSample = gWindowTables[_windowType][(unsigned int)_index];
@@ -67,11 +224,19 @@ void WindowFunction::setWindowLength(unsigned int length)
 void WindowFunction::setWindowType(unsigned int type)
 {
 	_windowType = type;
+	_parameter = WindowTableCache::getDefaultParameter(type);
+	_table = WindowTableCache::GetInstance()->getTable(_windowType, _windowSize, _parameter);
 }
 
-float* WindowFunction::getWindowTable()
+void WindowFunction::setWindowParameter(float parameter)
 {
-	return gWindowTables[_windowType];
+	_parameter = parameter;
+	_table = WindowTableCache::GetInstance()->getTable(_windowType, _windowSize, _parameter);
+}
+
+const float* WindowFunction::getWindowTable() const
+{
+	return _table->getData();
 }
 
 void WindowFunction::setIndex(double index)
@@ -79,114 +244,163 @@ void WindowFunction::setIndex(double index)
 	_index = index;
 }
 
-void WindowFunction::_generateWindowTables()
+void WindowTable::_generate()
 {
-	gWindowTables = new float*[kNumWindowTypes];
-	for (int i = 0; i < kNumWindowTypes; i++) {
-		gWindowTables[i] = new float[_windowSize];
-		switch (i)
+	float* table = _data;
+	switch (_type)
+	{
+	case WindowFunction::kTriangle:
 		{
-		case kTriangle:
-			{
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					if (j < _windowSize / 2)
-						gWindowTables[i][j] = j / (float)(_windowSize / 2);
-					else
-						gWindowTables[i][j] =  1 - ((j - (_windowSize / 2)) /  (float)(_windowSize / 2));
-				}
+			for (unsigned int j = 0; j < _size; j++) {
+				if (j < _size / 2)
+					table[j] = j / (float)(_size / 2);
+				else
+					table[j] =  1 - ((j - (_size / 2)) /  (float)(_size / 2));
 			}
-			break;
-		case kTrapezoid:
-			{
-				unsigned int rampLength = 512;
-				if (_windowSize <= 1024)
-					rampLength = _windowSize / 8;
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					if (j < rampLength)
-						gWindowTables[i][j] = j / (float)(rampLength);
-					else if (j < _windowSize - rampLength)
-						gWindowTables[i][j] = 1.f;
-					else
-						gWindowTables[i][j] = 1 - ((j - (_windowSize - rampLength)) / (float)(rampLength));
-				}
-			}
-			break;			
-		case kRectangle:
-			{
-				 for (unsigned int j = 0; j < _windowSize; j++) {
-						gWindowTables[i][j] = 1.f;
-				}	
+		}
+		break;
+	case WindowFunction::kTrapezoid:
+		{
+			unsigned int rampLength = 512;
+			if (_size <= 1024)
+				rampLength = _size / 8;
+			for (unsigned int j = 0; j < _size; j++) {
+				if (j < rampLength)
+					table[j] = j / (float)(rampLength);
+				else if (j < _size - rampLength)
+					table[j] = 1.f;
+				else
+					table[j] = 1 - ((j - (_size - rampLength)) / (float)(rampLength));
 			}
-			break;
-		case kHamming:
-			{
-				 for (unsigned int j = 0; j < _windowSize; j++) {
-					gWindowTables[i][j] = 0.53836 - 0.46164 * cos((2 * MusKit::PI * j)/(float)(_windowSize - 1));
-				}	
+		}
+		break;			
+	case WindowFunction::kRectangle:
+		{
+			 for (unsigned int j = 0; j < _size; j++) {
+					table[j] = 1.f;
+			}	
+		}
+		break;
+	case WindowFunction::kHamming:
+		{
+			 for (unsigned int j = 0; j < _size; j++) {
+				table[j] = 0.53836 - 0.46164 * cos((2 * MusKit::PI * j)/(float)(_size - 1));
+			}	
+		}
+		break;
+	case WindowFunction::kGaussian:
+		{
+			
+			for (unsigned int j = 0; j < _size; j++) {
+				float x = (j-(_size-1)/2.f) / (_parameter*((_size-1)/2.f));
+				table[j] = pow(float_E, (float)(-0.5 * pow(x, 2.f)));
+			}	
+		}
+		break;
+	case WindowFunction::kHann:
+		{
+			 for (unsigned int j = 0; j < _size; j++) {
+				table[j] = 0.5 * (1 - cos(2 * MusKit::PI * j / (float)(_size - 1)));
+			}	
+		}
+		break;
+	case WindowFunction::kBlackman:
+		{
+			float a0 = 0.42;
+			float a1 = 0.5;
+			float a2 = 0.08;
+			for (unsigned int j = 0; j < _size; j++) {
+				table[j] = a0 - a1 * cos((2 * MusKit::PI * j) / (_size - 1)) + a2 * cos((4 * MusKit::PI * j) / (_size - 1));
+			}	
+		}
+		break;		
+	case WindowFunction::kRampUp:
+		{
+			unsigned int rampLength = 128;
+			if (_size <= 256)
+				rampLength = _size / 8;
+			for (unsigned int j = 0; j < _size; j++) {
+				if (j < _size - rampLength)
+					table[j] = j / (float)(_size - rampLength);
+				else
+					table[j] = 1 - ((j - _size + rampLength) / (float)rampLength);
 			}
-			break;
-		case kGaussian:
-			{
-				
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					float x = (j-(_windowSize-1)/2.f) / (0.4*((_windowSize-1)/2.f));
-					gWindowTables[i][j] = pow(float_E, (float)(-0.5 * pow(x, 2.f)));
-				}	
+		}
+		break;
+	case WindowFunction::kRampDown:
+		{
+			unsigned int rampLength = 128;
+			if (_size <= 256)
+				rampLength = _size / 8;
+			for (unsigned int j = 0; j < _size; j++) {
+				if (j < rampLength)
+					table[j] = j / (float)(rampLength);
+				else
+					table[j] = 1 - (j - rampLength) / (float)(_size - rampLength);
 			}
-			break;
-		case kHann:
-			{
-				 for (unsigned int j = 0; j < _windowSize; j++) {
-					gWindowTables[i][j] = 0.5 * (1 - cos(2 * MusKit::PI * j / (float)(_windowSize - 1)));
-				}	
+		}
+		break;
+	case WindowFunction::kKaiser:
+		{
+			const double denom = _besselI0(_parameter);
+			for (unsigned int j = 0; j < _size; j++) {
+				double x = 2.0 * j / (double)(_size - 1) - 1.0;
+				table[j] = _besselI0(_parameter * sqrt(std::max(0.0, 1.0 - x * x))) / denom;
 			}
-			break;
-		case kBlackman:
-			{
-				float a0 = 0.42;
-				float a1 = 0.5;
-				float a2 = 0.08;
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					gWindowTables[i][j] = a0 - a1 * cos((2 * MusKit::PI * j) / (_windowSize - 1)) + a2 * cos((4 * MusKit::PI * j) / (_windowSize - 1));
-				}	
+		}
+		break;
+	case WindowFunction::kTukey:
+		{
+			const double alpha = std::min(std::max((double)_parameter, 0.0), 1.0);
+			const double edge = alpha * (_size - 1) / 2.0;
+			for (unsigned int j = 0; j < _size; j++) {
+				if (j < edge)
+					table[j] = 0.5 * (1 + cos(MusKit::PI * (j / edge - 1)));
+				else if (j > (_size - 1) - edge)
+					table[j] = 0.5 * (1 + cos(MusKit::PI * ((j - (_size - 1)) / edge + 1)));
+				else
+					table[j] = 1.f;
 			}
-			break;		
-		case kRampUp:
-			{
-				unsigned int rampLength = 128;
-				if (_windowSize <= 256)
-					rampLength = _windowSize / 8;
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					if (j < _windowSize - rampLength)
-						gWindowTables[i][j] = j / (float)(_windowSize - rampLength);
-					else
-						gWindowTables[i][j] = 1 - ((j - _windowSize + rampLength) / (float)rampLength);
-				}
+		}
+		break;
+	case WindowFunction::kBlackmanHarris:
+		{
+			const double a0 = 0.35875;
+			const double a1 = 0.48829;
+			const double a2 = 0.14128;
+			const double a3 = 0.01168;
+			for (unsigned int j = 0; j < _size; j++) {
+				double w = 2 * MusKit::PI * j / (double)(_size - 1);
+				table[j] = a0 - a1 * cos(w) + a2 * cos(2 * w) - a3 * cos(3 * w);
 			}
-			break;
-		case kRampDown:
-			{
-				unsigned int rampLength = 128;
-				if (_windowSize <= 256)
-					rampLength = _windowSize / 8;
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					if (j < rampLength)
-						gWindowTables[i][j] = j / (float)(rampLength);
-					else
-						gWindowTables[i][j] = 1 - (j - rampLength) / (float)(_windowSize - rampLength);
-				}
+		}
+		break;
+	case WindowFunction::kFlatTop:
+		{
+			const double a0 = 0.21557895;
+			const double a1 = 0.41663158;
+			const double a2 = 0.277263158;
+			const double a3 = 0.083578947;
+			const double a4 = 0.006947368;
+			for (unsigned int j = 0; j < _size; j++) {
+				double w = 2 * MusKit::PI * j / (double)(_size - 1);
+				table[j] = a0 - a1 * cos(w) + a2 * cos(2 * w) - a3 * cos(3 * w) + a4 * cos(4 * w);
 			}
-			break;
-		default:
-			{
-				for (unsigned int j = 0; j < _windowSize; j++) {
-					if (j < _windowSize / 2)
-						gWindowTables[i][j] = j / (_windowSize / 2);
-					else
-						gWindowTables[i][j] =  1 - ((j - (_windowSize / 2)) /  (_windowSize / 2));
-				}
-			}	
-			break;	
 		}
+		break;
+	default:
+		{
+			for (unsigned int j = 0; j < _size; j++) {
+				if (j < _size / 2)
+					table[j] = j / (_size / 2);
+				else
+					table[j] =  1 - ((j - (_size / 2)) /  (_size / 2));
+			}
+		}	
+		break;	
 	}
-}
\ No newline at end of file
+
+	// guard points so interpolated reads at the very end stay in bounds
+	table[_size] = table[_size - 1];
+	table[_size + 1] = table[_size - 1];
+}
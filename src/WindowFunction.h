@@ -1,51 +1,141 @@
 #ifndef WINDOWFUNCDISPLAY_H
 #define WINDOWFUNCDISPLAY_H
 
+#include <map>
+#include <mutex>
+
+/// \brief WindowTable
+/// An immutable, cache-line aligned window table.  Tables are only created
+/// by WindowTableCache and live for the life of the program, so pointers to
+/// them can be held and shared across threads freely.
+class WindowTable
+{
+public:
+	const float* getData() const { return _data; }
+	unsigned int getSize() const { return _size; }
+	unsigned int getType() const { return _type; }
+	float getParameter() const { return _parameter; }
+
+	// Resampled block read: dst[i] = table(startIndex + i * increment) with
+	// linear interpolation.  Indices are clamped to the table, so reading past
+	// the end holds the last value.
+	void fill(float* dst, int n, double startIndex, double increment) const;
+
+private:
+	friend class WindowTableCache;
+
+	WindowTable(unsigned int type, unsigned int size, float parameter);
+	~WindowTable();
+
+	void _generate();
+
+	float* _data;
+	unsigned int _size;
+	unsigned int _type;
+	float _parameter;
+};
+
+/// \brief WindowTableCache
+/// Process-wide cache of window tables keyed by (type, size, parameter).
+///
+/// Tables are built lazily the first time they are asked for, exactly once
+/// even if several threads ask at the same time.  Building a table allocates,
+/// so look up tables ahead of time rather than on the audio thread.
+class WindowTableCache
+{
+public:
+	static WindowTableCache* GetInstance();
+
+	const WindowTable* getTable(unsigned int type, unsigned int size);
+	const WindowTable* getTable(unsigned int type, unsigned int size, float parameter);
+
+	// parameter used when none is given: Gaussian sigma, Kaiser beta, Tukey alpha
+	static float getDefaultParameter(unsigned int type);
+
+private:
+	WindowTableCache() {}
+	~WindowTableCache();
+
+	struct Key
+	{
+		unsigned int type;
+		unsigned int size;
+		float parameter;
+		bool operator<(const Key& other) const;
+	};
+
+	struct Entry
+	{
+		Entry() : table(NULL) {}
+		std::once_flag built;
+		WindowTable* table;
+	};
+
+	typedef std::map<Key, Entry*> EntryMap;
+	EntryMap _entries;
+	std::mutex _lock;
+};
+
 /// \brief WindowFunction
 /// Class to maintain window function tables
 // and provide a simple "getNextSample" interface.
 // This comes at a price (per-sample function calls)
+//
+// Tables come from WindowTableCache, so every instance reads a table of its
+// own size.  getNextBlock/fill hand out whole blocks for callers that can't
+// afford a call per sample.
 
 // speedups:
-// - provide references to the tables and make the caller deal with indexing
-// - give the caller data on a per-block basis
-//     - copy table portions
-//     - give pointer into table? (still need to wrap..)
 // - enforce power of 2 table size and use mask to wrap index
 
 class WindowFunction
 {
-public: 
+public:
 	WindowFunction(unsigned int size);
 	~WindowFunction();
-	
+
 	// both versions of getNextSample reset the index when necessary.
 	// The parameterless version assumes you don't need to know when the
 	// end is reached, although you can use samplesRemain() to find this out.
 	// to avoid making this function every time you call getNextSample(),
 	// the other version does the comparison internally.
-	
+
 	//void getNextSample(float& outSample);
-	
+
 	// returns true if the last sample is reached
 	bool getNextSample(float& outSample);
-	
+
+	// block version of getNextSample: fills n samples and advances the index.
+	// returns true if the end of the window was reached (the index resets).
+	bool getNextBlock(float* dst, int n);
+
+	// resampled read from the current table, see WindowTable::fill
+	void fill(float* dst, int n, double startIndex, double increment) const;
+
 	bool samplesRemain() const;
-	
+
+	// may build a table, don't call from the audio thread
 	void setWindowType(unsigned int type);
-	
+
 	unsigned int getWindowType() const { return _windowType; }
-	
+
+	// shape parameter for Gaussian, Kaiser and Tukey windows
+	// may build a table, don't call from the audio thread
+	void setWindowParameter(float parameter);
+
+	float getWindowParameter() const { return _parameter; }
+
 	// set number of samples required, resets index
 	void setWindowLength(unsigned int length);
-	
+
 	// functions to optimize (but not safe!)
-	float* getWindowTable();
+	const float* getWindowTable() const;
+	const WindowTable* getTable() const { return _table; }
 	double getCurrentIndex() const { return _index; }
 	void setIndex(double index);
 	int getWindowSize() const { return _windowSize; }
 	int getWindowLength() const { return _length; }
-	
+
 	enum WindowTypes
 	{
 		kRectangle = 0,
@@ -57,9 +147,13 @@ public:
 		kBlackman,
 		kRampDown,
 		kRampUp,
+		kKaiser,
+		kTukey,
+		kBlackmanHarris,
+		kFlatTop,
 		kNumWindowTypes
 	};
-	
+
 private:
 
 	double _inc;
@@ -67,9 +161,9 @@ private:
 	unsigned int _length;
 	unsigned int _windowType;
 	unsigned int _windowSize;
-	
-	// only the first instance should call this.
-	void _generateWindowTables();
+	float _parameter;
+
+	const WindowTable* _table;
 };
 
-#endif
\ No newline at end of file
+#endif